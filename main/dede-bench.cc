@@ -0,0 +1,288 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Load-testing harness: drives /predict calls against a service, either
+ * in-process through the JSON API, or over HTTP against a running dede server,
+ * at a fixed concurrency (closed loop) or at a fixed arrival rate (open loop),
+ * and reports throughput and latency percentiles.
+ *
+ * e.g. in-process:
+ *   ./dede-bench -service_name mnist -service_create "$(cat create.json)" -service_predict "$(cat predict.json)" -concurrency 4 -requests 1000
+ * e.g. over HTTP, replaying a file with one predict JSON call per line, at 50 req/s:
+ *   ./dede-bench -bench_url http://localhost:8080 -payloads predict_calls.txt -rate 50 -requests 5000
+ */
+
+#include "jsonapi.h"
+#include "utils/httpclient.hpp"
+#include "ext/rapidjson/document.h"
+#include "ext/rapidjson/stringbuffer.h"
+#include "ext/rapidjson/writer.h"
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace dd;
+
+// reuse the JSON command line API flags for service and predict calls
+DECLARE_string(service_create);
+DECLARE_string(service_name);
+DECLARE_string(service_predict);
+
+DEFINE_string(payloads,"","file holding predict JSON calls to replay, one per line");
+DEFINE_string(bench_url,"","URL of a running dede server, e.g. http://localhost:8080 (in-process if empty)");
+DEFINE_int32(concurrency,1,"number of concurrent clients");
+DEFINE_double(rate,0.0,"fixed arrival rate in requests per second (0: closed loop at fixed concurrency)");
+DEFINE_int32(requests,100,"number of timed predict calls");
+DEFINE_int32(warmup,5,"number of untimed predict calls before the benchmark starts");
+DEFINE_int32(batch_size,0,"replicate the data of every payload up to this batch size (0: payloads as is)");
+DEFINE_bool(keep_service,false,"whether to keep the service once the benchmark is over");
+
+typedef std::chrono::steady_clock bench_clock;
+
+/**
+ * \brief prepares a predict call: sets the service name and resizes the data
+ *        to the requested batch size
+ */
+static std::string prepare_payload(const std::string &payload,
+				   int &nsamples)
+{
+  rapidjson::Document d;
+  d.Parse(payload.c_str());
+  if (d.HasParseError() || !d.IsObject())
+    {
+      LOG(ERROR) << "JSON parsing error on predict call: " << payload << std::endl;
+      return "";
+    }
+  if (!FLAGS_service_name.empty())
+    {
+      if (d.HasMember("service"))
+	d["service"].SetString(FLAGS_service_name.c_str(),d.GetAllocator());
+      else d.AddMember("service",rapidjson::Value().SetString(FLAGS_service_name.c_str(),d.GetAllocator()),d.GetAllocator());
+    }
+  nsamples = 1;
+  if (d.HasMember("data") && d["data"].IsArray() && !d["data"].Empty())
+    {
+      rapidjson::Value &data = d["data"];
+      if (FLAGS_batch_size > 0)
+	{
+	  int dsize = data.Size();
+	  while (static_cast<int>(data.Size()) < FLAGS_batch_size)
+	    {
+	      rapidjson::Value v(data[data.Size()%dsize],d.GetAllocator());
+	      data.PushBack(v,d.GetAllocator());
+	    }
+	  while (static_cast<int>(data.Size()) > FLAGS_batch_size)
+	    data.PopBack();
+	}
+      nsamples = data.Size();
+    }
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  d.Accept(writer);
+  return buffer.GetString();
+}
+
+/**
+ * \brief runs a single predict call, returns the status code
+ */
+static int predict_call(JsonAPI &japi,
+			const std::string &payload)
+{
+  if (FLAGS_bench_url.empty())
+    {
+      JDoc jd = japi.service_predict(payload);
+      return jd["status"]["code"].GetInt();
+    }
+  int code = -1;
+  std::string outstr;
+  try
+    {
+      httpclient::post_call(FLAGS_bench_url + "/predict",payload,"POST",code,outstr);
+    }
+  catch (std::exception &e)
+    {
+      LOG(ERROR) << "predict call error: " << e.what() << std::endl;
+    }
+  return code;
+}
+
+static double percentile(const std::vector<double> &sorted_lat,
+			 const double &p)
+{
+  if (sorted_lat.empty())
+    return 0.0;
+  size_t idx = static_cast<size_t>(p * (sorted_lat.size()-1) + 0.5);
+  return sorted_lat.at(std::min(idx,sorted_lat.size()-1));
+}
+
+int main(int argc, char *argv[])
+{
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  // payloads
+  std::vector<std::string> raw_payloads;
+  if (!FLAGS_payloads.empty())
+    {
+      std::ifstream inf(FLAGS_payloads);
+      if (!inf.is_open())
+	{
+	  LOG(ERROR) << "cannot open payloads file " << FLAGS_payloads << std::endl;
+	  return 1;
+	}
+      std::string line;
+      while (std::getline(inf,line))
+	if (!line.empty())
+	  raw_payloads.push_back(line);
+    }
+  else if (!FLAGS_service_predict.empty())
+    raw_payloads.push_back(FLAGS_service_predict);
+  if (raw_payloads.empty())
+    {
+      LOG(ERROR) << "no predict call, use -service_predict or -payloads" << std::endl;
+      return 1;
+    }
+  std::vector<std::string> payloads;
+  std::vector<int> payloads_samples;
+  for (const std::string &p: raw_payloads)
+    {
+      int nsamples = 0;
+      std::string pp = prepare_payload(p,nsamples);
+      if (pp.empty())
+	return 1;
+      payloads.push_back(pp);
+      payloads_samples.push_back(nsamples);
+    }
+
+  // service
+  JsonAPI japi;
+  if (!FLAGS_service_create.empty())
+    {
+      if (FLAGS_service_name.empty())
+	{
+	  LOG(ERROR) << "service creation requires -service_name" << std::endl;
+	  return 1;
+	}
+      int code = -1;
+      std::string outstr;
+      if (FLAGS_bench_url.empty())
+	{
+	  JDoc jd = japi.service_create(FLAGS_service_name,FLAGS_service_create);
+	  code = jd["status"]["code"].GetInt();
+	  outstr = japi.jrender(jd);
+	}
+      else httpclient::post_call(FLAGS_bench_url + "/services/" + FLAGS_service_name,FLAGS_service_create,"PUT",code,outstr);
+      if (code != 201)
+	{
+	  LOG(ERROR) << "service creation failed: " << outstr << std::endl;
+	  return 1;
+	}
+    }
+
+  // warmup, e.g. loads the model
+  for (int i=0;i<FLAGS_warmup;i++)
+    predict_call(japi,payloads.at(i%payloads.size()));
+
+  // benchmark
+  int concurrency = std::max(1,FLAGS_concurrency);
+  std::vector<double> latencies(FLAGS_requests,0.0);
+  std::atomic<int> next_req = {0};
+  std::atomic<int> errors = {0};
+  std::atomic<long int> samples = {0};
+  bench_clock::time_point tstart = bench_clock::now();
+  auto worker = [&]()
+    {
+      int r = 0;
+      while ((r = next_req++) < FLAGS_requests)
+	{
+	  bench_clock::time_point tsched = bench_clock::now();
+	  if (FLAGS_rate > 0.0)
+	    {
+	      // open loop: latency accounts for the time spent waiting for a free client
+	      tsched = tstart + std::chrono::microseconds(static_cast<long int>(r * 1e6 / FLAGS_rate));
+	      std::this_thread::sleep_until(tsched);
+	    }
+	  int code = predict_call(japi,payloads.at(r%payloads.size()));
+	  bench_clock::time_point tstop = bench_clock::now();
+	  latencies.at(r) = std::chrono::duration_cast<std::chrono::microseconds>(tstop-tsched).count() / 1000.0;
+	  if (code != 200)
+	    ++errors;
+	  else samples += payloads_samples.at(r%payloads.size());
+	}
+    };
+  std::vector<std::thread> clients;
+  for (int c=0;c<concurrency;c++)
+    clients.push_back(std::thread(worker));
+  for (std::thread &t: clients)
+    t.join();
+  double elapsed = std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now()-tstart).count() / 1e6;
+
+  // report
+  std::sort(latencies.begin(),latencies.end());
+  double mean = 0.0;
+  for (double l: latencies)
+    mean += l;
+  if (!latencies.empty())
+    mean /= static_cast<double>(latencies.size());
+  APIData ad_report;
+  ad_report.add("mode",FLAGS_bench_url.empty() ? std::string("inprocess") : std::string("http"));
+  ad_report.add("concurrency",concurrency);
+  ad_report.add("rate",FLAGS_rate);
+  ad_report.add("requests",FLAGS_requests);
+  ad_report.add("errors",errors.load());
+  ad_report.add("elapsed",elapsed);
+  ad_report.add("throughput",elapsed > 0.0 ? FLAGS_requests / elapsed : 0.0);
+  ad_report.add("samples_per_sec",elapsed > 0.0 ? samples.load() / elapsed : 0.0);
+  APIData ad_lat;
+  ad_lat.add("mean",mean);
+  ad_lat.add("p50",percentile(latencies,0.50));
+  ad_lat.add("p90",percentile(latencies,0.90));
+  ad_lat.add("p95",percentile(latencies,0.95));
+  ad_lat.add("p99",percentile(latencies,0.99));
+  ad_lat.add("max",latencies.empty() ? 0.0 : latencies.back());
+  ad_report.add("latency",ad_lat);
+  JDoc jd;
+  jd.SetObject();
+  ad_report.toJDoc(jd);
+  std::cout << japi.jrender(jd) << std::endl;
+
+  // cleanup
+  if (!FLAGS_service_create.empty() && !FLAGS_keep_service)
+    {
+      std::string jclear = "{\"clear\":\"mem\"}";
+      if (FLAGS_bench_url.empty())
+	japi.service_delete(FLAGS_service_name,jclear);
+      else
+	{
+	  int code = -1;
+	  std::string outstr;
+	  httpclient::get_call(FLAGS_bench_url + "/services/" + FLAGS_service_name + "?clear=mem","DELETE",code,outstr);
+	}
+    }
+  return errors.load() > 0 ? 2 : 0;
+}
@@ -65,6 +65,29 @@ namespace dd
 
     void reset_dv_test() {}
 
+    /**
+     * \brief number of training samples kept by the connector in its own representation,
+     *        to be pulled as Datum on demand, 0 if none
+     */
+    size_t train_size() const
+    {
+      return 0;
+    }
+
+    /**
+     * \brief converts training samples to Datum on demand, so that mini-batches are pulled
+     *        from the connector instead of holding the whole training set as Datum
+     * @param ids indices of the samples, below train_size()
+     * @param dv Datum of the samples, in the order of ids
+     * @see CaffeMemoryFeeder
+     */
+    void get_dv_train(const std::vector<size_t> &ids,
+		      std::vector<caffe::Datum> &dv)
+    {
+      (void)ids;
+      (void)dv;
+    }
+
     // write class weights to binary proto
     void write_class_weights(const std::string &model_repo,
 			     const APIData &ad_mllib);
@@ -78,6 +101,7 @@ namespace dd
     bool _flat1dconv = false; /**< whether a 1D convolution model. */
     bool _has_mean_file = false; /**< image model mean.binaryproto. */
     bool _sparse = false; /**< whether to use sparse representation. */
+    bool _train_pull = false; /**< whether training samples are kept by the connector and pulled with get_dv_train, instead of filling up _dv. */
     std::unordered_map<std::string,std::pair<int,int>> _imgs_size; /**< image sizes, used in detection. */
     std::string _dbfullname = "train.lmdb";
     std::string _test_dbfullname = "test.lmdb";
@@ -376,6 +400,8 @@ namespace dd
     {
       if (_db_batchsize > 0)
 	return _db_batchsize;
+      else if (_train_pull)
+	return train_size();
       else return _dv.size();
     }
 
@@ -427,24 +453,13 @@ namespace dd
 	      throw;
 	    }
 	  
-	  // transform to datum by filling up float_data
-	  if (_train)
+	  // transform to datum by filling up float_data, unless pulled by mini-batches
+	  if (_train && !_train_pull)
 	    {
 	      auto hit = _csvdata.begin();
 	      while(hit!=_csvdata.end())
 		{
-		  if (_label.size() == 1)
-		    _dv.push_back(to_datum((*hit)._v));
-		  else // multi labels or autoencoder
-		    {
-		      caffe::Datum dat = to_datum((*hit)._v,true);
-		      for (size_t i=0;i<_label_pos.size();i++) // concat labels and slice them out in the network itself
-			{
-			  dat.add_float_data(static_cast<float>((*hit)._v.at(_label_pos[i])));
-			}
-		      dat.set_channels(dat.channels()+_label.size());
-		      _dv.push_back(dat);
-		    }
+		  _dv.push_back(to_train_datum((*hit)._v));
 		  _ids.push_back((*hit)._str);
 		  ++hit;
 		}
@@ -459,7 +474,8 @@ namespace dd
 		}
 	      _csvdata_test = std::move(_csvdata);
 	    }
-	  else _csvdata.clear();
+	  else if (!_train_pull)
+	    _csvdata.clear();
 	  auto hit = _csvdata_test.begin();
 	  while(hit!=_csvdata_test.end())
 	    {
@@ -509,6 +525,35 @@ namespace dd
 
     void reset_dv_test();
 
+    size_t train_size() const
+    {
+      return _train_pull && !_db ? _csvdata.size() : 0;
+    }
+
+    void get_dv_train(const std::vector<size_t> &ids,
+		      std::vector<caffe::Datum> &dv)
+    {
+      for (size_t i: ids)
+	dv.push_back(to_train_datum(_csvdata.at(i)._v));
+    }
+
+    /**
+     * \brief turns a vector of values into a training Datum, with multiple labels
+     *        or autoencoder targets concatenated to the data
+     * @param vector of values
+     * @return datum
+     */
+    caffe::Datum to_train_datum(const std::vector<double> &vf)
+    {
+      if (_label.size() == 1)
+	return to_datum(vf);
+      caffe::Datum dat = to_datum(vf,true);
+      for (size_t i=0;i<_label_pos.size();i++) // concat labels and slice them out in the network itself
+	dat.add_float_data(static_cast<float>(vf.at(_label_pos[i])));
+      dat.set_channels(dat.channels()+_label.size());
+      return dat;
+    }
+
     /**
      * \brief turns a vector of values into a Caffe Datum structure
      * @param vector of values
@@ -628,6 +673,8 @@ namespace dd
     {
       if (_db_batchsize > 0)
 	return _db_batchsize;
+      else if (_train_pull && !_sparse)
+	return train_size();
       else if (!_sparse)
 	return _dv.size();
       else return _dv_sparse.size();
@@ -687,7 +734,7 @@ namespace dd
 	{
 	  TxtInputFileConn::transform(ad);
 	  
-	  if (_train)
+	  if (_train && !(_train_pull && !_sparse)) // dense datum are otherwise pulled by mini-batches
 	    {
 	      auto hit = _txt.begin();
 	      while(hit!=_txt.end())
@@ -796,6 +843,22 @@ namespace dd
       _test_db_cursor = std::unique_ptr<caffe::db::Cursor>();
       _test_db = std::unique_ptr<caffe::db::DB>();
     }
+
+    size_t train_size() const
+    {
+      return _train_pull && !_sparse && !_db ? _txt.size() : 0;
+    }
+
+    void get_dv_train(const std::vector<size_t> &ids,
+		      std::vector<caffe::Datum> &dv)
+    {
+      for (size_t i: ids)
+	{
+	  if (_characters)
+	    dv.push_back(to_datum<TxtCharEntry>(static_cast<TxtCharEntry*>(_txt.at(i))));
+	  else dv.push_back(to_datum<TxtBowEntry>(static_cast<TxtBowEntry*>(_txt.at(i))));
+	}
+    }
     
     template<class TEntry> caffe::Datum to_datum(TEntry *tbe)
       {
@@ -25,10 +25,18 @@
 #include "generators/net_caffe.h"
 #include "generators/net_caffe_convnet.h"
 #include "generators/net_caffe_resnet.h"
+#include "caffememoryfeeder.h"
+#include "caffe/sgd_solvers.hpp"
 #include "utils/fileops.hpp"
 #include "utils/utils.hpp"
+#include "utils/bbox.hpp"
+#include "threadbudget.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <thread>
 
 using caffe::Caffe;
 using caffe::Net;
@@ -38,6 +46,79 @@ using caffe::Datum;
 namespace dd
 {
 
+  /**
+   * \brief merges the detections of the tiles of an image back into the image
+   *        coordinates, overlapping detections across tile borders are suppressed
+   * @param vrad per-tile results, tiles are keyed by uri#tile=x,y
+   * @param nms_threshold IoU beyond which the detection with lower probability is removed
+   * @param top_k maximum number of detections per image, -1 for no limit
+   */
+  static void merge_tiles(std::vector<APIData> &vrad, const double &nms_threshold, const int &top_k)
+  {
+    if (std::none_of(vrad.begin(),vrad.end(),[](const APIData &rad)
+		     { return rad.get("uri").get<std::string>().find("#tile=") != std::string::npos; }))
+      return;
+    std::vector<APIData> merged;
+    std::vector<std::vector<bbox>> mboxes;
+    std::unordered_map<std::string,size_t> mpos;
+    for (APIData &rad: vrad)
+      {
+	std::string uri = rad.get("uri").get<std::string>();
+	size_t tpos = uri.rfind("#tile=");
+	if (tpos == std::string::npos)
+	  {
+	    merged.push_back(rad);
+	    mboxes.push_back(std::vector<bbox>());
+	    continue;
+	  }
+	int x = 0, y = 0;
+	sscanf(uri.c_str()+tpos+6,"%d,%d",&x,&y);
+	std::string base = uri.substr(0,tpos);
+	auto mit = mpos.find(base);
+	if (mit == mpos.end())
+	  {
+	    APIData mrad;
+	    mrad.add("uri",base);
+	    mrad.add("loss",0.0);
+	    mit = mpos.insert(std::pair<std::string,size_t>(base,merged.size())).first;
+	    merged.push_back(mrad);
+	    mboxes.push_back(std::vector<bbox>());
+	  }
+	std::vector<double> probs = rad.get("probs").get<std::vector<double>>();
+	std::vector<std::string> cats = rad.get("cats").get<std::vector<std::string>>();
+	std::vector<APIData> bboxes = rad.getv("bboxes");
+	for (size_t k=0;k<bboxes.size();k++)
+	  mboxes.at((*mit).second).push_back(bbox(bboxes.at(k).get("xmin").get<double>()+x,
+						    bboxes.at(k).get("ymax").get<double>()+y,
+						    bboxes.at(k).get("xmax").get<double>()+x,
+						    bboxes.at(k).get("ymin").get<double>()+y,
+						    probs.at(k),cats.at(k)));
+      }
+    for (auto &mp: mpos)
+      {
+	const std::vector<bbox> &boxes = mboxes.at(mp.second);
+	std::vector<double> probs;
+	std::vector<std::string> cats;
+	std::vector<APIData> bboxes;
+	for (size_t k: bbox::nms(boxes,nms_threshold,true,top_k))
+	  {
+	    probs.push_back(boxes.at(k)._prob);
+	    cats.push_back(boxes.at(k)._cat);
+	    APIData ad_bbox;
+	    ad_bbox.add("xmin",boxes.at(k)._xmin);
+	    ad_bbox.add("ymax",boxes.at(k)._ymin);
+	    ad_bbox.add("xmax",boxes.at(k)._xmax);
+	    ad_bbox.add("ymin",boxes.at(k)._ymax);
+	    bboxes.push_back(ad_bbox);
+	  }
+	APIData &mrad = merged.at(mp.second);
+	mrad.add("probs",probs);
+	mrad.add("cats",cats);
+	mrad.add("bboxes",bboxes);
+      }
+    vrad = merged;
+  }
+
   template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
   CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::CaffeLib(const CaffeModel &cmodel)
     :MLLib<TInputConnectorStrategy,TOutputConnectorStrategy,CaffeModel>(cmodel)
@@ -57,12 +138,15 @@ namespace dd
     _regression = cl._regression;
     _ntargets = cl._ntargets;
     _autoencoder = cl._autoencoder;
+    _batch_buckets = cl._batch_buckets;
+    _pnets = std::move(cl._pnets);
     cl._net = nullptr;
   }
 
   template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
   CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::~CaffeLib()
   {
+    _pnets.clear();
     delete _net;
     _net = nullptr;
   }
@@ -264,6 +348,7 @@ namespace dd
     // create net and fill it up
     if (!this->_mlmodel._def.empty() && !this->_mlmodel._weights.empty())
       {
+	_pnets.clear();
 	delete _net;
 	_net = nullptr;
 	try
@@ -299,6 +384,19 @@ namespace dd
 	    // nets can be exotic, let's make sure we don't get killed here
 	    LOG(ERROR) << "failed computing net's complexity";
 	  }
+	if (test)
+	  {
+	    try
+	      {
+		preallocate_buckets(_net);
+	      }
+	    catch(std::exception &e)
+	      {
+		delete _net;
+		_net = nullptr;
+		throw;
+	      }
+	  }
 	return 0;
       }
     // net definition is missing
@@ -338,6 +436,15 @@ namespace dd
       _ntargets = ad.get("ntargets").get<int>();
     if (ad.has("autoencoder") && ad.get("autoencoder").get<bool>())
       _autoencoder = true;
+    if (ad.has("batch_buckets"))
+      {
+	_batch_buckets = ad.get("batch_buckets").get<std::vector<int>>();
+	for (int b: _batch_buckets)
+	  if (b <= 0)
+	    throw MLLibBadParamException("batch_buckets must be strictly positive");
+	std::sort(_batch_buckets.begin(),_batch_buckets.end());
+	_batch_buckets.erase(std::unique(_batch_buckets.begin(),_batch_buckets.end()),_batch_buckets.end());
+      }
     if (!_autoencoder && _nclasses == 0)
       throw MLLibBadParamException("number of classes is unknown (nclasses == 0)");
     if (_regression && _ntargets == 0)
@@ -376,6 +483,13 @@ namespace dd
     this->_inputc._dv_test_sparse.clear();
     this->_inputc._ids.clear();
     inputc._train = true;
+    APIData ad_mllib = ad.getobj("parameters").getobj("mllib");
+
+    // with prefetching, training samples stay in the connector and mini-batches are pulled from it
+    bool prefetch = false;
+    if (ad_mllib.has("prefetch"))
+      prefetch = ad_mllib.get("prefetch").get<bool>();
+    inputc._train_pull = prefetch;
     APIData cad = ad;
     cad.add("has_mean_file",this->_mlmodel._has_mean_file);
     try
@@ -389,7 +503,6 @@ namespace dd
     
     // instantiate model template here, as a defered from service initialization
     // since inputs are necessary in order to fit the inner net input dimension.
-    APIData ad_mllib = ad.getobj("parameters").getobj("mllib");
     if (!this->_mlmodel._model_template.empty())
       {
 	// modifies model structure, template must have been copied at service creation with instantiate_template
@@ -508,7 +621,60 @@ namespace dd
 	delete solver;
 	throw;
       }
-    if (!inputc._dv.empty() || !inputc._dv_sparse.empty())
+
+    // CPU data-parallel training: worker nets share the solver net's weights and
+    // each process a shard of every mini-batch
+    int cpu_workers = 1;
+    if (ad_mllib.has("cpu_workers"))
+      cpu_workers = ad_mllib.get("cpu_workers").get<int>();
+    if (prefetch)
+      {
+	if (inputc._sparse || cpu_workers > 1)
+	  {
+	    delete solver;
+	    throw MLLibBadParamException("prefetch requires dense training data and a single CPU worker");
+	  }
+	if (inputc.train_size() == 0)
+	  {
+	    LOG(WARNING) << "prefetch requires training data held by the input connector, the data layer reads from the db, ignoring";
+	    prefetch = false;
+	  }
+      }
+    if (cpu_workers > 1)
+      {
+	if (Caffe::mode() != Caffe::CPU)
+	  {
+	    LOG(WARNING) << "cpu_workers is ignored in GPU mode";
+	    cpu_workers = 1;
+	  }
+	else if (inputc._sparse || inputc._dv.empty())
+	  {
+	    LOG(WARNING) << "cpu_workers requires dense in-memory training data, ignoring";
+	    cpu_workers = 1;
+	  }
+	else if (batch_size % cpu_workers != 0)
+	  {
+	    LOG(WARNING) << "cpu_workers=" << cpu_workers << " does not divide batch_size=" << batch_size << ", ignoring";
+	    cpu_workers = 1;
+	  }
+	else
+	  {
+	    // running statistics would be shared and written concurrently by all workers
+	    for (const boost::shared_ptr<caffe::Layer<float>> &l: solver->net()->layers())
+	      if (std::string(l->type()) == "BatchNorm")
+		{
+		  delete solver;
+		  throw MLLibBadParamException("cpu_workers does not support nets with BatchNorm layers");
+		}
+	  }
+      }
+    std::vector<std::unique_ptr<caffe::Net<float>>> wnets; // owned, released along with the train call
+    std::unique_ptr<WorkerPool> wpool; // persistent worker threads, one per worker net
+
+    // prefetching of mini-batches in background, instead of filling up the net with the whole dataset
+    std::unique_ptr<CaffeMemoryFeeder> feeder;
+    
+    if (!inputc._dv.empty() || !inputc._dv_sparse.empty() || prefetch)
       {
 	LOG(INFO) << "filling up net prior to training\n";
 	try {
@@ -519,7 +685,23 @@ namespace dd
 		  delete solver;
 		  throw MLLibBadParamException("solver's net's first layer is required to be of MemoryData type");
 		}
-	      boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(solver->net()->layers()[0])->AddDatumVector(inputc._dv);
+	      if (cpu_workers > 1)
+		{
+		  create_cpu_workers(solver,solver_param,inputc._dv,batch_size/cpu_workers,cpu_workers,wnets);
+		  wpool.reset(new WorkerPool(cpu_workers-1,0));
+		}
+	      else if (prefetch)
+		{
+		  boost::shared_ptr<caffe::MemoryDataLayer<float>> feeder_layer = boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(solver->net()->layers()[0]);
+		  feeder.reset(new CaffeMemoryFeeder([&inputc](const std::vector<size_t> &ids, std::vector<caffe::Datum> &dv)
+						     {
+						       inputc.get_dv_train(ids,dv);
+						     },
+						     inputc.train_size(),feeder_layer->layer_param().transform_param(),
+						     feeder_layer->batch_size(),true));
+		  feeder->start();
+		}
+	      else boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(solver->net()->layers()[0])->AddDatumVector(inputc._dv);
 	    }
 	  else
 	    {
@@ -588,44 +770,88 @@ namespace dd
     std::vector<float> losses;
     this->clear_all_meas_per_iter();
     float smoothed_loss = 0.0;
+
+    // background testing, the test net holds its own copy of the weights
+    bool test_async = false;
+    if (ad_solver.has("test_async"))
+      test_async = ad_solver.get("test_async").get<bool>();
+    int test_threads = 1; // background test runs on its own thread budget, away from training
+    if (ad_solver.has("test_threads"))
+      test_threads = ad_solver.get("test_threads").get<int>();
+    std::future<void> test_future;
+    Caffe::Brew test_mode = Caffe::mode();
+
+    // snapshots are staged in memory and written to disk in background
+    bool snapshot_async = true;
+    if (ad_solver.has("snapshot_async"))
+      snapshot_async = ad_solver.get("snapshot_async").get<bool>();
+    std::future<void> snapshot_future;
     while(solver->iter_ < solver->param_.max_iter()
 	  && this->_tjob_running.load())
       {
 	this->add_meas("iteration",solver->iter_);
 
 	solver->net_->ClearParamDiffs();
+	for (std::unique_ptr<caffe::Net<float>> &wnet: wnets)
+	  wnet->ClearParamDiffs();
 	
 	// Save a snapshot if needed.
 	if (solver->param_.snapshot() && solver->iter_ > start_iter &&
 	    solver->iter_ % solver->param_.snapshot() == 0) {
-	  solver->Snapshot();
+	  if (snapshot_async)
+	    snapshot(solver,snapshot_future);
+	  else solver->Snapshot();
 	}
 	if (solver->param_.test_interval() && solver->iter_ % solver->param_.test_interval() == 0
 	    && (solver->iter_ > 0 || solver->param_.test_initialization())) 
 	  {
-	    APIData meas_out;
-	    solver->test_nets().at(0).get()->ShareTrainedLayersWith(solver->net().get());
-	    test(solver->test_nets().at(0).get(),ad,inputc,test_batch_size,has_mean_file,meas_out);
-	    APIData meas_obj = meas_out.getobj("measure");
-	    std::vector<std::string> meas_str = meas_obj.list_keys();
 	    LOG(INFO) << "batch size=" << batch_size;
-	    for (auto m: meas_str)
+	    if (!test_async)
 	      {
-		if (m != "cmdiag" && m != "cmfull" && m != "labels") // do not report confusion matrix in server logs
+		APIData meas_out;
+		solver->test_nets().at(0).get()->ShareTrainedLayersWith(solver->net().get());
+		test(solver->test_nets().at(0).get(),ad,inputc,test_batch_size,has_mean_file,meas_out);
+		report_test_measures(meas_out,false);
+	      }
+	    else if (test_future.valid()
+		     && test_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+	      {
+		LOG(INFO) << "background test still running, skipping test at iteration " << solver->iter_;
+	      }
+	    else
+	      {
+		try
 		  {
-		    double mval = meas_obj.get(m).get<double>();
-		    LOG(INFO) << m << "=" << mval;
-		    this->add_meas(m,mval);
-		    this->add_meas_per_iter(m,mval);
+		    if (test_future.valid())
+		      test_future.get(); // rethrows errors from the previous test
+		    copy_trained_layers(solver->net().get(),solver->test_nets().at(0).get());
 		  }
-		else if (m == "cmdiag")
+		catch(std::exception &e)
 		  {
-		    std::vector<double> mdiag = meas_obj.get(m).get<std::vector<double>>();
-		    std::string mdiag_str;
-		    for (size_t i=0;i<mdiag.size();i++)
-		      mdiag_str += this->_mlmodel.get_hcorresp(i) + ":" + std::to_string(mdiag.at(i)) + " ";
-		    LOG(INFO) << m << "=[" << mdiag_str << "]";
+		    LOG(ERROR) << "exception while testing the network in background\n";
+		    delete solver;
+		    throw;
 		  }
+		caffe::Net<float> *test_net = solver->test_nets().at(0).get();
+		double test_iter = solver->iter_;
+		double test_loss = smoothed_loss;
+		test_future = std::async(std::launch::async,[this,test_net,test_iter,test_loss,test_mode,test_threads,&ad,&inputc,test_batch_size,has_mean_file]()
+					 {
+					   ThreadScope tscope(test_threads);
+					   // Caffe's context is per thread
+					   Caffe::set_mode(test_mode);
+#ifndef CPU_ONLY
+					   if (test_mode == Caffe::GPU)
+					     Caffe::SetDevice(_gpuid.at(0));
+#endif
+					   APIData meas_out;
+					   test(test_net,ad,inputc,test_batch_size,has_mean_file,meas_out);
+					   APIData meas_obj = meas_out.getobj("measure");
+					   meas_obj.add("iteration",test_iter);
+					   meas_obj.add("train_loss",test_loss);
+					   meas_out.add("measure",meas_obj);
+					   report_test_measures(meas_out,true);
+					 });
 	      }
 	  }
 	
@@ -635,13 +861,30 @@ namespace dd
 	    for (size_t i = 0; i < solver->callbacks().size(); ++i) {
 	      solver->callbacks()[i]->on_start();
 	    }
-	    for (int i = 0; i < solver->param_.iter_size(); ++i)
-	      loss += solver->net_->ForwardBackward();
+	    if (wnets.empty())
+	      {
+		for (int i = 0; i < solver->param_.iter_size(); ++i)
+		  {
+		    if (feeder)
+		      loss += feeder->forward_backward(solver->net_.get());
+		    else loss += solver->net_->ForwardBackward();
+		  }
+	      }
+	    else
+	      {
+		for (int i = 0; i < solver->param_.iter_size(); ++i)
+		  loss += parallel_forward_backward(solver->net_.get(),wnets,*wpool);
+		reduce_worker_gradients(solver->net_.get(),wnets);
+	      }
 	    loss /= solver->param_.iter_size();
 	  }
 	catch(std::exception &e)
 	  {
 	    LOG(ERROR) << "exception while forward/backward pass through the network\n";
+	    if (test_future.valid())
+	      test_future.wait();
+	    if (snapshot_future.valid())
+	      snapshot_future.wait();
 	    delete solver;
 	    throw;
 	  }
@@ -674,18 +917,45 @@ namespace dd
 	catch (std::exception &e)
 	  {
 	    LOG(ERROR) << "exception while updating network\n";
+	    if (test_future.valid())
+	      test_future.wait();
+	    if (snapshot_future.valid())
+	      snapshot_future.wait();
 	    delete solver;
 	    throw;
 	  }
       }
+
+    // wait for the last background test, its measures are still of interest
+    if (test_future.valid())
+      {
+	try
+	  {
+	    test_future.get();
+	  }
+	catch(std::exception &e)
+	  {
+	    LOG(ERROR) << "exception while testing the network in background: " << e.what();
+	  }
+      }
     
     // always save final snapshot.
     if (solver->param_.snapshot_after_train())
-      solver->Snapshot();
+      {
+	if (snapshot_async)
+	  snapshot(solver,snapshot_future);
+	else solver->Snapshot();
+      }
+
+    // model is read back from repository below
+    if (snapshot_future.valid())
+      snapshot_future.get();
     
     // destroy the net
     delete _net;
     _net = nullptr;
+    wnets.clear();
+    feeder.reset();
     delete solver;
     
     // bail on forced stop, i.e. not testing the net further.
@@ -735,6 +1005,203 @@ namespace dd
     return 0;
   }
 
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::create_cpu_workers(caffe::Solver<float> *solver,
+											       const caffe::SolverParameter &solver_param,
+											       const std::vector<caffe::Datum> &dv,
+											       const int &shard_batch_size,
+											       const int &cpu_workers,
+											       std::vector<std::unique_ptr<caffe::Net<float>>> &wnets)
+  {
+    caffe::NetParameter wnet_param = solver_param.net_param();
+    wnet_param.mutable_state()->set_phase(caffe::TRAIN);
+    size_t shard_size = dv.size() / cpu_workers;
+    for (int w=0;w<cpu_workers;w++)
+      {
+	caffe::Net<float> *net = solver->net().get();
+	if (w > 0)
+	  {
+	    net = new caffe::Net<float>(wnet_param);
+	    wnets.push_back(std::unique_ptr<caffe::Net<float>>(net));
+	    net->ShareTrainedLayersWith(solver->net().get()); // weights are shared, gradients are not
+	  }
+	std::vector<caffe::Datum> shard(dv.begin()+w*shard_size,dv.begin()+(w+1)*shard_size);
+	boost::shared_ptr<caffe::MemoryDataLayer<float>> mdl = boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(net->layers()[0]);
+	mdl->set_batch_size(shard_batch_size);
+	mdl->AddDatumVector(shard);
+      }
+    LOG(INFO) << "CPU data-parallel training with " << cpu_workers << " workers / shard batch size=" << shard_batch_size;
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  float CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::parallel_forward_backward(caffe::Net<float> *net,
+												       std::vector<std::unique_ptr<caffe::Net<float>>> &wnets,
+												       WorkerPool &wpool)
+  {
+    std::vector<float> wlosses(wnets.size(),0.0);
+    std::vector<std::exception_ptr> werrors(wnets.size());
+    size_t pending = wnets.size();
+    std::mutex pmutex;
+    std::condition_variable pcv;
+    for (size_t w=0;w<wnets.size();w++)
+      {
+	caffe::Net<float> *wn = wnets.at(w).get();
+	std::function<void()> task = [&,w,wn]()
+	  {
+	    try
+	      {
+		wlosses.at(w) = wn->ForwardBackward();
+	      }
+	    catch(...)
+	      {
+		werrors.at(w) = std::current_exception();
+	      }
+	    // notified under the lock, the waiting thread owns the barrier
+	    std::lock_guard<std::mutex> lock(pmutex);
+	    if (--pending == 0)
+	      pcv.notify_one();
+	  };
+	if (!wpool.try_submit(task))
+	  task(); // pool stopping or full, the barrier still needs every shard
+      }
+    float loss = 0.0;
+    std::exception_ptr eptr;
+    try
+      {
+	loss = net->ForwardBackward();
+      }
+    catch(...)
+      {
+	eptr = std::current_exception();
+      }
+    {
+      std::unique_lock<std::mutex> lock(pmutex);
+      pcv.wait(lock,[&pending](){ return pending == 0; });
+    }
+    for (size_t w=0;w<wnets.size();w++)
+      {
+	if (!eptr && werrors.at(w))
+	  eptr = werrors.at(w);
+	loss += wlosses.at(w);
+      }
+    if (eptr)
+      std::rethrow_exception(eptr);
+    return loss / static_cast<float>(wnets.size() + 1);
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::reduce_worker_gradients(caffe::Net<float> *net,
+												     std::vector<std::unique_ptr<caffe::Net<float>>> &wnets)
+  {
+    // every net normalizes its loss over its own shard, the reduced gradient is the average
+    const std::vector<caffe::Blob<float>*> &params = net->learnable_params();
+    float scale = 1.0 / static_cast<float>(wnets.size() + 1);
+#pragma omp parallel for
+    for (size_t i=0;i<params.size();i++)
+      {
+	for (std::unique_ptr<caffe::Net<float>> &wnet: wnets)
+	  caffe::caffe_axpy(params.at(i)->count(),1.0f,wnet->learnable_params().at(i)->cpu_diff(),params.at(i)->mutable_cpu_diff());
+	caffe::caffe_scal(params.at(i)->count(),scale,params.at(i)->mutable_cpu_diff());
+      }
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::snapshot(caffe::Solver<float> *solver,
+										     std::future<void> &snapshot_future)
+  {
+    // solver state is only accessible for SGD-based solvers with binary snapshots
+    caffe::SGDSolver<float> *sgd_solver = dynamic_cast<caffe::SGDSolver<float>*>(solver);
+    if (!sgd_solver || solver->param_.snapshot_format() != caffe::SolverParameter_SnapshotFormat_BINARYPROTO)
+      {
+	if (snapshot_future.valid())
+	  snapshot_future.get();
+	solver->Snapshot();
+	return;
+      }
+
+    // a single snapshot in flight bounds the staging memory
+    if (snapshot_future.valid())
+      snapshot_future.get();
+
+    // stage the weights and solver state, training can resume as soon as they are copied
+    std::string prefix = solver->param_.snapshot_prefix() + "_iter_" + std::to_string(solver->iter_);
+    std::string model_filename = prefix + ".caffemodel";
+    std::string state_filename = prefix + ".solverstate";
+    std::shared_ptr<caffe::NetParameter> net_param(new caffe::NetParameter());
+    solver->net()->ToProto(net_param.get(),solver->param_.snapshot_diff());
+    std::shared_ptr<caffe::SolverState> state(new caffe::SolverState());
+    state->set_iter(solver->iter_);
+    state->set_learned_net(model_filename);
+    state->set_current_step(solver->current_step_);
+    for (size_t i=0;i<sgd_solver->history().size();i++)
+      {
+	caffe::BlobProto *history_blob = state->add_history();
+	sgd_solver->history().at(i)->ToProto(history_blob);
+      }
+
+    // temporary names must not be picked up as models or states from the repository
+    snapshot_future = std::async(std::launch::async,[net_param,state,model_filename,state_filename,prefix]()
+				 {
+				   std::string tmp_model = prefix + ".tmpmodel";
+				   std::string tmp_state = prefix + ".tmpstate";
+				   LOG(INFO) << "Snapshotting to binary proto file " << model_filename;
+				   caffe::WriteProtoToBinaryFile(*net_param,tmp_model);
+				   if (std::rename(tmp_model.c_str(),model_filename.c_str()))
+				     LOG(ERROR) << "failed renaming snapshot " << tmp_model << " to " << model_filename;
+				   LOG(INFO) << "Snapshotting solver state to binary proto file " << state_filename;
+				   caffe::WriteProtoToBinaryFile(*state,tmp_state);
+				   if (std::rename(tmp_state.c_str(),state_filename.c_str()))
+				     LOG(ERROR) << "failed renaming solver state " << tmp_state << " to " << state_filename;
+				 });
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::report_test_measures(APIData &meas_out,
+												 const bool &background)
+  {
+    APIData meas_obj = meas_out.getobj("measure");
+    std::vector<std::string> meas_str = meas_obj.list_keys();
+    for (auto m: meas_str)
+      {
+	if (m != "cmdiag" && m != "cmfull" && m != "labels") // do not report confusion matrix in server logs
+	  {
+	    double mval = meas_obj.get(m).get<double>();
+	    LOG(INFO) << m << "=" << mval;
+	    // background results lag behind training, current iteration and loss are not overriden
+	    if (!background || (m != "iteration" && m != "train_loss"))
+	      this->add_meas(m,mval);
+	    this->add_meas_per_iter(m,mval);
+	  }
+	else if (m == "cmdiag")
+	  {
+	    std::vector<double> mdiag = meas_obj.get(m).get<std::vector<double>>();
+	    std::string mdiag_str;
+	    for (size_t i=0;i<mdiag.size();i++)
+	      mdiag_str += this->_mlmodel.get_hcorresp(i) + ":" + std::to_string(mdiag.at(i)) + " ";
+	    LOG(INFO) << m << "=[" << mdiag_str << "]";
+	  }
+      }
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::copy_trained_layers(caffe::Net<float> *net,
+												caffe::Net<float> *test_net)
+  {
+    // same as Caffe's ShareTrainedLayersWith, but data are copied instead of shared
+    for (size_t l=0;l<test_net->layers().size();l++)
+      {
+	const std::string &lname = test_net->layer_names().at(l);
+	if (!net->has_layer(lname))
+	  continue;
+	const std::vector<boost::shared_ptr<Blob<float>>> &source_blobs = net->layer_by_name(lname)->blobs();
+	const std::vector<boost::shared_ptr<Blob<float>>> &target_blobs = test_net->layers().at(l)->blobs();
+	if (source_blobs.size() != target_blobs.size())
+	  throw MLLibInternalException("incompatible number of blobs for layer " + lname + " between train and test nets");
+	for (size_t j=0;j<target_blobs.size();j++)
+	  target_blobs.at(j)->CopyFrom(*source_blobs.at(j),false,true);
+      }
+  }
+
   template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
   void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::test(caffe::Net<float> *net,
 										 const APIData &ad,
@@ -747,6 +1214,10 @@ namespace dd
     ad_res.add("iteration",this->get_meas("iteration"));
     ad_res.add("train_loss",this->get_meas("train_loss"));
     APIData ad_out = ad.getobj("parameters").getobj("output");
+    std::vector<std::string> measures;
+    if (ad_out.has("measure"))
+      measures = ad_out.get("measure").get<std::vector<std::string>>();
+    SupervisedOutput::measure_accumulator macc(measures,_nclasses,_regression);
     if (ad_out.has("measure"))
       {
 	float mean_loss = 0.0;
@@ -845,32 +1316,13 @@ namespace dd
 	    int scount = lresults[slot]->count();
 	    int scperel = scount / dv_size;
 	    
-	    for (int j=0;j<(int)dv_size;j++)
+	    const float *preds = lresults[slot]->cpu_data();
+	    if ((!_regression && !_autoencoder)|| _ntargets == 1)
+	      macc.add_batch(preds,scperel,nout,dv_labels);
+	    else // regression with ntargets > 1 or autoencoder
 	      {
-		APIData bad;
-		std::vector<double> predictions;
-		if ((!_regression && !_autoencoder)|| _ntargets == 1)
-		  {
-		    double target = dv_labels.at(j);
-		    for (int k=0;k<nout;k++)
-		      {
-			predictions.push_back(lresults[slot]->cpu_data()[j*scperel+k]);
-		      }
-		    bad.add("target",target);
-		  }
-		else // regression with ntargets > 1 or autoencoder
-		  {
-		    std::vector<double> target;
-		    for (size_t k=0;k<dv_float_data.at(j).size();k++)
-		      target.push_back(dv_float_data.at(j).at(k));
-		    for (int k=0;k<nout;k++)
-		      {
-			predictions.push_back(lresults[slot]->cpu_data()[j*scperel+k]);
-		      }
-		    bad.add("target",target);
-		  }
-		bad.add("pred",predictions);
-		ad_res.add(std::to_string(tresults+j),bad);
+		for (int j=0;j<(int)dv_size;j++)
+		  macc.add(preds+j*scperel,nout,dv_float_data.at(j));
 	      }
 	    tresults += dv_size;
 	    mean_loss += loss;
@@ -880,10 +1332,8 @@ namespace dd
 	  clnames.push_back(this->_mlmodel.get_hcorresp(i));
 	ad_res.add("clnames",clnames);
 	ad_res.add("batch_size",tresults);
-	if (_regression)
-	  ad_res.add("regression",_regression);
       }
-    SupervisedOutput::measure(ad_res,ad_out,out);
+    SupervisedOutput::measure(macc,ad_res,ad_out,out);
   }
   
   template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
@@ -914,6 +1364,16 @@ namespace dd
       confidence_threshold = ad_output.get("confidence_threshold").get<double>();
     if (ad_output.has("bbox") && ad_output.get("bbox").get<bool>())
       bbox = true;
+    double nms_threshold = 0.45;
+    bool nms = false;
+    if (ad_output.has("nms_threshold"))
+      {
+	nms_threshold = ad_output.get("nms_threshold").get<double>();
+	nms = true;
+      }
+    int top_k = -1;
+    if (ad_output.has("top_k"))
+      top_k = ad_output.get("top_k").get<int>();
     
     // gpu
 #ifndef CPU_ONLY
@@ -940,6 +1400,20 @@ namespace dd
 #else
     Caffe::set_mode(Caffe::CPU);
 #endif
+
+    if (ad_mllib.has("benchmark"))
+      {
+	APIData ad_bench = ad_mllib.getobj("benchmark");
+	int bench_batch_size = 1;
+	int bench_iterations = 10;
+	if (ad_bench.has("batch_size"))
+	  bench_batch_size = ad_bench.get("batch_size").get<int>();
+	if (ad_bench.has("iterations"))
+	  bench_iterations = ad_bench.get("iterations").get<int>();
+	benchmark_net(bench_batch_size,bench_iterations,out);
+	out.add("status",0);
+	return 0;
+      }
     
     if (ad_output.has("measure"))
       {
@@ -997,41 +1471,80 @@ namespace dd
     std::vector<APIData> vrad;
     int nclasses = -1;
     int idoffset = 0;
+    const int max_batch_size = batch_size;
+    const int total_size = inputc.test_batch_size();
+
+    if (!extract_layer.empty())
+      {
+	std::map<std::string,int> n_layer_names_index = _net->layer_names_index();
+	if (n_layer_names_index.find(extract_layer)==n_layer_names_index.end())
+	  throw MLLibBadParamException("unknown extract layer " + extract_layer);
+      }
+
+    // batches run concurrently on net replicas, CPU only
+    int cpu_workers = 1;
+    if (ad_mllib.has("cpu_workers"))
+      cpu_workers = ad_mllib.get("cpu_workers").get<int>();
+    if (cpu_workers > 1)
+      {
+	if (Caffe::mode() == Caffe::GPU)
+	  {
+	    LOG(WARNING) << "cpu_workers is ignored in GPU mode";
+	    cpu_workers = 1;
+	  }
+	else if (inputc._sparse)
+	  {
+	    LOG(WARNING) << "cpu_workers requires dense input data, ignoring";
+	    cpu_workers = 1;
+	  }
+	// batches are spread over the replicas, the main net alone would not time the call
+	else if (ad_mllib.has("profile") && ad_mllib.get("profile").get<bool>())
+	  throw MLLibBadParamException("profile is not supported with cpu_workers > 1");
+      }
+    std::vector<std::vector<Datum>> wbatches; // batches queued for the workers, in input order
+    std::vector<int> wbatch_sizes;
+    std::vector<int> wnet_batch_sizes;
+    std::vector<int> widoffsets;
+
     while(true)
       {
+	// batch_size counts the samples of this pass, net_batch_size adds the bucket padding
+	int take = max_batch_size;
+	int net_batch_size = bucket_batch_size(total_size-idoffset,max_batch_size,take);
 	try
 	  {
 	    if (!inputc._sparse)
 	      {
-		std::vector<Datum> dv = inputc.get_dv_test(batch_size,has_mean_file);
+		std::vector<Datum> dv = inputc.get_dv_test(take,has_mean_file);
 		if (dv.empty())
 		  break;
 		batch_size = dv.size();
-		if (boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(_net->layers()[0]) == 0)
-		    {
-		      LOG(ERROR) << "deploy net's first layer is required to be of MemoryData type (predict)";
-		      delete _net;
-		      _net = nullptr;
-		      throw MLLibBadParamException("deploy net's first layer is required to be of MemoryData type");
-		    }
-		boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(_net->layers()[0])->set_batch_size(batch_size);
-		boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(_net->layers()[0])->AddDatumVector(dv);
+		if (_batch_buckets.empty())
+		  net_batch_size = batch_size;
+		while (static_cast<int>(dv.size()) < net_batch_size)
+		  dv.push_back(dv.back());
+		if (cpu_workers > 1)
+		  {
+		    wbatches.push_back(std::move(dv));
+		    wbatch_sizes.push_back(batch_size);
+		    wnet_batch_sizes.push_back(net_batch_size);
+		    widoffsets.push_back(idoffset);
+		    idoffset += batch_size;
+		    continue;
+		  }
+		add_batch(_net,dv,net_batch_size);
 	      }
 	    else
 	      {
-		std::vector<caffe::SparseDatum> dv = inputc.get_dv_test_sparse(batch_size);
+		std::vector<caffe::SparseDatum> dv = inputc.get_dv_test_sparse(take);
 		if (dv.empty())
 		  break;
 		batch_size = dv.size();
-		if (boost::dynamic_pointer_cast<caffe::MemorySparseDataLayer<float>>(_net->layers()[0]) == 0)
-		  {
-		    LOG(ERROR) << "deploy net's first layer is required to be of MemoryData type (predict)";
-		    delete _net;
-		    _net = nullptr;
-		    throw MLLibBadParamException("deploy net's first layer is required to be of MemorySparseData type");
-		  }
-		boost::dynamic_pointer_cast<caffe::MemorySparseDataLayer<float>>(_net->layers()[0])->set_batch_size(batch_size);
-		boost::dynamic_pointer_cast<caffe::MemorySparseDataLayer<float>>(_net->layers()[0])->AddDatumVector(dv);
+		if (_batch_buckets.empty())
+		  net_batch_size = batch_size;
+		while (static_cast<int>(dv.size()) < net_batch_size)
+		  dv.push_back(dv.back());
+		add_batch(_net,dv,net_batch_size);
 	      }
 	  }
 	catch(std::exception &e)
@@ -1041,147 +1554,103 @@ namespace dd
 	    _net = nullptr;
 	    throw;
 	  }
-	
-	float loss = 0.0;
-	if (extract_layer.empty()) // supervised
+
+	try
 	  {
-	    std::vector<Blob<float>*> results;
-	    try
+	    predict_batch(_net,inputc,batch_size,net_batch_size,idoffset,extract_layer,
+			  bbox,confidence_threshold,nms,nms_threshold,top_k,nclasses,vrad);
+	  }
+	catch(std::exception &e)
+	  {
+	    delete _net;
+	    _net = nullptr;
+	    throw;
+	  }
+	idoffset += batch_size;
+      } // end prediction loop over batches
+
+    if (!wbatches.empty())
+      {
+	cpu_workers = std::min(cpu_workers,static_cast<int>(wbatches.size()));
+	std::vector<std::vector<APIData>> wvrad(wbatches.size());
+	std::vector<int> wnclasses(cpu_workers,-1);
+	std::atomic<size_t> next_batch(0);
+	// the call's thread budget is split among the workers
+	int budget = ThreadBudget::current();
+	if (budget <= 0)
+	  budget = std::thread::hardware_concurrency();
+	const int wthreads = std::max(1,budget / cpu_workers);
+	try
+	  {
+	    create_predict_workers(cpu_workers);
+	    auto worker = [&](const int w)
 	      {
-		results = _net->Forward(&loss);
-	      }
-	    catch(std::exception &e)
+		caffe::Caffe::set_mode(caffe::Caffe::CPU); // mode is per thread
+		ThreadScope wscope(wthreads);
+		caffe::Net<float> *net = w == 0 ? _net : _pnets.at(w-1).get();
+		size_t b;
+		while ((b = next_batch++) < wbatches.size())
+		  {
+		    add_batch(net,wbatches.at(b),wnet_batch_sizes.at(b));
+		    predict_batch(net,inputc,wbatch_sizes.at(b),wnet_batch_sizes.at(b),widoffsets.at(b),extract_layer,
+				  bbox,confidence_threshold,nms,nms_threshold,top_k,wnclasses.at(w),wvrad.at(b));
+		  }
+	      };
+	    std::vector<std::future<void>> wfutures;
+	    for (int w=1;w<cpu_workers;w++)
+	      wfutures.push_back(std::async(std::launch::async,worker,w));
+	    std::exception_ptr eptr;
+	    try
 	      {
-		LOG(ERROR) << "Error while proceeding with prediction forward pass, not enough memory?";
-		delete _net;
-		_net = nullptr;
-		throw;
+		worker(0);
 	      }
-	    if (bbox) // in-image object detection
+	    catch(...)
 	      {
-		const int det_size = 7;
-		const float *outr = results[0]->cpu_data();
-		const int num_det = results[0]->height() / batch_size; // total number of detections across batch
-		for (int j=0;j<batch_size;j++)
-		  {
-		    int k = 0;
-		    std::vector<double> probs;
-		    std::vector<std::string> cats;
-		    std::vector<APIData> bboxes;
-		    APIData rad;
-		    std::string uri = inputc._ids.at(idoffset+j);
-		    auto bit = inputc._imgs_size.find(uri);
-		    int rows = 1;
-		    int cols = 1;
-		    if (bit != inputc._imgs_size.end())
-		      {
-			rows = (*bit).second.first;
-			cols = (*bit).second.second;
-		      }
-		    bool leave = false;
-		    while(k<num_det)
-		      {
-			if (outr[0] == -1)
-			  {
-			    // skipping invalid detection
-			    outr += det_size;
-			    leave = true;
-			    break;
-			  }
-			std::vector<float> detection(outr, outr + det_size);
-			++k;
-			outr += det_size;
-			if (detection[2] < confidence_threshold)
-			  continue;
-			probs.push_back(detection[2]);
-			cats.push_back(this->_mlmodel.get_hcorresp(detection[1]));
-			APIData ad_bbox;
-			ad_bbox.add("xmin",detection[3]*cols);
-			ad_bbox.add("ymax",detection[4]*rows);
-			ad_bbox.add("xmax",detection[5]*cols);
-			ad_bbox.add("ymin",detection[6]*rows);
-			bboxes.push_back(ad_bbox);
-		      }
-		    if (leave)
-		      continue;
-		    rad.add("uri",uri);
-		    rad.add("loss",0.0); // XXX: unused
-		    rad.add("probs",probs);
-		    rad.add("cats",cats);
-		    rad.add("bboxes",bboxes); 
-		    vrad.push_back(rad);
-		  }
+		eptr = std::current_exception();
+		next_batch = wbatches.size(); // stops the other workers early
 	      }
-	    else // classification
+	    for (std::future<void> &wf: wfutures)
 	      {
-		int slot = results.size() - 1;
-		if (_regression)
+		try
 		  {
-		    if (_ntargets > 1)
-		      slot = 1;
-		    else slot = 0; // XXX: more in-depth testing required
+		    wf.get();
 		  }
-		int scount = results[slot]->count();
-		int scperel = scount / batch_size;
-		nclasses = scperel;
-		if (_autoencoder)
-		  nclasses = scperel = 1;
-		for (int j=0;j<batch_size;j++)
+		catch(...)
 		  {
-		    APIData rad;
-		    if (!inputc._ids.empty())
-		      rad.add("uri",inputc._ids.at(idoffset+j));
-		    else rad.add("uri",std::to_string(idoffset+j));
-		    rad.add("loss",loss);
-		    std::vector<double> probs;
-		    std::vector<std::string> cats;
-		    for (int i=0;i<nclasses;i++)
-		      {
-			double prob = results[slot]->cpu_data()[j*scperel+i];
-			if (prob < confidence_threshold)
-			  continue;
-			probs.push_back(prob);
-			cats.push_back(this->_mlmodel.get_hcorresp(i));
-		      }
-		    rad.add("probs",probs);
-		    rad.add("cats",cats);
-		    vrad.push_back(rad);
+		    if (!eptr)
+		      eptr = std::current_exception();
 		  }
 	      }
+	    if (eptr)
+	      std::rethrow_exception(eptr);
 	  }
-	else // unsupervised
-	  {
-	    std::map<std::string,int> n_layer_names_index = _net->layer_names_index();
-	    std::map<std::string,int>::const_iterator lit;
-	    if ((lit=n_layer_names_index.find(extract_layer))==n_layer_names_index.end())
-	      throw MLLibBadParamException("unknown extract layer " + extract_layer);
-	    int li = (*lit).second;
-	    loss = _net->ForwardFromTo(0,li);
-	    const std::vector<std::vector<Blob<float>*>>& rresults = _net->top_vecs();
-	    std::vector<Blob<float>*> results = rresults.at(li);
-	    int slot = 0;
-	    int scount = results[slot]->count();
-	    int scperel = scount / batch_size;
-	    std::vector<int> vshape = {batch_size,scperel};
-	    results[slot]->Reshape(vshape); // reshaping into a rectangle, first side = batch size
-	    for (int j=0;j<batch_size;j++)
-	      {
-		APIData rad;
-		rad.add("uri",inputc._ids.at(idoffset+j));
-		rad.add("loss",loss);
-		std::vector<double> vals;
-		int cpos = 0;
-		for (int c=0;c<results.at(slot)->shape(1);c++)
-		  {
-		    vals.push_back(results.at(slot)->cpu_data()[j*scperel+cpos]);
-		    ++cpos;
-		  }
-		rad.add("vals",vals);
-		vrad.push_back(rad);
-	      }
+	catch(std::exception &e)
+	  {
+	    LOG(ERROR) << "exception while running parallel prediction";
+	    delete _net;
+	    _net = nullptr;
+	    _pnets.clear();
+	    throw;
 	  }
-	idoffset += batch_size;
-      } // end prediction loop over batches
+	// batch results are merged back in input order
+	for (std::vector<APIData> &bvrad: wvrad)
+	  vrad.insert(vrad.end(),std::make_move_iterator(bvrad.begin()),std::make_move_iterator(bvrad.end()));
+	for (int nc: wnclasses)
+	  if (nc >= 0)
+	    nclasses = nc;
+	LOG(INFO) << "parallel prediction of " << wbatches.size() << " batches over " << cpu_workers << " workers";
+      }
+    if (bbox)
+      merge_tiles(vrad,nms_threshold,top_k);
+
+    // per-layer timings, on the last batch held by the net
+    if (ad_mllib.has("profile") && ad_mllib.get("profile").get<bool>())
+      {
+	int profile_iterations = 10;
+	if (ad_mllib.has("profile_iterations"))
+	  profile_iterations = ad_mllib.get("profile_iterations").get<int>();
+	profile_net(1,profile_iterations,out);
+      }
 
     tout.add_results(vrad);
     if (extract_layer.empty())
@@ -1204,6 +1673,221 @@ namespace dd
     return 0;
   }
   
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::add_batch(caffe::Net<float> *net,
+										      const std::vector<caffe::Datum> &dv,
+										      const int &net_batch_size)
+  {
+    boost::shared_ptr<caffe::MemoryDataLayer<float>> mdl = boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(net->layers()[0]);
+    if (mdl == 0)
+      {
+	LOG(ERROR) << "deploy net's first layer is required to be of MemoryData type (predict)";
+	throw MLLibBadParamException("deploy net's first layer is required to be of MemoryData type");
+      }
+    mdl->set_batch_size(net_batch_size);
+    mdl->AddDatumVector(dv);
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::add_batch(caffe::Net<float> *net,
+										      const std::vector<caffe::SparseDatum> &dv,
+										      const int &net_batch_size)
+  {
+    boost::shared_ptr<caffe::MemorySparseDataLayer<float>> mdl = boost::dynamic_pointer_cast<caffe::MemorySparseDataLayer<float>>(net->layers()[0]);
+    if (mdl == 0)
+      {
+	LOG(ERROR) << "deploy net's first layer is required to be of MemoryData type (predict)";
+	throw MLLibBadParamException("deploy net's first layer is required to be of MemorySparseData type");
+      }
+    mdl->set_batch_size(net_batch_size);
+    mdl->AddDatumVector(dv);
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::predict_batch(caffe::Net<float> *net,
+											  const TInputConnectorStrategy &inputc,
+											  const int &batch_size,
+											  const int &net_batch_size,
+											  const int &idoffset,
+											  const std::string &extract_layer,
+											  const bool &bbox,
+											  const double &confidence_threshold,
+											  const bool &nms,
+											  const double &nms_threshold,
+											  const int &top_k,
+											  int &nclasses,
+											  std::vector<APIData> &vrad)
+  {
+    float loss = 0.0;
+    if (extract_layer.empty()) // supervised
+      {
+	std::vector<Blob<float>*> results;
+	try
+	  {
+	    results = net->Forward(&loss);
+	  }
+	catch(std::exception &e)
+	  {
+	    LOG(ERROR) << "Error while proceeding with prediction forward pass, not enough memory?";
+	    throw;
+	  }
+	if (bbox) // in-image object detection
+	  {
+	    const int det_size = 7;
+	    const float *outr = results[0]->cpu_data();
+	    const int num_det = results[0]->height() / net_batch_size; // total number of detections across batch
+	    std::vector<dd::bbox> boxes;
+	    boxes.reserve(num_det);
+	    for (int j=0;j<batch_size;j++)
+	      {
+		int k = 0;
+		std::string uri = inputc._ids.at(idoffset+j);
+		auto bit = inputc._imgs_size.find(uri);
+		int rows = 1;
+		int cols = 1;
+		if (bit != inputc._imgs_size.end())
+		  {
+		    rows = (*bit).second.first;
+		    cols = (*bit).second.second;
+		  }
+		bool leave = false;
+		boxes.clear();
+		while(k<num_det)
+		  {
+		    if (outr[0] == -1)
+		      {
+			// skipping invalid detection
+			outr += det_size;
+			leave = true;
+			break;
+		      }
+		    const float *detection = outr;
+		    ++k;
+		    outr += det_size;
+		    if (detection[2] < confidence_threshold)
+		      continue;
+		    // boxes are read in place from the output blob, y axis is top to bottom
+		    boxes.push_back(dd::bbox(detection[3]*cols,detection[4]*rows,
+					     detection[5]*cols,detection[6]*rows,
+					     detection[2],static_cast<int>(detection[1])));
+		  }
+		if (leave)
+		  continue;
+		std::vector<size_t> kept;
+		if (nms)
+		  kept = dd::bbox::nms(boxes,nms_threshold,true,top_k);
+		else kept = dd::bbox::top(boxes,top_k);
+
+		// only surviving boxes are materialized
+		std::vector<double> probs;
+		std::vector<std::string> cats;
+		std::vector<APIData> bboxes;
+		probs.reserve(kept.size());
+		cats.reserve(kept.size());
+		bboxes.reserve(kept.size());
+		for (size_t b: kept)
+		  {
+		    const dd::bbox &box = boxes.at(b);
+		    probs.push_back(box._prob);
+		    cats.push_back(this->_mlmodel.get_hcorresp(box._label));
+		    APIData ad_bbox;
+		    ad_bbox.add("xmin",box._xmin);
+		    ad_bbox.add("ymax",box._ymin);
+		    ad_bbox.add("xmax",box._xmax);
+		    ad_bbox.add("ymin",box._ymax);
+		    bboxes.push_back(ad_bbox);
+		  }
+		APIData rad;
+		rad.add("uri",uri);
+		rad.add("loss",0.0); // XXX: unused
+		rad.add("probs",probs);
+		rad.add("cats",cats);
+		rad.add("bboxes",bboxes); 
+		vrad.push_back(rad);
+	      }
+	  }
+	else // classification
+	  {
+	    int slot = results.size() - 1;
+	    if (_regression)
+	      {
+		if (_ntargets > 1)
+		  slot = 1;
+		else slot = 0; // XXX: more in-depth testing required
+	      }
+	    int scount = results[slot]->count();
+	    int scperel = scount / net_batch_size;
+	    nclasses = scperel;
+	    if (_autoencoder)
+	      nclasses = scperel = 1;
+	    for (int j=0;j<batch_size;j++)
+	      {
+		APIData rad;
+		if (!inputc._ids.empty())
+		  rad.add("uri",inputc._ids.at(idoffset+j));
+		else rad.add("uri",std::to_string(idoffset+j));
+		rad.add("loss",loss);
+		std::vector<double> probs;
+		std::vector<std::string> cats;
+		for (int i=0;i<nclasses;i++)
+		  {
+		    double prob = results[slot]->cpu_data()[j*scperel+i];
+		    if (prob < confidence_threshold)
+		      continue;
+		    probs.push_back(prob);
+		    cats.push_back(this->_mlmodel.get_hcorresp(i));
+		  }
+		rad.add("probs",probs);
+		rad.add("cats",cats);
+		vrad.push_back(rad);
+	      }
+	  }
+      }
+    else // unsupervised
+      {
+	std::map<std::string,int> n_layer_names_index = net->layer_names_index();
+	std::map<std::string,int>::const_iterator lit;
+	if ((lit=n_layer_names_index.find(extract_layer))==n_layer_names_index.end())
+	  throw MLLibBadParamException("unknown extract layer " + extract_layer);
+	int li = (*lit).second;
+	loss = net->ForwardFromTo(0,li);
+	const std::vector<std::vector<Blob<float>*>>& rresults = net->top_vecs();
+	std::vector<Blob<float>*> results = rresults.at(li);
+	int slot = 0;
+	int scount = results[slot]->count();
+	int scperel = scount / net_batch_size;
+	std::vector<int> vshape = {net_batch_size,scperel};
+	results[slot]->Reshape(vshape); // reshaping into a rectangle, first side = batch size
+	for (int j=0;j<batch_size;j++)
+	  {
+	    APIData rad;
+	    rad.add("uri",inputc._ids.at(idoffset+j));
+	    rad.add("loss",loss);
+	    std::vector<double> vals;
+	    int cpos = 0;
+	    for (int c=0;c<results.at(slot)->shape(1);c++)
+	      {
+		vals.push_back(results.at(slot)->cpu_data()[j*scperel+cpos]);
+		++cpos;
+	      }
+	    rad.add("vals",vals);
+	    vrad.push_back(rad);
+	  }
+      }
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::create_predict_workers(const int &cpu_workers)
+  {
+    while (static_cast<int>(_pnets.size()) < cpu_workers - 1)
+      {
+	caffe::Net<float> *net = new caffe::Net<float>(this->_mlmodel._def,caffe::TEST);
+	_pnets.push_back(std::unique_ptr<caffe::Net<float>>(net));
+	net->ShareTrainedLayersWith(_net); // weights are shared, activations are not
+	preallocate_buckets(net);
+      }
+  }
+
   template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
   void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::update_in_memory_net_and_solver(caffe::SolverParameter &sp,
 													    const APIData &ad,
@@ -1545,34 +2229,190 @@ namespace dd
   {
     for (size_t l=0;l<_net->layers().size();l++)
       {
-	const boost::shared_ptr<caffe::Layer<float>> &layer = _net->layers().at(l);
-	std::string lname = layer->layer_param().name();
-	std::string ltype = layer->layer_param().type();
-	std::vector<boost::shared_ptr<Blob<float>>> blblobs = layer->blobs();
-	const std::vector<caffe::Blob<float>*> &tlblobs = _net->top_vecs().at(l);
-	//std::cerr << "lname=" << lname << " / bottom layer blobs size=" << blblobs.size() << std::endl;
-	if (blblobs.empty())
-	  continue;
-	long int lcount = blblobs.at(0)->count();
-	long int lflops = 0;
-	if (ltype == "Convolution")
-	  {
-	    int dwidth = tlblobs.at(0)->width();
-	    int dheight = tlblobs.at(0)->height();
-	    //std::cerr << "dwidth=" << dwidth << " / dheight=" << dheight << std::endl;
-	    lflops = lcount * dwidth * dheight;
-	  }
-	else
-	  {
-	    lflops = lcount;
-	  }
-	//std::cerr << "lname=" << lname << " / ltype=" << ltype << " / lflops=" << lflops << " / lcount=" << lcount << std::endl;
-	flops += lflops;
-	params += lcount;
+	long int lparams = 0;
+	flops += layer_complexity(l,lparams);
+	params += lparams;
       }
     LOG(INFO) << "Net total flops=" << flops << " / total params=" << params << std::endl;
   }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  long int CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::layer_complexity(const int &l,
+												 long int &lparams)
+  {
+    const boost::shared_ptr<caffe::Layer<float>> &layer = _net->layers().at(l);
+    std::string ltype = layer->layer_param().type();
+    std::vector<boost::shared_ptr<Blob<float>>> blblobs = layer->blobs();
+    const std::vector<caffe::Blob<float>*> &tlblobs = _net->top_vecs().at(l);
+    if (blblobs.empty())
+      return 0;
+    long int lcount = blblobs.at(0)->count();
+    long int lflops = 0;
+    if (ltype == "Convolution")
+      {
+	int dwidth = tlblobs.at(0)->width();
+	int dheight = tlblobs.at(0)->height();
+	lflops = lcount * dwidth * dheight;
+      }
+    else
+      {
+	lflops = lcount;
+      }
+    lparams = lcount;
+    return lflops;
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::profile_net(const int &start_layer,
+											const int &iterations,
+											APIData &out)
+  {
+    int batch_size = 1;
+    if (!_net->top_vecs().at(0).empty())
+      batch_size = _net->top_vecs().at(0).at(0)->shape(0);
+
+    // warm-up pass, so that memory allocations are not accounted for
+    _net->ForwardFromTo(start_layer,_net->layers().size()-1);
+
+    std::vector<APIData> vlayers;
+    double total_time = 0.0;
+    long int total_flops = 0;
+    long int total_memory = 0;
+    caffe::Timer timer;
+    for (size_t l=start_layer;l<_net->layers().size();l++)
+      {
+	timer.Start();
+	for (int i=0;i<iterations;i++)
+	  _net->ForwardFromTo(l,l);
+	timer.Stop();
+	double ltime = timer.MilliSeconds() / static_cast<double>(iterations);
+
+	long int lparams = 0;
+	long int lflops = layer_complexity(l,lparams) * batch_size;
+	long int lmemory = lparams * sizeof(float);
+	for (const caffe::Blob<float> *tb: _net->top_vecs().at(l))
+	  lmemory += tb->count() * sizeof(float);
+
+	APIData ad_layer;
+	ad_layer.add("name",_net->layers().at(l)->layer_param().name());
+	ad_layer.add("type",std::string(_net->layers().at(l)->type()));
+	ad_layer.add("time",ltime);
+	ad_layer.add("flops",static_cast<double>(lflops));
+	ad_layer.add("gflops_per_sec",ltime > 0.0 ? lflops / (ltime * 1e6) : 0.0);
+	ad_layer.add("memory",static_cast<double>(lmemory));
+	vlayers.push_back(ad_layer);
+	total_time += ltime;
+	total_flops += lflops;
+	total_memory += lmemory;
+      }
+    APIData ad_profile;
+    ad_profile.add("batch_size",batch_size);
+    ad_profile.add("iterations",iterations);
+    ad_profile.add("time",total_time);
+    ad_profile.add("flops",static_cast<double>(total_flops));
+    ad_profile.add("gflops_per_sec",total_time > 0.0 ? total_flops / (total_time * 1e6) : 0.0);
+    ad_profile.add("memory",static_cast<double>(total_memory));
+    ad_profile.add("layers",vlayers);
+    out.add("profile",ad_profile);
+    LOG(INFO) << "Net profile: batch_size=" << batch_size << " / forward time=" << total_time << "ms / memory=" << total_memory << std::endl;
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::benchmark_net(const int &batch_size,
+											  const int &iterations,
+											  APIData &out)
+  {
+    if (batch_size <= 0 || iterations <= 0)
+      throw MLLibBadParamException("benchmark requires strictly positive batch_size and iterations");
+    if (boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(_net->layers()[0]) == 0)
+      throw MLLibBadParamException("benchmark requires the deploy net's first layer to be of MemoryData type");
+
+    // synthetic input: reshape the data layer outputs and propagate shapes through the net
+    for (caffe::Blob<float> *tb: _net->top_vecs().at(0))
+      {
+	std::vector<int> shape = tb->shape();
+	shape[0] = batch_size;
+	tb->Reshape(shape);
+	caffe::caffe_set(tb->count(),0.0f,tb->mutable_cpu_data());
+      }
+    try
+      {
+	_net->Reshape();
+	profile_net(1,iterations,out);
+      }
+    catch(std::exception &e)
+      {
+	LOG(ERROR) << "Error while benchmarking net, not enough memory?";
+	delete _net;
+	_net = nullptr;
+	throw;
+      }
+  }
   
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  int CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::bucket_batch_size(const int &remaining,
+											     const int &max_batch_size,
+											     int &take) const
+  {
+    take = max_batch_size;
+    if (_batch_buckets.empty() || remaining <= 0)
+      return take;
+    int left = std::min(remaining,max_batch_size);
+    take = left;
+    int fit = -1;
+    for (int b: _batch_buckets)
+      {
+	if (b > max_batch_size)
+	  break;
+	if (b >= left)
+	  {
+	    // pad up to the bucket, unless it is mostly padding and a smaller bucket can split the batch
+	    if (2*left >= b || fit < 0)
+	      return b;
+	    break;
+	  }
+	fit = b;
+      }
+    if (fit < 0) // no bucket within the call's batch size
+      return left;
+    take = fit;
+    return fit;
+  }
+
+  template <class TInputConnectorStrategy, class TOutputConnectorStrategy, class TMLModel>
+  void CaffeLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>::preallocate_buckets(caffe::Net<float> *net)
+  {
+    if (_batch_buckets.empty() || !net)
+      return;
+    boost::shared_ptr<caffe::MemoryDataLayer<float>> mdl = boost::dynamic_pointer_cast<caffe::MemoryDataLayer<float>>(net->layers()[0]);
+    if (mdl == 0)
+      {
+	LOG(WARNING) << "batch buckets are not preallocated, deploy net's first layer is not of MemoryData type";
+	return;
+      }
+    int max_bucket = _batch_buckets.back();
+    mdl->set_batch_size(max_bucket);
+    for (caffe::Blob<float> *tb: net->top_vecs().at(0))
+      {
+	std::vector<int> shape = tb->shape();
+	shape[0] = max_bucket;
+	tb->Reshape(shape);
+	caffe::caffe_set(tb->count(),0.0f,tb->mutable_cpu_data());
+      }
+    try
+      {
+	// one pass touches every blob, blobs only reallocate when growing beyond this size
+	net->Reshape();
+	net->ForwardFromTo(1,net->layers().size()-1);
+      }
+    catch(std::exception &e)
+      {
+	LOG(ERROR) << "Error while preallocating net for batch size " << max_bucket << ", not enough memory?";
+	throw;
+      }
+    LOG(INFO) << "Preallocated deploy net for batch size " << max_bucket << std::endl;
+  }
+
   template class CaffeLib<ImgCaffeInputFileConn,SupervisedOutput,CaffeModel>;
   template class CaffeLib<CSVCaffeInputFileConn,SupervisedOutput,CaffeModel>;
   template class CaffeLib<TxtCaffeInputFileConn,SupervisedOutput,CaffeModel>;
@@ -24,9 +24,12 @@
 
 #include "mllibstrategy.h"
 #include "caffemodel.h"
+#include "workerpool.h"
 #include "caffe/caffe.hpp"
 #include "caffe/layers/memory_data_layer.hpp"
 #include "caffe/layers/memory_sparse_data_layer.hpp"
+#include <future>
+#include <memory>
 
 using caffe::Blob;
 
@@ -162,6 +165,66 @@ namespace dd
 	      const bool &has_mean_file,
 	      APIData &out);
 
+      /**
+       * \brief creates the worker nets for CPU data-parallel training, and fills up
+       *        every net with its own shard of the training data
+       * @param solver current solver, whose net is the first worker
+       * @param solver_param solver parameters, holding the in-memory net definition
+       * @param dv training data
+       * @param shard_batch_size per worker batch size
+       * @param cpu_workers total number of workers
+       * @param wnets the additional worker nets
+       */
+      void create_cpu_workers(caffe::Solver<float> *solver,
+			      const caffe::SolverParameter &solver_param,
+			      const std::vector<caffe::Datum> &dv,
+			      const int &shard_batch_size,
+			      const int &cpu_workers,
+			      std::vector<std::unique_ptr<caffe::Net<float>>> &wnets);
+
+      /**
+       * \brief runs forward and backward passes concurrently on the solver net and worker nets,
+       *        worker nets run on the pool's persistent threads, one barrier per iteration
+       * @param wpool pool with one thread per worker net
+       * @return average loss across workers
+       */
+      float parallel_forward_backward(caffe::Net<float> *net,
+				      std::vector<std::unique_ptr<caffe::Net<float>>> &wnets,
+				      WorkerPool &wpool);
+
+      /**
+       * \brief averages worker nets gradients into the solver net, before the update
+       */
+      void reduce_worker_gradients(caffe::Net<float> *net,
+				   std::vector<std::unique_ptr<caffe::Net<float>>> &wnets);
+
+      /**
+       * \brief snapshots the net and solver state: blobs are copied in memory, then
+       *        written to disk in background, through temporary files renamed once complete
+       * @param solver current solver
+       * @param snapshot_future the pending write, if any, waited for before a new snapshot
+       */
+      void snapshot(caffe::Solver<float> *solver,
+		    std::future<void> &snapshot_future);
+
+      /**
+       * \brief logs and stores test measures
+       * @param meas_out output data object from test
+       * @param background whether the measures come from a background test, lagging
+       *        behind training, in which case current iteration and loss are left untouched
+       */
+      void report_test_measures(APIData &meas_out,
+				const bool &background);
+
+      /**
+       * \brief copies trained weights from train net into test net, so that the test net
+       *        can be used while the training net keeps being updated
+       * @param net train net
+       * @param test_net test net
+       */
+      void copy_trained_layers(caffe::Net<float> *net,
+			       caffe::Net<float> *test_net);
+
     /**
      * \brief updates: - solver's paths to data according to current Caffe model
      *                 - net's batch size and data sources (e.g. lmdb sources)
@@ -217,6 +280,98 @@ namespace dd
 
       void model_complexity(long int &flops,
 			    long int &params);
+
+      /**
+       * \brief estimated flops and number of parameters of a single layer, per sample
+       * @param l layer index in the net
+       * @param lparams number of parameters of the layer
+       * @return layer flops
+       */
+      long int layer_complexity(const int &l,
+				long int &lparams);
+
+      /**
+       * \brief times the forward pass of every layer of the current net
+       *        from start_layer onward, using the data already held in the net's blobs
+       * @param start_layer first layer to be timed, usually 1 in order to skip the data layer
+       * @param iterations number of forward passes to average over, per layer
+       * @param out output data object that receives the profile
+       */
+      void profile_net(const int &start_layer,
+		       const int &iterations,
+		       APIData &out);
+
+      /**
+       * \brief benchmarks the deploy net on synthetic input of a given batch size,
+       *        without requiring any data
+       * @param batch_size the batch size to reshape the net to
+       * @param iterations number of forward passes to average over, per layer
+       * @param out output data object that receives the profile
+       */
+      void benchmark_net(const int &batch_size,
+			 const int &iterations,
+			 APIData &out);
+
+      /**
+       * \brief picks the preallocated batch size of the next forward pass
+       * @param remaining number of samples left to predict
+       * @param max_batch_size largest batch size allowed by the call
+       * @param take number of samples to read from the input connector, take <= returned size
+       * @return batch size the net is run with, samples beyond take are padding
+       */
+      int bucket_batch_size(const int &remaining,
+			    const int &max_batch_size,
+			    int &take) const;
+
+      /**
+       * \brief allocates the deploy net blobs for the largest batch bucket
+       *        so that smaller buckets never reallocate
+       * @param net deploy net or one of its replicas
+       */
+      void preallocate_buckets(caffe::Net<float> *net);
+
+      /**
+       * \brief fills up the net's input layer with a prediction batch
+       * @param net deploy net or one of its replicas
+       * @param dv batch, padded to net_batch_size
+       * @param net_batch_size batch size the net is run with
+       */
+      void add_batch(caffe::Net<float> *net,
+		     const std::vector<caffe::Datum> &dv,
+		     const int &net_batch_size);
+
+      void add_batch(caffe::Net<float> *net,
+		     const std::vector<caffe::SparseDatum> &dv,
+		     const int &net_batch_size);
+
+      /**
+       * \brief runs the batch held by a net forward and turns its outputs into per-sample results
+       * @param net deploy net or one of its replicas, filled up with add_batch
+       * @param inputc input connector, for sample ids and image sizes
+       * @param batch_size number of samples in the batch, without padding
+       * @param net_batch_size batch size the net is run with
+       * @param idoffset index of the batch's first sample in the input
+       * @param vrad per-sample results are appended to this vector
+       */
+      void predict_batch(caffe::Net<float> *net,
+			 const TInputConnectorStrategy &inputc,
+			 const int &batch_size,
+			 const int &net_batch_size,
+			 const int &idoffset,
+			 const std::string &extract_layer,
+			 const bool &bbox,
+			 const double &confidence_threshold,
+			 const bool &nms,
+			 const double &nms_threshold,
+			 const int &top_k,
+			 int &nclasses,
+			 std::vector<APIData> &vrad);
+
+      /**
+       * \brief creates the deploy net replicas used by parallel prediction, if missing
+       * @param cpu_workers total number of workers, the deploy net included
+       */
+      void create_predict_workers(const int &cpu_workers);
       
     public:
       caffe::Net<float> *_net = nullptr; /**< neural net. */
@@ -226,6 +381,8 @@ namespace dd
       bool _regression = false; /**< whether the net acts as a regressor. */
       int _ntargets = 0; /**< number of classification or regression targets. */
       bool _autoencoder = false; /**< whether an autoencoder. */
+      std::vector<std::unique_ptr<caffe::Net<float>>> _pnets; /**< deploy net replicas sharing the net's weights, for parallel prediction. */
+      std::vector<int> _batch_buckets; /**< sorted preallocated prediction batch sizes, empty if the net follows every request's batch size. */
       std::mutex _net_mutex; /**< mutex around net, e.g. no concurrent predict calls as net is not re-instantiated. Use batches instead. */
       long int _flops = 0;  /**< model flops. */
       long int _params = 0;  /**< number of parameters in the model. */
@@ -0,0 +1,237 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAFFEMEMORYFEEDER_H
+#define CAFFEMEMORYFEEDER_H
+
+#include "caffe/caffe.hpp"
+#include "caffe/data_transformer.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace dd
+{
+  /**
+   * \brief prefetching feeder for MemoryData layers at training time: mini-batches are
+   *        pulled from the input connector, that keeps the training data in its own
+   *        representation, converted to Datum and transformed into float buffers by a
+   *        background thread, with double buffering, and reshuffled every epoch.
+   *        The training set is thus never held as a whole as Datum
+   */
+  class CaffeMemoryFeeder
+  {
+  public:
+    /**
+     * \brief pulls training samples from the input connector, as Datum
+     * @param ids indices of the samples
+     * @param dv Datum of the samples, in the order of ids
+     */
+    typedef std::function<void(const std::vector<size_t> &ids,
+			       std::vector<caffe::Datum> &dv)> pull_function;
+
+    /**
+     * \brief constructor
+     * @param pull pulls training samples from the input connector
+     * @param size number of training samples
+     * @param tp transformation parameters of the MemoryData layer
+     * @param batch_size mini-batch size
+     * @param shuffle whether to reshuffle the data at every epoch
+     */
+    CaffeMemoryFeeder(const pull_function &pull,
+		      const size_t &size,
+		      const caffe::TransformationParameter &tp,
+		      const int &batch_size,
+		      const bool &shuffle)
+      :_pull(pull),_transformer(tp,caffe::TRAIN),_batch_size(batch_size),_shuffle(shuffle)
+      {
+	_transformer.InitRand();
+	_order.resize(size);
+	for (size_t i=0;i<_order.size();i++)
+	  _order.at(i) = i;
+	std::vector<caffe::Datum> dv;
+	_pull(std::vector<size_t>(1,0),dv);
+	std::vector<int> shape = _transformer.InferBlobShape(dv.at(0));
+	shape[0] = _batch_size;
+	for (int b=0;b<2;b++)
+	  {
+	    _data[b].Reshape(shape);
+	    _labels[b].resize(_batch_size);
+	    _state[b] = FREE;
+	  }
+      }
+
+    ~CaffeMemoryFeeder()
+      {
+	stop();
+      }
+
+    /**
+     * \brief starts the background thread
+     */
+    void start()
+    {
+      _running = true;
+      _th = std::thread(&CaffeMemoryFeeder::run,this);
+    }
+
+    /**
+     * \brief stops the background thread
+     */
+    void stop()
+    {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_running = false;
+      }
+      _cv.notify_all();
+      if (_th.joinable())
+	_th.join();
+    }
+
+    /**
+     * \brief acquires the next mini-batch, and releases the previous one,
+     *        errors from pulling the data are passed on
+     * @param data mini-batch data, valid until next call
+     * @param labels mini-batch labels, valid until next call
+     */
+    void next(float *&data, float *&labels)
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (_inuse >= 0)
+	{
+	  _state[_inuse] = FREE;
+	  _cv.notify_all();
+	}
+      _cv.wait(lock,[this]{ return _state[_next] == READY || _error; });
+      if (_state[_next] != READY)
+	std::rethrow_exception(_error);
+      _state[_next] = INUSE;
+      _inuse = _next;
+      _next = 1 - _next;
+      data = _data[_inuse].mutable_cpu_data();
+      labels = &_labels[_inuse].front();
+    }
+
+    /**
+     * \brief runs forward and backward passes on the next mini-batch, which is
+     *        already transformed: it is set as the output of the net's MemoryData
+     *        layer and the layer itself is skipped, its parameters are left untouched
+     * @param net training net whose first layer is of MemoryData type
+     * @return loss
+     */
+    float forward_backward(caffe::Net<float> *net)
+    {
+      float *data = nullptr;
+      float *labels = nullptr;
+      next(data,labels);
+      const std::vector<caffe::Blob<float>*> &tops = net->top_vecs().at(0);
+      tops.at(0)->Reshape(_data[_inuse].shape());
+      tops.at(0)->set_cpu_data(data);
+      if (tops.size() > 1)
+	tops.at(1)->set_cpu_data(labels);
+      float loss = net->ForwardFromTo(1,net->layers().size()-1);
+      net->Backward();
+      return loss;
+    }
+
+  private:
+    void run()
+    {
+      std::mt19937 g = std::mt19937(std::random_device()());
+      int b = 0;
+      std::vector<size_t> ids;
+      std::vector<caffe::Datum> dv;
+      std::vector<int> uni_shape = _data[0].shape();
+      uni_shape[0] = 1;
+      caffe::Blob<float> uni_blob(uni_shape);
+      while(true)
+	{
+	  {
+	    std::unique_lock<std::mutex> lock(_mutex);
+	    _cv.wait(lock,[this,b]{ return !_running || _state[b] == FREE; });
+	    if (!_running)
+	      return;
+	  }
+	  // the buffer is not accessed by the consumer until it is marked ready
+	  try
+	    {
+	      ids.clear();
+	      for (int i=0;i<_batch_size;i++)
+		{
+		  if (_pos == 0 && _shuffle)
+		    std::shuffle(_order.begin(),_order.end(),g);
+		  ids.push_back(_order.at(_pos));
+		  _pos = (_pos + 1) % _order.size();
+		}
+	      dv.clear();
+	      _pull(ids,dv);
+	      int offset = _data[b].count() / _batch_size;
+	      for (int i=0;i<_batch_size;i++)
+		{
+		  uni_blob.set_cpu_data(_data[b].mutable_cpu_data() + i * offset);
+		  _transformer.Transform(dv.at(i),&uni_blob);
+		  _labels[b].at(i) = dv.at(i).label();
+		}
+	    }
+	  catch (...)
+	    {
+	      std::lock_guard<std::mutex> lock(_mutex);
+	      _error = std::current_exception();
+	      _cv.notify_all();
+	      return;
+	    }
+	  {
+	    std::lock_guard<std::mutex> lock(_mutex);
+	    _state[b] = READY;
+	  }
+	  _cv.notify_all();
+	  b = 1 - b;
+	}
+    }
+
+    enum buffer_state { FREE, READY, INUSE };
+
+    pull_function _pull; /**< pulls training samples from the input connector. */
+    std::vector<size_t> _order; /**< current epoch ordering of the training data. */
+    size_t _pos = 0; /**< position in current epoch. */
+    caffe::DataTransformer<float> _transformer; /**< transformer, as in the MemoryData layer. */
+    int _batch_size = 1;
+    bool _shuffle = true;
+    caffe::Blob<float> _data[2]; /**< double buffered mini-batch data. */
+    std::vector<float> _labels[2]; /**< double buffered mini-batch labels. */
+    buffer_state _state[2];
+    int _next = 0; /**< next buffer to be consumed. */
+    int _inuse = -1; /**< buffer in use by the consumer, if any. */
+    bool _running = false;
+    std::exception_ptr _error; /**< error from pulling or transforming the data, if any. */
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::thread _th;
+  };
+}
+
+#endif
@@ -20,7 +20,10 @@
  */
 
 #include "csvinputfileconn.h"
+#include "utils/datacache.hpp"
 #include <glog/logging.h>
+#include <map>
+#include <memory>
 
 namespace dd
 {
@@ -252,6 +255,130 @@ namespace dd
       throw InputConnectorBadParamException("cannot find id column " + _id);
   }
   
+  /*- parsed dataset cache -*/
+  static const char csv_cache_magic[8] = {'D','D','C','S','V','C','0','1'};
+  enum csv_cache_tag { CSV_CACHE_TRAIN = 0, CSV_CACHE_TEST = 1, CSV_CACHE_END = 2 };
+
+  std::string CSVInputFileConn::csv_cache_key(const std::string &fname) const
+  {
+    std::stringstream sk;
+    sk << fname << ":" << fileops::file_last_modif(fname) << ":" << fileops::file_size(fname) << ";";
+    if (!_csv_test_fname.empty())
+      sk << _csv_test_fname << ":" << fileops::file_last_modif(_csv_test_fname) << ":" << fileops::file_size(_csv_test_fname) << ";";
+    sk << "separator=" << _delim << ";id=" << _id << ";label=";
+    for (size_t l=0;l<_label.size();l++)
+      sk << _label.at(l) << "/" << (l < _label_offset.size() ? _label_offset.at(l) : 0) << ",";
+    std::vector<std::string> ignored(_ignored_columns.begin(),_ignored_columns.end());
+    std::sort(ignored.begin(),ignored.end());
+    sk << ";ignore=";
+    for (const std::string &ig: ignored)
+      sk << ig << ",";
+    sk << ";scale=" << _scale << ";min_vals=";
+    sk.precision(17);
+    for (double v: _min_vals)
+      sk << v << ",";
+    sk << ";max_vals=";
+    for (double v: _max_vals)
+      sk << v << ",";
+    std::map<std::string,std::map<std::string,int>> cats;
+    for (auto &c: _categoricals)
+      cats[c.first] = std::map<std::string,int>(c.second._vals.begin(),c.second._vals.end());
+    sk << ";categoricals=";
+    for (auto &c: cats)
+      {
+	sk << c.first << "{";
+	for (auto &v: c.second)
+	  sk << v.first << ":" << v.second << ",";
+	sk << "}";
+      }
+    return sk.str();
+  }
+
+  bool CSVInputFileConn::read_csv_cache(const std::string &key)
+  {
+    std::string cache_fname = _model_repo + "/" + _cache_fname;
+    DataCacheReader cr(cache_fname,csv_cache_magic);
+    if (!cr.is_open())
+      return false;
+
+    // header: key, categoricals and scaling bounds
+    std::string ckey;
+    bool ok = cr.read_str(ckey) && ckey == key;
+    std::unordered_map<std::string,CCategorical> categoricals;
+    std::vector<double> min_vals, max_vals;
+    uint64_t ncats = 0;
+    ok = ok && cr.read_size(ncats);
+    for (uint64_t c=0;ok&&c<ncats;c++)
+      {
+	std::string cname;
+	uint64_t nvals = 0;
+	ok = cr.read_str(cname) && cr.read_size(nvals);
+	CCategorical cc;
+	for (uint64_t v=0;ok&&v<nvals;v++)
+	  {
+	    std::string cval;
+	    int cnum = -1;
+	    ok = cr.read_str(cval) && cr.read_int(cnum);
+	    cc.add_cat(cval,cnum);
+	  }
+	categoricals.insert(std::pair<std::string,CCategorical>(cname,cc));
+      }
+    ok = ok && cr.read_vals(min_vals) && cr.read_vals(max_vals);
+
+    // check that data lines are complete before replaying any of them
+    size_t data_pos = cr._pos;
+    char tag = CSV_CACHE_END;
+    std::string cid;
+    std::vector<double> vals;
+    while (ok && (ok = cr.read_tag(tag)) && tag != CSV_CACHE_END)
+      ok = (tag == CSV_CACHE_TRAIN || tag == CSV_CACHE_TEST) && cr.read_str(cid) && cr.read_vals(vals,true);
+    if (!ok)
+      {
+	LOG(INFO) << "parsed dataset cache " << cache_fname << " is outdated or incomplete, parsing data again" << std::endl;
+	return false;
+      }
+
+    _categoricals = categoricals;
+    if (!min_vals.empty())
+      {
+	_min_vals = min_vals;
+	_max_vals = max_vals;
+      }
+    cr._pos = data_pos;
+    int nlines = 0, ntlines = 0;
+    while (cr.read_tag(tag) && tag != CSV_CACHE_END)
+      {
+	cr.read_str(cid);
+	cr.read_vals(vals);
+	if (tag == CSV_CACHE_TRAIN)
+	  {
+	    add_train_csvline(cid,vals);
+	    ++nlines;
+	  }
+	else
+	  {
+	    add_test_csvline(cid,vals);
+	    ++ntlines;
+	  }
+      }
+    LOG(INFO) << "read " << nlines << " training and " << ntlines << " test lines from parsed dataset cache " << cache_fname << std::endl;
+    return true;
+  }
+
+  void CSVInputFileConn::finalize_csv(const APIData &ad)
+  {
+    // shuffle before possible test data selection.
+    shuffle_data(ad);
+
+    if (_csv_test_fname.empty() && _test_split > 0)
+      {
+	split_data();
+	LOG(INFO) << "data split test size=" << _csvdata_test.size() << " / remaining data size=" << _csvdata.size() << std::endl;
+      }
+    if (!_ignored_columns.empty() || !_categoricals.empty())
+      update_columns();
+  }
+  
   void CSVInputFileConn::read_csv(const APIData &ad,
 				  const std::string &fname)
   {
@@ -271,6 +398,22 @@ namespace dd
       std::cout << std::endl;
       //debug
 
+      // parsed dataset cache, if any
+      bool cache = ad.has("cache") && ad.get("cache").get<bool>() && !_model_repo.empty();
+      std::string cache_key;
+      std::unique_ptr<DataCacheWriter> cache_out;
+      std::string cache_fname = _model_repo + "/" + _cache_fname;
+      if (cache)
+	{
+	  cache_key = csv_cache_key(fname);
+	  if (read_csv_cache(cache_key))
+	    {
+	      csv_file.close();
+	      finalize_csv(ad);
+	      return;
+	    }
+	}
+
       // categorical variables
       if (!_categoricals.empty())
 	{
@@ -334,6 +477,34 @@ namespace dd
 	  nlines = 0;
 	}
       
+      // cache header, data lines are appended as they are read
+      if (cache)
+	{
+	  cache_out.reset(new DataCacheWriter(cache_fname,csv_cache_magic));
+	  if (cache_out->is_open())
+	    {
+	      cache_out->write_str(cache_key);
+	      cache_out->write_size(_categoricals.size());
+	      for (auto &c: _categoricals)
+		{
+		  cache_out->write_str(c.first);
+		  cache_out->write_size(c.second._vals.size());
+		  for (auto &v: c.second._vals)
+		    {
+		      cache_out->write_str(v.first);
+		      cache_out->write_int(v.second);
+		    }
+		}
+	      cache_out->write_vals(_min_vals);
+	      cache_out->write_vals(_max_vals);
+	    }
+	  else
+	    {
+	      LOG(WARNING) << "cannot write parsed dataset cache " << cache_fname << std::endl;
+	      cache_out.reset();
+	    }
+	}
+      
       // read data
       while(std::getline(csv_file,hline))
 	{
@@ -345,11 +516,15 @@ namespace dd
 	    {
 	      scale_vals(vals);
 	    }
-	  if (!_id.empty())
+	  if (_id.empty())
+	    cid = std::to_string(nlines);
+	  if (cache_out)
 	    {
-	      add_train_csvline(cid,vals);
+	      cache_out->write_tag(CSV_CACHE_TRAIN);
+	      cache_out->write_str(cid);
+	      cache_out->write_vals(vals);
 	    }
-	  else add_train_csvline(std::to_string(nlines),vals); 
+	  add_train_csvline(cid,vals);
 	  
 	  //debug
 	  /*std::cout << "csv data line #" << nlines << "=";
@@ -378,11 +553,15 @@ namespace dd
 		{
 		  scale_vals(vals);
 		}
-	      if (!_id.empty())
-		add_test_csvline(cid,vals);
-	      //_csvdata_test.emplace_back(cid,vals);
-	      else add_test_csvline(std::to_string(nlines),vals);
-	      //_csvdata_test.emplace_back(std::to_string(nlines),vals);
+	      if (_id.empty())
+		cid = std::to_string(nlines);
+	      if (cache_out)
+		{
+		  cache_out->write_tag(CSV_CACHE_TEST);
+		  cache_out->write_str(cid);
+		  cache_out->write_vals(vals);
+		}
+	      add_test_csvline(cid,vals);
 	      
 	      //debug
 	      /*std::cout << "csv test data line=";
@@ -394,16 +573,16 @@ namespace dd
 	  csv_test_file.close();
 	}
 
-      // shuffle before possible test data selection.
-      shuffle_data(ad);
-      
-      if (_csv_test_fname.empty() && _test_split > 0)
+      // complete the cache, made visible only once fully written
+      if (cache_out)
 	{
-	  split_data();
-	  LOG(INFO) << "data split test size=" << _csvdata_test.size() << " / remaining data size=" << _csvdata.size() << std::endl;
+	  cache_out->write_tag(CSV_CACHE_END);
+	  if (!cache_out->commit())
+	    LOG(WARNING) << "failed writing parsed dataset cache " << cache_fname << std::endl;
+	  else LOG(INFO) << "wrote parsed dataset cache " << cache_fname << std::endl;
 	}
-      if (!_ignored_columns.empty() || !_categoricals.empty())
-	update_columns();
+
+      finalize_csv(ad);
   }
   
 }
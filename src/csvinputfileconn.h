@@ -418,6 +418,28 @@ namespace dd
     void read_csv(const APIData &ad,
 		  const std::string &fname);
 
+    /**
+     * \brief key of the parsed dataset cache, from data files path, modification time
+     *        and size, and connector parameters that affect parsing
+     * @param fname training data file name
+     * @return cache key
+     */
+    std::string csv_cache_key(const std::string &fname) const;
+
+    /**
+     * \brief restores categoricals, scaling bounds and data lines from the parsed dataset
+     *        cache in the model repository, if its key matches
+     * @param key expected cache key
+     * @return true if the cache was used, false otherwise
+     */
+    bool read_csv_cache(const std::string &key);
+
+    /**
+     * \brief shuffles, splits and updates columns once data has been read
+     * @param ad input data object
+     */
+    void finalize_csv(const APIData &ad);
+
     int batch_size() const
     {
       return _csvdata.size();
@@ -518,7 +540,8 @@ namespace dd
     std::vector<double> _max_vals; /**< lower bound used for auto-scaling data */
     std::unordered_map<std::string,CCategorical> _categoricals; /**< auto-converted categorical variables */
     double _test_split = -1;
-    
+    std::string _cache_fname = "csv_cache.dat"; /**< parsed dataset cache, in model repository */
+
     // data
     std::vector<CSVline> _csvdata;
     std::vector<CSVline> _csvdata_test;
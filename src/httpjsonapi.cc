@@ -34,12 +34,25 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/array.hpp>
 #include <chrono>
 #include <ctime>
+#include <future>
 
 DEFINE_string(host,"localhost","host for running the server");
 DEFINE_string(port,"8080","server port");
 DEFINE_int32(nthreads,10,"number of HTTP server threads");
+DEFINE_bool(http_async,false,"whether to run the asynchronous HTTP server, that keeps connections alive, serves pipelined requests and runs calls on a separate pool of inference workers");
+DEFINE_int32(inference_workers,0,"number of inference workers of the asynchronous HTTP server (0: same as nthreads)");
+DEFINE_int32(inference_queue,256,"maximum number of calls waiting for an inference worker, further calls are rejected with 503 (0: unbounded)");
+DEFINE_int32(http_async_connections,256,"maximum number of simultaneous connections of the asynchronous HTTP server, kept alive and served by a thread each");
+DEFINE_int32(max_inflated_size,512,"maximum size of a decompressed gzip request body, in MB (0: unlimited)");
+DEFINE_int32(max_body_size,512,"maximum size of a request body, in MB, larger bodies are rejected with 413 (0: unlimited)");
+DEFINE_string(unix_socket,"","path of a unix domain socket to also serve the API on, for co-located clients");
+DEFINE_int32(unix_socket_connections,64,"maximum number of simultaneous connections on the unix domain socket");
+DEFINE_string(service_manifest,"","file created services are persisted to, and restored from at startup");
+DEFINE_int32(restore_concurrency,4,"number of services restored in parallel at startup");
+DEFINE_bool(restore_warmup,false,"whether to load and run the nets of restored services once before reporting ready");
 
 using namespace boost::iostreams;
 
@@ -115,6 +128,18 @@ namespace dd
   }
 }
 
+/**
+ * \brief HTTP reply, independent of the server flavor
+ */
+class APIReply
+{
+public:
+  int _status = 200;
+  std::string _body;
+  bool _gzip = false; /**< whether the body is gzip encoded. */
+  std::string _content_type = "application/json";
+};
+
 class APIHandler
 {
 public:
@@ -137,12 +162,13 @@ public:
     return rep;
     }*/
   
-  void fillup_response(http_server::response &response,
+  void fillup_response(APIReply &reply,
 		       const JDoc &janswer,
 		       std::string &access_log,
 		       int &code,
 		       std::chrono::time_point<std::chrono::system_clock> tstart,
-		       const std::string &encoding="")
+		       const std::string &encoding="",
+		       const bool &binary=false)
   {
     std::chrono::time_point<std::chrono::system_clock> tstop = std::chrono::system_clock::now();
     std::string service;
@@ -159,6 +185,7 @@ public:
     access_log += " " + std::to_string(proctime);
     int outcode = code;
     std::string stranswer;
+    bool binary_answer = false;
     if (janswer.HasMember("template")) // if output template, fillup with rendered template.
       {
 	std::string tpl = janswer["template"].GetString();
@@ -166,6 +193,16 @@ public:
 	mustache::RenderTemplate(tpl," ",janswer,&sg);
 	stranswer = sg.str();
       }
+    else if (code == 200
+	     && (binary || (janswer.HasMember("format") && std::string(janswer["format"].GetString()) == "binary")))
+      {
+	stranswer = _hja->jrender_binary(janswer);
+	binary_answer = true;
+      }
+    else if (janswer.HasMember("float_precision"))
+      {
+	stranswer = _hja->jrender(janswer,janswer["float_precision"].GetInt());
+      }
     else
       {
 	stranswer = _hja->jrender(janswer);
@@ -195,6 +232,7 @@ public:
 	      {
 		dd::httpclient::post_call(url,stranswer,http_method,outcode,outstr,content_type);
 		stranswer = outstr;
+		binary_answer = false;
 	      }
 	    catch (std::runtime_error &e)
 	      {
@@ -222,41 +260,84 @@ public:
 	    LOG(ERROR) << e.what() << std::endl;
 	    outcode = 400;
 	    stranswer = _hja->jrender(_hja->dd_bad_request_400());
+	    has_gzip = false;
+	    binary_answer = false;
 	  }
       }
-    response = http_server::response::stock_reply(http_server::response::status_type(outcode),stranswer);
-    response.headers[1].value = "application/json";
-    if (!encoding.empty() && has_gzip)
+    reply._body = std::move(stranswer);
+    reply._gzip = !encoding.empty() && has_gzip;
+    reply._status = code;
+    reply._content_type = binary_answer ? "application/octet-stream" : "application/json";
+  }
+
+  /**
+   * \brief decompresses a gzip body in chunks, straight into the parser input, and
+   *        stops as soon as the decompressed size goes beyond the limit
+   * @param gz compressed body
+   * @param out decompressed body
+   * @return false if the decompressed body is too large
+   */
+  bool inflate(const std::string &gz,
+	       std::string &out)
+  {
+    size_t max_size = static_cast<size_t>(std::max(0,FLAGS_max_inflated_size)) * 1024 * 1024;
+    filtering_istream gzin;
+    gzin.push(gzip_decompressor());
+    gzin.push(boost::iostreams::array_source(gz.data(),gz.size()));
+    size_t reserve = gz.size() * 4;
+    if (max_size > 0)
+      reserve = std::min(reserve,max_size);
+    out.reserve(reserve);
+    char buf[65536];
+    while(gzin)
       {
-	response.headers.resize(3);
-	response.headers[2].name = "Content-Encoding";
-	response.headers[2].value = "gzip";
+	gzin.read(buf,sizeof(buf));
+	std::streamsize n = gzin.gcount();
+	if (n <= 0)
+	  break;
+	if (max_size > 0 && out.size() + n > max_size)
+	  return false;
+	out.append(buf,n);
       }
-    response.status = static_cast<http_server::response::status_type>(code);
+    if (gzin.bad())
+      throw std::runtime_error("failed decompressing gzip request body");
+    return true;
   }
 
-  void operator()(http_server::request const &request,
-		  http_server::response &response)
+  void not_found(APIReply &reply)
   {
-    //debug
-    /*std::cerr << "uri=" << request.destination << std::endl;
-    std::cerr << "method=" << request.method << std::endl;
-    std::cerr << "source=" << request.source << std::endl;
-    std::cerr << "body=" << request.body << std::endl;*/
-    //debug
+    reply._status = 404;
+    reply._body = _hja->jrender(_hja->dd_not_found_404());
+    reply._gzip = false;
+  }
 
+  /**
+   * \brief routes a request to the API and renders the reply
+   * @param source_in client address
+   * @param req_method HTTP method
+   * @param destination request URI
+   * @param headers request headers
+   * @param body_in request body, possibly compressed
+   * @param reply HTTP reply
+   */
+  void route(const std::string &source_in,
+	     const std::string &req_method,
+	     const std::string &destination,
+	     const dd::http_headers &headers,
+	     const std::string &body_in,
+	     APIReply &reply)
+  {
     std::chrono::time_point<std::chrono::system_clock> tstart = std::chrono::system_clock::now();
-    std::string access_log =  request.source + " \"" + request.method + " " + request.destination + "\"";
+    std::string access_log =  source_in + " \"" + req_method + " " + destination + "\"";
     int code;    
-    std::string source = request.source;
+    std::string source = source_in;
     if (source == "::1")
       source = "127.0.0.1";
     uri::uri ur;
     ur << uri::scheme("http")
        << uri::host(source)
-       << uri::path(request.destination);
+       << uri::path(destination);
 
-    std::string req_method = request.method;
     std::string req_path = uri::path(ur);
     std::string req_query = uri::query(ur);
     std::transform(req_path.begin(),req_path.end(),req_path.begin(),::tolower);
@@ -265,10 +346,9 @@ public:
     if (rscs.empty())
       {
 	LOG(ERROR) << "empty resource\n";
-	response = http_server::response::stock_reply(http_server::response::not_found,_hja->jrender(_hja->dd_not_found_404()));
+	not_found(reply);
 	return;
       }
-    std::string body = request.body;
     
     //debug
     /*std::cerr << "ur=" << ur << std::endl;
@@ -281,33 +361,38 @@ public:
 
     std::string content_encoding;
     std::string accept_encoding;
-    for (const auto& header : request.headers) {
-      if (header.name == "Accept-Encoding")
-	  accept_encoding = header.value;
-      else if (header.name == "Content-Encoding")
-	content_encoding = header.value;
+    bool accept_binary = false;
+    for (const auto& header : headers) {
+      if (header.first == "Accept-Encoding")
+	  accept_encoding = header.second;
+      else if (header.first == "Content-Encoding")
+	content_encoding = header.second;
+      else if (header.first == "Accept")
+	accept_binary = header.second.find("application/octet-stream") != std::string::npos;
     }
     bool encoding_error = false;
+    std::string inflated; // parser input, when the body is compressed
+    bool has_inflated = false;
     if (!content_encoding.empty())
       {
 	if (content_encoding == "gzip")
 	  {
-	    if (!body.empty())
+	    if (!body_in.empty())
 	      {
 		try
 		  {
-		    std::string gzstr;
-		    filtering_ostream gzin;
-		    gzin.push(gzip_decompressor());
-		    gzin.push(boost::iostreams::back_inserter(gzstr));
-		    gzin << body;
-		    boost::iostreams::close(gzin);
-		    body = gzstr;
+		    if (!inflate(body_in,inflated))
+		      {
+			LOG(ERROR) << "decompressed request body is larger than " << FLAGS_max_inflated_size << "MB" << std::endl;
+			fillup_response(reply,_hja->dd_payload_too_large_413(),access_log,code,tstart);
+			encoding_error = true;
+		      }
+		    has_inflated = true;
 		  }
 		catch(const std::exception &e)
 		  {
 		    LOG(ERROR) << e.what() << std::endl;
-		    fillup_response(response,_hja->dd_bad_request_400(),access_log,code,tstart);
+		    fillup_response(reply,_hja->dd_bad_request_400(),access_log,code,tstart);
 		    code = 400;
 		    encoding_error = true;
 		  }
@@ -316,77 +401,89 @@ public:
 	else
 	  {
 	    LOG(ERROR) << "Unsupported content-encoding:" << content_encoding << std::endl;
-	    fillup_response(response,_hja->dd_bad_request_400(),access_log,code,tstart);
+	    fillup_response(reply,_hja->dd_bad_request_400(),access_log,code,tstart);
 	    code = 400;
 	    encoding_error = true;
 	  }
       }
 
+    const std::string &body = has_inflated ? inflated : body_in;
+
     if (!encoding_error)
       {
 	if (rscs.at(0) == _rsc_info)
 	  {
-	    fillup_response(response,_hja->info(),access_log,code,tstart,accept_encoding);
+	    fillup_response(reply,_hja->info(),access_log,code,tstart,accept_encoding);
+	  }
+	else if (rscs.at(0) == _rsc_health)
+	  {
+	    fillup_response(reply,_hja->health(),access_log,code,tstart,accept_encoding);
 	  }
 	else if (rscs.at(0) == _rsc_services)
 	  {
 	    if (rscs.size() < 2)
 	      {
-		fillup_response(response,_hja->dd_bad_request_400(),access_log,code,tstart);
+		fillup_response(reply,_hja->dd_bad_request_400(),access_log,code,tstart);
 		LOG(ERROR) << access_log << std::endl;
 		return;
 	      }
 	    std::string sname = rscs.at(1);
 	    if (req_method == "GET")
 	      {
-		fillup_response(response,_hja->service_status(sname),access_log,code,tstart,accept_encoding);
+		fillup_response(reply,_hja->service_status(sname),access_log,code,tstart,accept_encoding);
 	      }
 	    else if (req_method == "PUT" || req_method == "POST") // tolerance to using POST
 	      {
-		fillup_response(response,_hja->service_create(sname,body),access_log,code,tstart,accept_encoding);
+		fillup_response(reply,_hja->service_create(sname,body),access_log,code,tstart,accept_encoding);
 	      }
 	    else if (req_method == "DELETE")
 	      {
 		// DELETE does not accept body so query options are turned into JSON for internal processing
 		std::string jstr = dd::uri_query_to_json(req_query);
-		fillup_response(response,_hja->service_delete(sname,jstr),access_log,code,tstart,accept_encoding);
+		fillup_response(reply,_hja->service_delete(sname,jstr),access_log,code,tstart,accept_encoding);
 	      }
 	  }
 	else if (rscs.at(0) == _rsc_predict)
 	  {
 	    if (req_method != "POST")
 	      {
-		fillup_response(response,_hja->dd_bad_request_400(),access_log,code,tstart);
+		fillup_response(reply,_hja->dd_bad_request_400(),access_log,code,tstart);
 		LOG(ERROR) << access_log << std::endl;
 		return;
 	      }
-	    fillup_response(response,_hja->service_predict(body),access_log,code,tstart,accept_encoding);
+	    fillup_response(reply,_hja->service_predict(body),access_log,code,tstart,accept_encoding,accept_binary);
 	  }
 	else if (rscs.at(0) == _rsc_train)
 	  {
 	    if (req_method == "GET")
 	      {
 		std::string jstr = dd::uri_query_to_json(req_query);
-		fillup_response(response,_hja->service_train_status(jstr),access_log,code,tstart,accept_encoding);
+		fillup_response(reply,_hja->service_train_status(jstr),access_log,code,tstart,accept_encoding);
 	      }
 	    else if (req_method == "PUT" || req_method == "POST")
 	      {
-		fillup_response(response,_hja->service_train(body),access_log,code,tstart,accept_encoding);
+		fillup_response(reply,_hja->service_train(body),access_log,code,tstart,accept_encoding);
 	      }
 	    else if (req_method == "DELETE")
 	      {
 		// DELETE does not accept body so query options are turned into JSON for internal processing
 		std::string jstr = dd::uri_query_to_json(req_query);
-		fillup_response(response,_hja->service_train_delete(jstr),access_log,code,tstart);
+		fillup_response(reply,_hja->service_train_delete(jstr),access_log,code,tstart);
 	      }
 	  }
 	else
 	  {
 	    LOG(ERROR) << "Unknown Service=" << rscs.at(0) << std::endl;
-	    response = http_server::response::stock_reply(http_server::response::not_found,_hja->jrender(_hja->dd_not_found_404()));
+	    not_found(reply);
 	    code = 404;
 	  }
       }
+    log_access(access_log,code);
+  }
+
+  void log_access(const std::string &access_log,
+		  const int &code)
+  {
     std::time_t t = std::time(nullptr);
 #if __GNUC__ >= 5
     if (code == 200 || code == 201)
@@ -400,6 +497,32 @@ public:
     else LOG(ERROR) << mltime << " - " << access_log << std::endl;
 #endif
   }
+
+  void operator()(http_server::request const &request,
+		  http_server::response &response)
+  {
+    //debug
+    /*std::cerr << "uri=" << request.destination << std::endl;
+    std::cerr << "method=" << request.method << std::endl;
+    std::cerr << "source=" << request.source << std::endl;
+    std::cerr << "body=" << request.body << std::endl;*/
+    //debug
+
+    dd::http_headers headers;
+    for (const auto& header : request.headers)
+      headers.push_back(std::pair<std::string,std::string>(header.name,header.value));
+    APIReply reply;
+    route(request.source,request.method,request.destination,headers,request.body,reply);
+    response = http_server::response::stock_reply(http_server::response::status_type(reply._status),reply._body);
+    response.headers[1].value = reply._content_type;
+    if (reply._gzip)
+      {
+	response.headers.resize(3);
+	response.headers[2].name = "Content-Encoding";
+	response.headers[2].value = "gzip";
+      }
+  }
+
   void log(http_server::string_type const &info)
   {
     LOG(ERROR) << info << std::endl;
@@ -407,11 +530,94 @@ public:
 
   dd::HttpJsonAPI *_hja;
   std::string _rsc_info = "info";
+  std::string _rsc_health = "health";
   std::string _rsc_services = "services";
   std::string _rsc_predict = "predict";
   std::string _rsc_train = "train";
 };
 
+/**
+ * \brief asynchronous server handler: requests are read by the connection threads
+ *        of the keep-alive server, then handed over to the bounded inference worker
+ *        pool. Connections and running calls are thus bounded independently.
+ */
+class AsyncAPIHandler
+{
+public:
+  AsyncAPIHandler(dd::HttpJsonAPI *hja,
+		  dd::WorkerPool *pool)
+    :_handler(hja),_pool(pool) { }
+
+  ~AsyncAPIHandler() { }
+
+  void operator()(const std::string &source,
+		  const std::string &method,
+		  const std::string &destination,
+		  const dd::http_headers &headers,
+		  std::string &body,
+		  APIReply &reply)
+  {
+    // light calls are answered by the connection threads
+    if (method == "GET" && (destination.compare(0,5,"/info") == 0
+			    || destination.compare(0,7,"/health") == 0))
+      {
+	_handler.route(source,method,destination,headers,body,reply);
+	return;
+      }
+    std::shared_ptr<std::packaged_task<void()>> task(new std::packaged_task<void()>([&]
+      {
+	try
+	  {
+	    _handler.route(source,method,destination,headers,body,reply);
+	  }
+	catch (std::exception &e)
+	  {
+	    LOG(ERROR) << e.what() << std::endl;
+	    reply = APIReply();
+	    reply._status = 500;
+	    reply._body = _handler._hja->jrender(_handler._hja->dd_internal_error_500());
+	  }
+      }));
+    std::future<void> ft = task->get_future();
+    if (!_pool->try_submit([task]{ (*task)(); }))
+      {
+	reply._status = 503;
+	reply._body = _handler._hja->jrender(_handler._hja->dd_service_unavailable_503());
+	_handler.log_access(source + " \"" + method + " " + destination + "\" 503 inference queue full",503);
+	return;
+      }
+    ft.get();
+  }
+
+  APIHandler _handler;
+  dd::WorkerPool *_pool = nullptr;
+};
+
+/**
+ * \brief keep-alive server handler on top of an API handler
+ */
+template<typename H>
+dd::UnixHttpServer::handler http_handler(H h)
+{
+  return [h](const std::string &source,
+	     const std::string &method,
+	     const std::string &destination,
+	     const dd::http_headers &headers,
+	     std::string &body,
+	     int &status,
+	     std::string &reply_body,
+	     dd::http_headers &reply_headers) mutable
+    {
+      APIReply reply;
+      h(source,method,destination,headers,body,reply);
+      status = reply._status;
+      reply_body = std::move(reply._body);
+      reply_headers.push_back(std::pair<std::string,std::string>("Content-Type",reply._content_type));
+      if (reply._gzip)
+	reply_headers.push_back(std::pair<std::string,std::string>("Content-Encoding","gzip"));
+    };
+}
+
 namespace dd
 {
   volatile std::sig_atomic_t _sigstatus;
@@ -419,6 +625,11 @@ namespace dd
   /* variables for C-like signal handling */
   HttpJsonAPI *_ghja = nullptr;
   http_server *_gdd_server = nullptr;
+
+  static size_t max_body_size()
+  {
+    return static_cast<size_t>(std::max(0,FLAGS_max_body_size)) * 1024 * 1024;
+  }
   
   HttpJsonAPI::HttpJsonAPI()
     :JsonAPI()
@@ -427,13 +638,38 @@ namespace dd
 
   HttpJsonAPI::~HttpJsonAPI()
   {
+    if (_restore_thread.joinable())
+      _restore_thread.join();
     delete _dd_server;
   }
 
+  int HttpJsonAPI::start_unix_server(const std::string &path)
+  {
+    APIHandler ahandler(this);
+    _unix_server = std::unique_ptr<UnixHttpServer>(new UnixHttpServer(path,
+								      http_handler([ahandler](const std::string &source,
+											      const std::string &method,
+											      const std::string &destination,
+											      const http_headers &headers,
+											      std::string &body,
+											      APIReply &reply) mutable
+										   {
+										     ahandler.route(source,method,destination,headers,body,reply);
+										   }),
+								      FLAGS_unix_socket_connections,
+								      max_body_size()));
+    return _unix_server->start();
+  }
+
   int HttpJsonAPI::start_server(const std::string &host,
 				const std::string &port,
 				const int &nthreads)
   {
+    if (!FLAGS_unix_socket.empty() && !_unix_server
+	&& start_unix_server(FLAGS_unix_socket))
+      return 1;
+    if (FLAGS_http_async)
+      return start_async_server(host,port,nthreads);
     APIHandler ahandler(this);
     http_server::options options(ahandler);
     _dd_server = new http_server(options.address(host)
@@ -460,6 +696,26 @@ namespace dd
     return 0;
   }
 
+  int HttpJsonAPI::start_async_server(const std::string &host,
+				      const std::string &port,
+				      const int &nthreads)
+  {
+    int nworkers = FLAGS_inference_workers > 0 ? FLAGS_inference_workers : nthreads;
+    _inference_pool = std::unique_ptr<WorkerPool>(new WorkerPool(nworkers,FLAGS_inference_queue));
+    _async_server = std::unique_ptr<TcpHttpServer>(new TcpHttpServer(host,port,
+								     http_handler(AsyncAPIHandler(this,_inference_pool.get())),
+								     FLAGS_http_async_connections,
+								     max_body_size()));
+    _ghja = this;
+    if (_async_server->start())
+      return 1;
+    LOG(INFO) << "Running DeepDetect asynchronous HTTP server with " << nworkers << " inference workers" << std::endl;
+    _async_server->wait();
+    // connections are closed, the pool drains the remaining calls
+    _inference_pool.reset();
+    return 0;
+  }
+
   int HttpJsonAPI::start_server_daemon(const std::string &host,
 				       const std::string &port,
 				       const int &nthreads)
@@ -473,6 +729,10 @@ namespace dd
   void HttpJsonAPI::stop_server()
   {
     LOG(INFO) << "stopping HTTP server\n";
+    if (_unix_server)
+      _unix_server->stop();
+    if (_async_server)
+      _async_server->stop();
     if (_dd_server)
       {
 	try
@@ -502,6 +762,13 @@ namespace dd
   {
     google::ParseCommandLineFlags(&argc, &argv, true);
     std::signal(SIGINT,terminate);
+    if (!FLAGS_service_manifest.empty())
+      {
+	// services are restored while the server is up, /health tells when they are ready
+	set_manifest(FLAGS_service_manifest);
+	_restoring = true;
+	_restore_thread = std::thread(&JsonAPI::restore_services,this,FLAGS_restore_concurrency,FLAGS_restore_warmup);
+      }
     return start_server(FLAGS_host,FLAGS_port,FLAGS_nthreads);
   }
 
@@ -23,6 +23,8 @@
 #define HTTPJSONAPI_H
 
 #include "jsonapi.h"
+#include "workerpool.h"
+#include "unixhttpserver.h"
 #include <boost/network/protocol/http/server.hpp>
 #include <boost/network/uri.hpp>
 #include <boost/network/uri/uri_io.hpp>
@@ -49,11 +51,19 @@ namespace dd
     int start_server(const std::string &host,
 		     const std::string &port,
 		     const int &nthreads);
+    int start_async_server(const std::string &host,
+			   const std::string &port,
+			   const int &nthreads);
+    int start_unix_server(const std::string &path);
     int boot(int argc, char *argv[]);
     static void terminate(int param);
     
     http_server *_dd_server = nullptr; /**< main reusable pointer to server object */
+    std::unique_ptr<WorkerPool> _inference_pool; /**< inference workers of the asynchronous server */
+    std::unique_ptr<TcpHttpServer> _async_server; /**< asynchronous keep-alive server, if any */
+    std::unique_ptr<UnixHttpServer> _unix_server; /**< unix domain socket server, if any */
     std::future<int> _ft; /**< holds the results from the main server thread */
+    std::thread _restore_thread; /**< restores services from the manifest at startup */
   };
 }
 
@@ -29,9 +29,135 @@
 #include "ext/base64/base64.h"
 #include <glog/logging.h>
 #include <random>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <queue>
+#include <cstdio>
 
 namespace dd
 {
+
+  /**
+   * \brief process-wide store of decoded images, so that images can be handed
+   *        over from one service to the next without re-encoding, through URIs
+   *        of the form mem://batch/index
+   */
+  class MemImages
+  {
+  public:
+    /**
+     * \brief registers a batch of decoded images for the lifetime of the object
+     * @param imgs decoded images
+     */
+    MemImages(std::vector<cv::Mat> &&imgs)
+    {
+      static std::atomic<long int> batch_counter = {0};
+      _batch = std::to_string(batch_counter++);
+      std::lock_guard<std::mutex> lock(mutex());
+      store().insert(std::pair<std::string,std::vector<cv::Mat>>(_batch,std::move(imgs)));
+    }
+
+    ~MemImages()
+    {
+      std::lock_guard<std::mutex> lock(mutex());
+      store().erase(_batch);
+    }
+
+    MemImages(const MemImages&) = delete;
+    MemImages& operator=(const MemImages&) = delete;
+
+    /**
+     * \brief URI of an image in this batch
+     */
+    std::string uri(const size_t &i) const
+    {
+      return "mem://" + _batch + "/" + std::to_string(i);
+    }
+
+    /**
+     * \brief image in this batch
+     */
+    cv::Mat at(const size_t &i) const
+    {
+      std::lock_guard<std::mutex> lock(mutex());
+      return store().at(_batch).at(i);
+    }
+
+    /**
+     * \brief number of images in this batch
+     */
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex());
+      return store().at(_batch).size();
+    }
+
+    static bool is_mem(const std::string &uri)
+    {
+      return uri.compare(0,6,"mem://") == 0;
+    }
+
+    /**
+     * \brief index of an image in this batch from its URI
+     * @return -1 if the URI does not belong to this batch
+     */
+    long int index(const std::string &uri) const
+    {
+      std::string prefix = "mem://" + _batch + "/";
+      if (uri.compare(0,prefix.size(),prefix) != 0)
+	return -1;
+      return std::stol(uri.substr(prefix.size()));
+    }
+
+    /**
+     * \brief looks up an image from its URI, images are shared, not copied
+     * @param uri mem://batch/index
+     * @param img image destination
+     * @return false if the image is not (or no more) in the store
+     */
+    static bool get(const std::string &uri, cv::Mat &img)
+    {
+      if (!is_mem(uri))
+	return false;
+      std::string rest = uri.substr(6);
+      size_t slash = rest.find('/');
+      if (slash == std::string::npos)
+	return false;
+      long int i = -1;
+      try
+	{
+	  i = std::stol(rest.substr(slash+1));
+	}
+      catch (std::exception &e)
+	{
+	  return false;
+	}
+      std::lock_guard<std::mutex> lock(mutex());
+      auto hit = store().find(rest.substr(0,slash));
+      if (hit == store().end() || i < 0 || i >= static_cast<long int>((*hit).second.size()))
+	return false;
+      img = (*hit).second.at(i);
+      return true;
+    }
+
+  private:
+    static std::unordered_map<std::string,std::vector<cv::Mat>>& store()
+    {
+      static std::unordered_map<std::string,std::vector<cv::Mat>> s;
+      return s;
+    }
+
+    static std::mutex& mutex()
+    {
+      static std::mutex m;
+      return m;
+    }
+
+    std::string _batch; /**< batch identifier. */
+  };
   
   class DDImg
   {
@@ -76,12 +202,60 @@ namespace dd
       {
 	std::vector<unsigned char> vdat(str.begin(),str.end());
 	cv::Mat img = cv::Mat(cv::imdecode(cv::Mat(vdat,true),_bw ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR));
-	_imgs_size.push_back(std::pair<int,int>(img.rows,img.cols));
-	cv::Size size(_width,_height);
-	cv::Mat rimg;
-	cv::resize(img,rimg,size,0,0,CV_INTER_CUBIC);
-	_imgs.push_back(rimg);
+	add_image(img);
       }
+
+    // store image, resized to the input size unless required otherwise
+    void add_image(const cv::Mat &img)
+    {
+      if (_resize && _tile_size > 0)
+	{
+	  if (img.cols > _tile_size || img.rows > _tile_size)
+	    {
+	      add_tiles(img);
+	      return;
+	    }
+	  _tiles.push_back("");
+	}
+      _imgs_size.push_back(std::pair<int,int>(img.rows,img.cols));
+      if (!_resize)
+	{
+	  _imgs.push_back(img);
+	  return;
+	}
+      cv::Size size(_width,_height);
+      cv::Mat rimg;
+      cv::resize(img,rimg,size,0,0,CV_INTER_CUBIC);
+      _imgs.push_back(rimg);
+    }
+
+    // tile offsets along a side, the last tile is aligned on the border
+    std::vector<int> tile_offsets(const int &side) const
+    {
+      std::vector<int> offsets = { 0 };
+      if (side <= _tile_size)
+	return offsets;
+      int stride = std::max(1,static_cast<int>(_tile_size * (1.0 - _tile_overlap)));
+      while(offsets.back() + _tile_size < side)
+	offsets.push_back(std::min(offsets.back() + stride,side - _tile_size));
+      return offsets;
+    }
+
+    // overlapping windows at native resolution, each window is keyed by its offset
+    void add_tiles(const cv::Mat &img)
+    {
+      cv::Size size(_width,_height);
+      for (int y: tile_offsets(img.rows))
+	for (int x: tile_offsets(img.cols))
+	  {
+	    cv::Mat tile = img(cv::Rect(x,y,std::min(_tile_size,img.cols-x),std::min(_tile_size,img.rows-y)));
+	    _imgs_size.push_back(std::pair<int,int>(tile.rows,tile.cols));
+	    cv::Mat rimg;
+	    cv::resize(tile,rimg,size,0,0,CV_INTER_CUBIC);
+	    _imgs.push_back(rimg);
+	    _tiles.push_back("#tile=" + std::to_string(x) + "," + std::to_string(y));
+	  }
+    }
     
     // deserialize image, independent of format
     void deserialize(std::stringstream &input)
@@ -97,17 +271,132 @@ namespace dd
 	decode(str);
       }
     
+    // video file extensions
+    static bool is_video(const std::string &fname)
+    {
+      static const std::vector<std::string> exts = { ".mp4", ".avi", ".mkv", ".mov", ".webm", ".mpg", ".mpeg", ".m4v", ".flv", ".ts" };
+      size_t dot = fname.rfind('.');
+      if (dot == std::string::npos)
+	return false;
+      std::string ext = fname.substr(dot);
+      std::transform(ext.begin(),ext.end(),ext.begin(),::tolower);
+      return std::find(exts.begin(),exts.end(),ext) != exts.end();
+    }
+    
     // data acquisition
     int read_file(const std::string &fname)
     {
+      if (_video || is_video(fname))
+	return read_video(fname);
       cv::Mat img = cv::imread(fname,_bw ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR);
       if (img.empty())
 	return -1;
-      _imgs_size.push_back(std::pair<int,int>(img.rows,img.cols));
-      cv::Size size(_width,_height);
-      cv::Mat rimg;
-      cv::resize(img,rimg,size,0,0,CV_INTER_CUBIC);
-      _imgs.push_back(rimg);
+      add_image(img);
+      return 0;
+    }
+
+    // video file or pipe, frames are sampled and decoded on a background thread
+    // while the calling thread resizes them, each frame is keyed by its timestamp
+    int read_video(const std::string &fname)
+    {
+      cv::VideoCapture cap(fname);
+      if (!cap.isOpened())
+	return -1;
+      double fps = cap.get(CV_CAP_PROP_FPS);
+      static const size_t max_queued = 16;
+      std::queue<std::pair<double,cv::Mat>> frames;
+      std::mutex fmutex;
+      std::condition_variable fcv;
+      bool done = false;
+      bool stop = false;
+      std::exception_ptr derror; // decoding error, rethrown on the calling thread
+      std::thread decoder([&]()
+	{
+	  long int n = 0;
+	  int nsampled = 0;
+	  double next_ts = 0.0;
+	  try
+	    {
+	      while(nsampled < _video_max_frames)
+		{
+		  if (!cap.grab()) // skipped frames are not decoded
+		    break;
+		  double ts = cap.get(CV_CAP_PROP_POS_MSEC);
+		  if (ts <= 0.0 && n > 0 && fps > 0.0) // no timestamp from the stream
+		    ts = n * 1000.0 / fps;
+		  bool sample = false;
+		  if (_video_fps > 0.0)
+		    {
+		      if ((sample = ts >= next_ts))
+			while(next_ts <= ts)
+			  next_ts += 1000.0 / _video_fps;
+		    }
+		  else sample = (n % _video_stride == 0);
+		  ++n;
+		  if (!sample)
+		    continue;
+		  cv::Mat frame;
+		  if (!cap.retrieve(frame) || frame.empty())
+		    continue;
+		  ++nsampled;
+		  std::unique_lock<std::mutex> lock(fmutex);
+		  fcv.wait(lock,[&]{ return stop || frames.size() < max_queued; });
+		  if (stop)
+		    break;
+		  frames.push(std::pair<double,cv::Mat>(ts,frame));
+		  fcv.notify_all();
+		}
+	    }
+	  catch (...)
+	    {
+	      derror = std::current_exception();
+	    }
+	  std::lock_guard<std::mutex> lock(fmutex);
+	  done = true;
+	  fcv.notify_all();
+	});
+      try
+	{
+	  while(true)
+	    {
+	      std::pair<double,cv::Mat> f;
+	      {
+		std::unique_lock<std::mutex> lock(fmutex);
+		fcv.wait(lock,[&]{ return done || !frames.empty(); });
+		if (frames.empty())
+		  break;
+		f = std::move(frames.front());
+		frames.pop();
+		fcv.notify_all();
+	      }
+	      if (_bw && f.second.channels() == 3)
+		{
+		  cv::Mat gimg;
+		  cv::cvtColor(f.second,gimg,CV_BGR2GRAY);
+		  f.second = gimg;
+		}
+	      size_t nimgs = _imgs.size();
+	      add_image(f.second);
+	      char ts[32];
+	      snprintf(ts,sizeof(ts),"%.3f",f.first / 1000.0);
+	      _img_files.insert(_img_files.end(),_imgs.size()-nimgs,fname + "#t=" + ts);
+	    }
+	}
+      catch (...)
+	{
+	  {
+	    std::lock_guard<std::mutex> lock(fmutex);
+	    stop = true;
+	    fcv.notify_all();
+	  }
+	  decoder.join();
+	  throw;
+	}
+      decoder.join();
+      if (derror)
+	std::rethrow_exception(derror);
+      if (_imgs.empty())
+	return -1;
       return 0;
     }
 
@@ -138,6 +427,72 @@ namespace dd
       return 0;
     }
 
+    // shared memory, read in place
+    int read_shm(const ShmSegment &seg)
+    {
+      cv::Mat img;
+      if (seg._shape.empty()) // encoded image
+	{
+	  cv::Mat buf(1,seg.size(),CV_8UC1,const_cast<char*>(seg.data()));
+	  img = cv::imdecode(buf,_bw ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR);
+	}
+      else // raw HxWxC pixels, BGR order
+	{
+	  if (seg._shape.size() < 2 || seg._shape.size() > 3)
+	    throw InputConnectorBadParamException("shared memory image shape must be HxW or HxWxC");
+	  int channels = seg._shape.size() == 3 ? seg._shape.at(2) : 1;
+	  if (channels != 1 && channels != 3)
+	    throw InputConnectorBadParamException("shared memory image must have 1 or 3 channels");
+	  bool f32 = seg._dtype == "float32";
+	  cv::Mat raw(seg._shape.at(0),seg._shape.at(1),f32 ? CV_32FC(channels) : CV_8UC(channels),const_cast<char*>(seg.data()));
+	  if (f32)
+	    raw.convertTo(img,CV_8UC(channels)); // pixel values in [0,255]
+	  else img = raw;
+	  if (_bw && channels == 3)
+	    {
+	      cv::Mat gimg;
+	      cv::cvtColor(img,gimg,CV_BGR2GRAY);
+	      img = gimg;
+	    }
+	  else if (!_bw && channels == 1)
+	    {
+	      cv::Mat cimg;
+	      cv::cvtColor(img,cimg,CV_GRAY2BGR);
+	      img = cimg;
+	    }
+	}
+      if (img.empty())
+	return -1;
+      if (!_resize && img.data == reinterpret_cast<const uchar*>(seg.data()))
+	img = img.clone(); // the segment is unmapped after reading
+      add_image(img); // resizing copies out of the segment
+      return 0;
+    }
+
+    // decoded image handed over by another service
+    int read_mem_uri(const std::string &uri)
+    {
+      cv::Mat img;
+      if (!MemImages::get(uri,img))
+	throw InputConnectorBadParamException("no in-memory image " + uri);
+      if (img.empty())
+	return -1;
+      if (_bw && img.channels() == 3)
+	{
+	  cv::Mat gimg;
+	  cv::cvtColor(img,gimg,CV_BGR2GRAY);
+	  img = gimg;
+	}
+      else if (!_bw && img.channels() == 1)
+	{
+	  cv::Mat cimg;
+	  cv::cvtColor(img,cimg,CV_GRAY2BGR);
+	  img = cimg;
+	}
+      add_image(img);
+      return 0;
+    }
+
     int read_dir(const std::string &dir)
     {
       // list directories in dir
@@ -209,6 +564,14 @@ namespace dd
     std::vector<int> _labels;
     int _width = 227;
     int _height = 227;
+    bool _resize = true; /**< whether to resize images to the input size. */
+    bool _video = false; /**< whether to read files as videos, e.g. pipes, regardless of their extension. */
+    int _video_stride = 1; /**< samples one video frame every stride frames. */
+    double _video_fps = 0.0; /**< samples video frames at this rate instead, if positive. */
+    int _video_max_frames = 300; /**< maximum number of sampled frames per video, bounds memory on long videos and streams. */
+    int _tile_size = 0; /**< side of the windows larger images are tiled into, 0 for no tiling. */
+    double _tile_overlap = 0.2; /**< overlap of neighbouring windows, as a fraction of their side. */
+    std::vector<std::string> _tiles; /**< window of each image, empty if not tiled. */
     std::string _db_fname;
   };
   
@@ -218,7 +581,7 @@ namespace dd
   ImgInputFileConn()
     :InputConnectorStrategy(){}
     ImgInputFileConn(const ImgInputFileConn &i)
-      :InputConnectorStrategy(i),_width(i._width),_height(i._height),_bw(i._bw),_mean(i._mean),_has_mean_scalar(i._has_mean_scalar) {}
+      :InputConnectorStrategy(i),_width(i._width),_height(i._height),_bw(i._bw),_video(i._video),_video_stride(i._video_stride),_video_fps(i._video_fps),_video_max_frames(i._video_max_frames),_tile_size(i._tile_size),_tile_overlap(i._tile_overlap),_mean(i._mean),_has_mean_scalar(i._has_mean_scalar) {}
     ~ImgInputFileConn() {}
 
     void init(const APIData &ad)
@@ -235,6 +598,30 @@ namespace dd
 	_height = ad.get("height").get<int>();
       if (ad.has("bw"))
 	_bw = ad.get("bw").get<bool>();
+      if (ad.has("video"))
+	_video = ad.get("video").get<bool>();
+      if (ad.has("video_stride"))
+	{
+	  _video_stride = ad.get("video_stride").get<int>();
+	  if (_video_stride < 1)
+	    throw InputConnectorBadParamException("video_stride must be positive");
+	}
+      if (ad.has("video_fps"))
+	_video_fps = ad.get("video_fps").get<double>();
+      if (ad.has("video_max_frames"))
+	{
+	  _video_max_frames = ad.get("video_max_frames").get<int>();
+	  if (_video_max_frames <= 0)
+	    throw InputConnectorBadParamException("video_max_frames must be positive");
+	}
+      if (ad.has("tile_size"))
+	_tile_size = ad.get("tile_size").get<int>();
+      if (ad.has("tile_overlap"))
+	{
+	  _tile_overlap = ad.get("tile_overlap").get<double>();
+	  if (_tile_overlap < 0.0 || _tile_overlap >= 1.0)
+	    throw InputConnectorBadParamException("tile_overlap must be within [0,1[");
+	}
       if (ad.has("shuffle"))
 	_shuffle = ad.get("shuffle").get<bool>();
       if (ad.has("seed"))
@@ -289,6 +676,7 @@ namespace dd
 	      fillup_parameters(ad_param.getobj("input"));
 	    }
 	}
+      bool mem_uris = ad.has("mem_uris") && ad.get("mem_uris").get<bool>();
       int catch_read = 0;
       std::string catch_msg;
       std::vector<std::string> uris;
@@ -298,9 +686,16 @@ namespace dd
 	  bool no_img = false;
 	  std::string u = _uris.at(i);
 	  DataEl<DDImg> dimg;
+	  dimg._mem_uris = mem_uris;
 	  dimg._ctype._bw = _bw;
 	  dimg._ctype._width = _width;
 	  dimg._ctype._height = _height;
+	  dimg._ctype._video = _video;
+	  dimg._ctype._video_stride = _video_stride;
+	  dimg._ctype._video_fps = _video_fps;
+	  dimg._ctype._video_max_frames = _video_max_frames;
+	  dimg._ctype._tile_size = _tile_size;
+	  dimg._ctype._tile_overlap = _tile_overlap;
 	  try
 	    {
 	      if (dimg.read_element(u))
@@ -337,13 +732,14 @@ namespace dd
 	      _test_labels.insert(_test_labels.end(),
 	      std::make_move_iterator(dimg._ctype._labels.begin()),
 	      std::make_move_iterator(dimg._ctype._labels.end()));
-	    if (!dimg._ctype._b64 && dimg._ctype._imgs.size() == 1)
-	      uris.push_back(u);
-	    else if (!dimg._ctype._img_files.empty())
-	      uris.insert(uris.end(),
-	      std::make_move_iterator(dimg._ctype._img_files.begin()),
-	      std::make_move_iterator(dimg._ctype._img_files.end()));
-	    else uris.push_back(std::to_string(i));
+	    std::vector<std::string> ids = dimg._ctype._img_files;
+	    if (ids.empty())
+	      ids.assign(dimg._ctype._imgs.size(),dimg._ctype._b64 ? std::to_string(i) : u);
+	    for (size_t k=0;k<ids.size() && k<dimg._ctype._tiles.size();k++)
+	      ids.at(k) += dimg._ctype._tiles.at(k);
+	    uris.insert(uris.end(),
+	      std::make_move_iterator(ids.begin()),
+	      std::make_move_iterator(ids.end()));
 	  }
 	}
       if (catch_read)
@@ -399,6 +795,12 @@ namespace dd
     int _width = 227;
     int _height = 227;
     bool _bw = false; /**< whether to convert to black & white. */
+    bool _video = false; /**< whether to read files as videos, e.g. pipes. */
+    int _video_stride = 1; /**< samples one video frame every stride frames. */
+    double _video_fps = 0.0; /**< samples video frames at this rate instead, if positive. */
+    int _video_max_frames = 300; /**< maximum number of sampled frames per video, bounds memory on long videos and streams. */
+    int _tile_size = 0; /**< side of the windows larger images are tiled into, 0 for no tiling. */
+    double _tile_overlap = 0.2; /**< overlap of neighbouring windows, as a fraction of their side. */
     double _test_split = 0.0; /**< auto-split of the dataset. */
     bool _shuffle = false; /**< whether to shuffle the dataset, usually before splitting. */
     int _seed = -1; /**< shuffling seed. */
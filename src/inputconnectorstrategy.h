@@ -25,11 +25,40 @@
 #include "apidata.h"
 #include "utils/fileops.hpp"
 #include "utils/httpclient.hpp"
+#include "utils/shmseg.hpp"
 #include <exception>
 
 namespace dd
 {
 
+  /**
+   * \brief bad parameter exception
+   */
+  class InputConnectorBadParamException : public std::exception
+  {
+  public:
+    InputConnectorBadParamException(const std::string &s)
+      :_s(s) {}
+    ~InputConnectorBadParamException() {}
+    const char* what() const noexcept { return _s.c_str(); }
+  private:
+    std::string _s;
+  };
+
+  /**
+   * \brief internal error exception
+   */
+  class InputConnectorInternalException : public std::exception
+  {
+  public:
+    InputConnectorInternalException(const std::string &s)
+      :_s(s) {}
+    ~InputConnectorInternalException() {}
+    const char* what() const noexcept { return _s.c_str(); }
+  private:
+    std::string _s;
+  };
+  
   /**
    * \brief fetched data element
    * Note: functions read_mem and read_file must be defined in template type DDT
@@ -43,7 +72,18 @@ namespace dd
     int read_element(const std::string &uri)
     {
       bool dir = false;
-      if (uri.find("https://") != std::string::npos
+      if (ShmSegment::is_shm(uri))
+	{
+	  ShmSegment seg(uri);
+	  return read_shm(_ctype,seg,0);
+	}
+      else if (uri.compare(0,6,"mem://") == 0)
+	{
+	  if (!_mem_uris)
+	    throw InputConnectorBadParamException("in-memory elements are only handed over from one service to the next: " + uri);
+	  return read_mem_uri(_ctype,uri,0);
+	}
+      else if (uri.find("https://") != std::string::npos
 	  || uri.find("http://") != std::string::npos
 	  || uri.find("file://") != std::string::npos)
 	{
@@ -74,34 +114,44 @@ namespace dd
     
     std::string _content;
     DDT _ctype;
-  };
-  
-  /**
-   * \brief bad parameter exception
-   */
-  class InputConnectorBadParamException : public std::exception
-  {
-  public:
-    InputConnectorBadParamException(const std::string &s)
-      :_s(s) {}
-    ~InputConnectorBadParamException() {}
-    const char* what() const noexcept { return _s.c_str(); }
-  private:
-    std::string _s;
-  };
+    bool _mem_uris = false; /**< whether mem:// URIs are read, on calls from other services only. */
 
-  /**
-   * \brief internal error exception
-   */
-  class InputConnectorInternalException : public std::exception
-  {
-  public:
-    InputConnectorInternalException(const std::string &s)
-      :_s(s) {}
-    ~InputConnectorInternalException() {}
-    const char* what() const noexcept { return _s.c_str(); }
   private:
-    std::string _s;
+    /**
+     * \brief reads from shared memory in place, for types that support it
+     */
+    template <class T>
+      auto read_shm(T &ctype, const ShmSegment &seg, int) -> decltype(ctype.read_shm(seg))
+      {
+	return ctype.read_shm(seg);
+      }
+
+    /**
+     * \brief reads from a copy of the shared memory region otherwise
+     */
+    template <class T>
+      int read_shm(T &ctype, const ShmSegment &seg, long)
+      {
+	if (!seg._shape.empty())
+	  throw InputConnectorBadParamException("raw tensors in shared memory are not supported by this input connector");
+	return ctype.read_mem(std::string(seg.data(),seg.size()));
+      }
+
+    /**
+     * \brief reads an element handed over in memory by another service
+     */
+    template <class T>
+      auto read_mem_uri(T &ctype, const std::string &uri, int) -> decltype(ctype.read_mem_uri(uri))
+      {
+	return ctype.read_mem_uri(uri);
+      }
+
+    template <class T>
+      int read_mem_uri(T &ctype, const std::string &uri, long)
+      {
+	(void)ctype;
+	throw InputConnectorBadParamException("in-memory elements are not supported by this input connector: " + uri);
+      }
   };
   
   /**
@@ -0,0 +1,167 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jobscheduler.h"
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <thread>
+
+DEFINE_int32(train_cores,0,"number of cores shared by all training jobs (0: all cores)");
+DEFINE_int32(train_memory,0,"memory shared by all training jobs, in MB (0: unlimited)");
+
+namespace dd
+{
+  JobScheduler::JobScheduler(const int &cores,
+			     const long int &memory)
+    :_cores(cores),_memory(memory)
+  {
+    if (_cores <= 0)
+      _cores = std::max(1u,std::thread::hardware_concurrency());
+    if (_memory < 0)
+      _memory = 0;
+  }
+
+  JobScheduler& JobScheduler::get()
+  {
+    static JobScheduler js(FLAGS_train_cores,FLAGS_train_memory);
+    return js;
+  }
+
+  std::shared_ptr<JobTicket> JobScheduler::submit(const std::string &service,
+						  const int &priority,
+						  const int &cores,
+						  const long int &memory)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    int jcores = cores <= 0 ? _cores : std::min(cores,_cores);
+    long int jmemory = std::max(0l,memory);
+    if (_memory > 0)
+      jmemory = std::min(jmemory,_memory);
+    std::shared_ptr<JobTicket> ticket(new JobTicket(++_counter,service,priority,jcores,jmemory));
+
+    // ordered by priority, then submission
+    auto qit = _queue.begin();
+    while(qit!=_queue.end() && (*qit)->_priority >= priority)
+      ++qit;
+    _queue.insert(qit,ticket);
+    LOG(INFO) << "training job queued for service " << service << " / cores=" << jcores << " / memory=" << jmemory << " / priority=" << priority << std::endl;
+    return ticket;
+  }
+
+  bool JobScheduler::acquire(const std::shared_ptr<JobTicket> &ticket)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    schedule();
+    _cv.wait(lock,[&ticket]{ return ticket->_state.load() == 1 || ticket->_cancelled; });
+    return ticket->_state.load() == 1;
+  }
+
+  void JobScheduler::release(const std::shared_ptr<JobTicket> &ticket)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (ticket->_state.load() != 1)
+      return;
+    _used_cores -= ticket->_cores;
+    _used_memory -= ticket->_memory;
+    auto hit = _service_running.find(ticket->_service);
+    if (hit!=_service_running.end() && --(*hit).second == 0)
+      _service_running.erase(hit);
+    ticket->_state.store(2);
+    schedule();
+  }
+
+  bool JobScheduler::cancel(const std::shared_ptr<JobTicket> &ticket)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto qit = std::find(_queue.begin(),_queue.end(),ticket);
+    if (qit == _queue.end())
+      return false;
+    _queue.erase(qit);
+    ticket->_cancelled = true;
+    ticket->_state.store(2);
+    schedule();
+    _cv.notify_all();
+    return true;
+  }
+
+  int JobScheduler::queue_position(const std::shared_ptr<JobTicket> &ticket)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto qit = std::find(_queue.begin(),_queue.end(),ticket);
+    if (qit == _queue.end())
+      return 0;
+    return std::distance(_queue.begin(),qit) + 1;
+  }
+
+  double JobScheduler::wait_time(const std::shared_ptr<JobTicket> &ticket)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::chrono::steady_clock::time_point tstop = ticket->_state.load() == 0 ? std::chrono::steady_clock::now() : ticket->_tstart;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(tstop-ticket->_tsubmit).count() / 1000.0;
+  }
+
+  void JobScheduler::info(APIData &out)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    APIData ad;
+    ad.add("cores",_cores);
+    ad.add("used_cores",_used_cores);
+    ad.add("memory",static_cast<double>(_memory));
+    ad.add("used_memory",static_cast<double>(_used_memory));
+    ad.add("queued",static_cast<int>(_queue.size()));
+    out.add("train_scheduler",ad);
+  }
+
+  void JobScheduler::schedule()
+  {
+    bool admitted = false;
+    auto qit = _queue.begin();
+    while(qit!=_queue.end())
+      {
+	std::shared_ptr<JobTicket> ticket = (*qit);
+	if (ticket->_cancelled)
+	  {
+	    qit = _queue.erase(qit);
+	    continue;
+	  }
+	// a service runs one job at a time, its next jobs leave room to other services
+	if (_service_running.find(ticket->_service)!=_service_running.end())
+	  {
+	    ++qit;
+	    continue;
+	  }
+	if (_used_cores + ticket->_cores > _cores
+	    || (_memory > 0 && _used_memory + ticket->_memory > _memory))
+	  break; // first job that does not fit blocks the others, so that large jobs are not starved
+	_used_cores += ticket->_cores;
+	_used_memory += ticket->_memory;
+	++_service_running[ticket->_service];
+	ticket->_tstart = std::chrono::steady_clock::now();
+	ticket->_state.store(1);
+	qit = _queue.erase(qit);
+	admitted = true;
+	LOG(INFO) << "training job admitted for service " << ticket->_service << " / cores=" << ticket->_cores << " / waited " << std::chrono::duration_cast<std::chrono::seconds>(ticket->_tstart-ticket->_tsubmit).count() << "s" << std::endl;
+      }
+    if (admitted)
+      _cv.notify_all();
+  }
+}
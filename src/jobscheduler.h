@@ -0,0 +1,150 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include "apidata.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace dd
+{
+  /**
+   * \brief training job resource request and scheduling state
+   */
+  class JobTicket
+  {
+  public:
+    JobTicket(const int &id,
+	      const std::string &service,
+	      const int &priority,
+	      const int &cores,
+	      const long int &memory)
+      :_id(id),_service(service),_priority(priority),_cores(cores),_memory(memory),
+      _tsubmit(std::chrono::steady_clock::now()) {}
+    ~JobTicket() {}
+
+    int _id = 0; /**< submission order. */
+    std::string _service; /**< service the job belongs to. */
+    int _priority = 0; /**< higher priority jobs are scheduled first. */
+    int _cores = 0; /**< number of cores granted to the job. */
+    long int _memory = 0; /**< memory granted to the job, in MB, 0 if unknown. */
+    std::chrono::steady_clock::time_point _tsubmit; /**< date at which the job was queued. */
+    std::chrono::steady_clock::time_point _tstart; /**< date at which the job was admitted. */
+    std::atomic<int> _state = {0}; /**< 0: queued, 1: running, 2: finished or cancelled */
+    bool _cancelled = false;
+  };
+
+  /**
+   * \brief process-wide scheduler of training jobs: jobs wait in a queue until their
+   *        cores and memory fit in the global budget. Queued jobs are ordered by priority,
+   *        then submission order, and a service runs a single job at a time so that
+   *        no service can grab the whole budget.
+   */
+  class JobScheduler
+  {
+  public:
+    /**
+     * \brief constructor
+     * @param cores total number of cores for training jobs
+     * @param memory total memory for training jobs, in MB, 0 for unlimited
+     */
+    JobScheduler(const int &cores,
+		 const long int &memory);
+    ~JobScheduler() {}
+
+    /**
+     * \brief process-wide scheduler, with budget from the command line
+     */
+    static JobScheduler& get();
+
+    /**
+     * \brief queues a job
+     * @param service service name
+     * @param priority job priority
+     * @param cores requested number of cores, 0 for the whole budget
+     * @param memory requested memory in MB, 0 if unknown
+     * @return job ticket
+     */
+    std::shared_ptr<JobTicket> submit(const std::string &service,
+				      const int &priority,
+				      const int &cores,
+				      const long int &memory);
+
+    /**
+     * \brief blocks until the job is admitted
+     * @return true if the job can run, false if it was cancelled while queued
+     */
+    bool acquire(const std::shared_ptr<JobTicket> &ticket);
+
+    /**
+     * \brief gives the job resources back, once the job is over
+     */
+    void release(const std::shared_ptr<JobTicket> &ticket);
+
+    /**
+     * \brief cancels a queued job, no effect on running jobs
+     * @return true if the job was removed from the queue, false if it was already admitted or over
+     */
+    bool cancel(const std::shared_ptr<JobTicket> &ticket);
+
+    /**
+     * \brief position of a queued job, starting at 1, 0 if not queued
+     */
+    int queue_position(const std::shared_ptr<JobTicket> &ticket);
+
+    /**
+     * \brief time spent by a job in the queue, in seconds
+     */
+    double wait_time(const std::shared_ptr<JobTicket> &ticket);
+
+    /**
+     * \brief budget and usage
+     * @param out output data object
+     */
+    void info(APIData &out);
+
+  private:
+    /**
+     * \brief admits queued jobs that fit in the budget, lock must be held
+     */
+    void schedule();
+
+    int _cores = 1; /**< cores budget. */
+    long int _memory = 0; /**< memory budget in MB, 0 for unlimited. */
+    int _used_cores = 0;
+    long int _used_memory = 0;
+    int _counter = 0; /**< submitted jobs counter. */
+    std::list<std::shared_ptr<JobTicket>> _queue; /**< queued jobs, in scheduling order. */
+    std::unordered_map<std::string,int> _service_running; /**< running jobs, per service. */
+    std::mutex _mutex;
+    std::condition_variable _cv;
+  };
+}
+
+#endif
@@ -22,11 +22,15 @@
 #include "jsonapi.h"
 #include "dd_config.h"
 #include "githash.h"
+#include "jobscheduler.h"
 #include "ext/rapidjson/document.h"
 #include "ext/rapidjson/stringbuffer.h"
 #include "ext/rapidjson/reader.h"
 #include "ext/rapidjson/writer.h"
 #include <glog/logging.h>
+#include <algorithm>
+#include <cstring>
+#include <thread>
 
 namespace dd
 {
@@ -113,6 +117,14 @@ namespace dd
     return jd;
   }
 
+  JDoc JsonAPI::dd_payload_too_large_413() const
+  {
+    JDoc jd;
+    jd.SetObject();
+    render_status(jd,413,"PayloadTooLarge");
+    return jd;
+  }
+
   JDoc JsonAPI::dd_internal_error_500() const
   {
     JDoc jd;
@@ -120,6 +132,14 @@ namespace dd
     render_status(jd,500,"InternalError");
     return jd;
   }
+
+  JDoc JsonAPI::dd_service_unavailable_503() const
+  {
+    JDoc jd;
+    jd.SetObject();
+    render_status(jd,503,"ServiceUnavailable");
+    return jd;
+  }
   
   JDoc JsonAPI::dd_unknown_library_1000() const
   {
@@ -217,6 +237,207 @@ namespace dd
     return buffer.GetString();
   }
 
+  /**
+   * \brief JSON writer with a bounded number of significant digits for doubles
+   */
+  class PrecisionWriter : public rapidjson::Writer<rapidjson::StringBuffer>
+  {
+  public:
+    PrecisionWriter(rapidjson::StringBuffer &buffer, const int &precision)
+      :rapidjson::Writer<rapidjson::StringBuffer>(buffer),_precision(precision) {}
+
+    bool Double(double d)
+    {
+      Prefix(rapidjson::kNumberType);
+      char buf[32];
+      int n = snprintf(buf,sizeof(buf),"%.*g",_precision,d);
+      for (int i=0;i<n;i++)
+	os_->Put(buf[i]);
+      return true;
+    }
+
+  private:
+    int _precision = 6;
+  };
+
+  // members of a predict answer that drive the rendering, not rendered themselves
+  static bool is_render_control(const JVal &name)
+  {
+    return strcmp(name.GetString(),"format") == 0 || strcmp(name.GetString(),"float_precision") == 0;
+  }
+
+  static void append_float32_le(const double &d, std::string &blob)
+  {
+    float f = static_cast<float>(d);
+    uint32_t bits;
+    memcpy(&bits,&f,sizeof(bits));
+    char le[4] = { static_cast<char>(bits & 0xff), static_cast<char>((bits >> 8) & 0xff),
+		   static_cast<char>((bits >> 16) & 0xff), static_cast<char>((bits >> 24) & 0xff) };
+    blob.append(le,4);
+  }
+
+  // classes with a probability and a category, packed as probs and cats in binary
+  static bool is_prob_classes(const JVal &jval)
+  {
+    if (!jval.IsArray() || jval.Size() == 0)
+      return false;
+    for (rapidjson::SizeType i=0;i<jval.Size();i++)
+      if (!jval[i].IsObject() || !jval[i].HasMember("prob") || !jval[i]["prob"].IsNumber()
+	  || !jval[i].HasMember("cat") || !jval[i]["cat"].IsString())
+	return false;
+    return true;
+  }
+
+  static bool is_class_packed(const JVal &name)
+  {
+    return strcmp(name.GetString(),"prob") == 0 || strcmp(name.GetString(),"cat") == 0
+      || strcmp(name.GetString(),"last") == 0;
+  }
+
+  static void write_binary(const JVal &jval,
+			   rapidjson::Writer<rapidjson::StringBuffer> &writer,
+			   std::string &blob);
+
+  static void write_binary_classes(const JVal &jclasses,
+				   rapidjson::Writer<rapidjson::StringBuffer> &writer,
+				   std::string &blob)
+  {
+    writer.String("probs");
+    writer.StartObject();
+    writer.String("offset");
+    writer.Uint64(blob.size()/4);
+    writer.String("length");
+    writer.Uint(jclasses.Size());
+    writer.EndObject();
+    blob.reserve(blob.size()+4*jclasses.Size());
+    for (rapidjson::SizeType i=0;i<jclasses.Size();i++)
+      append_float32_le(jclasses[i]["prob"].GetDouble(),blob);
+    writer.String("cats");
+    writer.StartArray();
+    for (rapidjson::SizeType i=0;i<jclasses.Size();i++)
+      writer.String(jclasses[i]["cat"].GetString(),jclasses[i]["cat"].GetStringLength());
+    writer.EndArray();
+
+    // other members of the classes, e.g. bbox, stay in classes, in the same order
+    bool others = false;
+    for (rapidjson::SizeType i=0;i<jclasses.Size() && !others;i++)
+      for (auto m=jclasses[i].MemberBegin();m!=jclasses[i].MemberEnd();++m)
+	if (!is_class_packed(m->name))
+	  {
+	    others = true;
+	    break;
+	  }
+    if (!others)
+      return;
+    writer.String("classes");
+    writer.StartArray();
+    for (rapidjson::SizeType i=0;i<jclasses.Size();i++)
+      {
+	writer.StartObject();
+	for (auto m=jclasses[i].MemberBegin();m!=jclasses[i].MemberEnd();++m)
+	  {
+	    if (is_class_packed(m->name))
+	      continue;
+	    writer.String(m->name.GetString(),m->name.GetStringLength());
+	    write_binary(m->value,writer,blob);
+	  }
+	writer.EndObject();
+      }
+    writer.EndArray();
+  }
+
+  static void write_binary(const JVal &jval,
+			   rapidjson::Writer<rapidjson::StringBuffer> &writer,
+			   std::string &blob)
+  {
+    if (jval.IsArray() && jval.Size() > 0)
+      {
+	bool numbers = true;
+	for (rapidjson::SizeType i=0;i<jval.Size();i++)
+	  if (!jval[i].IsNumber())
+	    {
+	      numbers = false;
+	      break;
+	    }
+	if (numbers)
+	  {
+	    writer.StartObject();
+	    writer.String("offset");
+	    writer.Uint64(blob.size()/4);
+	    writer.String("length");
+	    writer.Uint(jval.Size());
+	    writer.EndObject();
+	    blob.reserve(blob.size()+4*jval.Size());
+	    for (rapidjson::SizeType i=0;i<jval.Size();i++)
+	      append_float32_le(jval[i].GetDouble(),blob);
+	    return;
+	  }
+	writer.StartArray();
+	for (rapidjson::SizeType i=0;i<jval.Size();i++)
+	  write_binary(jval[i],writer,blob);
+	writer.EndArray();
+      }
+    else if (jval.IsObject())
+      {
+	writer.StartObject();
+	for (auto m=jval.MemberBegin();m!=jval.MemberEnd();++m)
+	  {
+	    if (strcmp(m->name.GetString(),"classes") == 0 && is_prob_classes(m->value))
+	      {
+		write_binary_classes(m->value,writer,blob);
+		continue;
+	      }
+	    writer.String(m->name.GetString(),m->name.GetStringLength());
+	    write_binary(m->value,writer,blob);
+	  }
+	writer.EndObject();
+      }
+    else jval.Accept(writer);
+  }
+
+  std::string JsonAPI::jrender(const JDoc &jst, const int &float_precision) const
+  {
+    rapidjson::StringBuffer buffer;
+    PrecisionWriter writer(buffer,std::max(1,std::min(17,float_precision)));
+    writer.StartObject();
+    for (auto m=jst.MemberBegin();m!=jst.MemberEnd();++m)
+      {
+	if (is_render_control(m->name))
+	  continue;
+	writer.String(m->name.GetString(),m->name.GetStringLength());
+	m->value.Accept(writer);
+      }
+    writer.EndObject();
+    return buffer.GetString();
+  }
+
+  std::string JsonAPI::jrender_binary(const JDoc &jst) const
+  {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    std::string blob;
+    writer.StartObject();
+    for (auto m=jst.MemberBegin();m!=jst.MemberEnd();++m)
+      {
+	if (is_render_control(m->name))
+	  continue;
+	writer.String(m->name.GetString(),m->name.GetStringLength());
+	write_binary(m->value,writer,blob);
+      }
+    writer.EndObject();
+    std::string header = buffer.GetString();
+    uint32_t hsize = header.size();
+    std::string out = "DDB1";
+    char le[4] = { static_cast<char>(hsize & 0xff), static_cast<char>((hsize >> 8) & 0xff),
+		   static_cast<char>((hsize >> 16) & 0xff), static_cast<char>((hsize >> 24) & 0xff) };
+    out.reserve(8+hsize+3+blob.size());
+    out.append(le,4);
+    out += header;
+    out.append((4 - out.size() % 4) % 4,' ');
+    out += blob;
+    return out;
+  }
+
   JDoc JsonAPI::info() const
   {
     // answer info call.
@@ -238,6 +459,11 @@ namespace dd
 	++hit;
       }
     jhead.AddMember("services",jservs,jinfo.GetAllocator());
+    APIData ad_sched;
+    JobScheduler::get().info(ad_sched);
+    JVal jsched(rapidjson::kObjectType);
+    ad_sched.getobj("train_scheduler").toJVal(jinfo,jsched);
+    jhead.AddMember("train_scheduler",jsched,jinfo.GetAllocator());
     jinfo.AddMember("head",jhead,jinfo.GetAllocator());
     return jinfo;
   }
@@ -411,6 +637,7 @@ namespace dd
       {
 	return dd_internal_mllib_error_1007(e.what());
       }
+    record_service(sname,jstr);
     JDoc jsc = dd_created_201();
     return jsc;
   }
@@ -466,7 +693,10 @@ namespace dd
     try
       {
 	if (remove_service(sname,ad))
-	  return dd_ok_200();
+	  {
+	    forget_service(sname);
+	    return dd_ok_200();
+	  }
       }
     catch (MLLibInternalException &e)
       {
@@ -518,7 +748,44 @@ namespace dd
       {
 	return dd_bad_request_400();
       }
+
+    // in-memory images are only handed over internally, from one service to the next
+    if (ad_data.has("mem_uris"))
+      return dd_bad_request_400();
+    if (d.HasMember("data") && d["data"].IsArray())
+      for (rapidjson::SizeType i=0;i<d["data"].Size();i++)
+	if (d["data"][i].IsString() && std::string(d["data"][i].GetString()).compare(0,6,"mem://") == 0)
+	  {
+	    LOG(ERROR) << "in-memory data URI from client: " << d["data"][i].GetString() << std::endl;
+	    return dd_bad_request_400();
+	  }
+
+    // chain of services, and other services predicting from the same data
+    for (const char *key: { "chain", "fanout" })
+      {
+	if (!d.HasMember(key))
+	  continue;
+	if (!d[key].IsArray())
+	  return dd_bad_request_400();
+	for (rapidjson::SizeType i=0;i<d[key].Size();i++)
+	  {
+	    if (!d[key][i].IsObject() || !d[key][i].HasMember("service")
+		|| !d[key][i]["service"].IsString())
+	      return dd_bad_request_400();
+	    std::string csname = d[key][i]["service"].GetString();
+	    std::transform(csname.begin(),csname.end(),csname.begin(),::tolower);
+	    if (!this->service_exists(csname))
+	      return dd_service_not_found_1002();
+	  }
+      }
     
+    // rendering
+    APIData ad_output = ad_data.getobj("parameters").getobj("output");
+    if (ad_output.has("format")
+	&& ad_output.get("format").get<std::string>() != "json"
+	&& ad_output.get("format").get<std::string>() != "binary")
+      return dd_bad_request_400();
+
     // prediction
     APIData out;
     try
@@ -567,6 +834,8 @@ namespace dd
     JVal jbody(rapidjson::kObjectType);
     if (jout.HasMember("predictions"))
       jbody.AddMember("predictions",jout["predictions"],jpred.GetAllocator());
+    if (jout.HasMember("profile"))
+      jbody.AddMember("profile",jout["profile"],jpred.GetAllocator());
     jpred.AddMember("body",jbody,jpred.GetAllocator());
     if (ad_data.getobj("parameters").getobj("output").has("template"))
       {
@@ -574,6 +843,10 @@ namespace dd
 	APIData ad_output = ad_params.getobj("output");
 	jpred.AddMember("template",JVal().SetString(ad_output.get("template").get<std::string>().c_str(),jpred.GetAllocator()),jpred.GetAllocator());
       }
+    if (ad_output.has("format") && ad_output.get("format").get<std::string>() == "binary")
+      jpred.AddMember("format","binary",jpred.GetAllocator());
+    if (ad_output.has("float_precision"))
+      jpred.AddMember("float_precision",ad_output.get("float_precision").get<int>(),jpred.GetAllocator());
     if (ad_data.getobj("parameters").getobj("output").has("network"))
       {
 	APIData ad_params = ad_data.getobj("parameters");
@@ -863,6 +1136,97 @@ namespace dd
     return jd;
   }
   
+  JDoc JsonAPI::health() const
+  {
+    bool ready = !_restoring.load();
+    JDoc jh = ready ? dd_ok_200() : dd_service_unavailable_503();
+    JVal jhead(rapidjson::kObjectType);
+    jhead.AddMember("method","/health",jh.GetAllocator());
+    jh.AddMember("head",jhead,jh.GetAllocator());
+    JVal jbody(rapidjson::kObjectType);
+    jbody.AddMember("ready",ready,jh.GetAllocator());
+    jbody.AddMember("restored",_restored.load(),jh.GetAllocator());
+    jbody.AddMember("total",_restore_total.load(),jh.GetAllocator());
+    JVal jfailed(rapidjson::kArrayType);
+    {
+      std::lock_guard<std::mutex> lock(_restore_mtx);
+      for (const std::string &f: _restore_failed)
+	jfailed.PushBack(JVal().SetString(f.c_str(),jh.GetAllocator()),jh.GetAllocator());
+    }
+    jbody.AddMember("failed",jfailed,jh.GetAllocator());
+    jh.AddMember("body",jbody,jh.GetAllocator());
+    return jh;
+  }
+
+  void JsonAPI::restore_services(const int &concurrency, const bool &warmup)
+  {
+    std::vector<std::pair<std::string,std::string>> entries;
+    if (read_manifest(entries))
+      {
+	LOG(INFO) << "no service manifest to restore from at " << _manifest_fname << std::endl;
+	_restoring = false;
+	return;
+      }
+    _restore_total = entries.size();
+    LOG(INFO) << "restoring " << entries.size() << " services from " << _manifest_fname << std::endl;
+    std::chrono::time_point<std::chrono::system_clock> tstart = std::chrono::system_clock::now();
+    std::atomic<size_t> next(0);
+    auto restore = [&]()
+      {
+	size_t i;
+	while((i = next++) < entries.size())
+	  {
+	    const std::string &sname = entries.at(i).first;
+	    JDoc jc = service_create(sname,entries.at(i).second);
+	    int code = jc["status"]["code"].GetInt();
+	    if (code != 201)
+	      {
+		LOG(ERROR) << "failed restoring service " << sname << ", code=" << code << std::endl;
+		std::lock_guard<std::mutex> lock(_restore_mtx);
+		_restore_failed.push_back(sname);
+	      }
+	    else if (warmup)
+	      {
+		// a single benchmark pass loads the net and allocates its memory
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+		writer.StartObject();
+		writer.Key("service");
+		writer.String(sname.c_str());
+		writer.Key("parameters");
+		writer.StartObject();
+		writer.Key("mllib");
+		writer.StartObject();
+		writer.Key("benchmark");
+		writer.StartObject();
+		writer.Key("batch_size");
+		writer.Int(1);
+		writer.Key("iterations");
+		writer.Int(1);
+		writer.EndObject();
+		writer.EndObject();
+		writer.EndObject();
+		writer.EndObject();
+		JDoc jw = service_predict(buffer.GetString());
+		if (jw["status"]["code"].GetInt() != 200)
+		  LOG(INFO) << "service " << sname << " could not be warmed up" << std::endl;
+	      }
+	    ++_restored;
+	  }
+      };
+    std::vector<std::thread> threads;
+    int nthreads = std::max(1,std::min(concurrency,static_cast<int>(entries.size())));
+    for (int t=1;t<nthreads;t++)
+      threads.push_back(std::thread(restore));
+    restore();
+    for (std::thread &t: threads)
+      t.join();
+    std::chrono::time_point<std::chrono::system_clock> tstop = std::chrono::system_clock::now();
+    LOG(INFO) << "restored " << entries.size() - _restore_failed.size() << "/" << entries.size() << " services in "
+	      << std::chrono::duration_cast<std::chrono::milliseconds>(tstop-tstart).count() << "ms" << std::endl;
+    _restoring = false;
+  }
+
   int JsonAPI::store_json_blob(const std::string &model_repo,
 			       const std::string &jstr)
   {
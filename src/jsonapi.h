@@ -24,6 +24,8 @@
 
 #include "apistrategy.h"
 #include "dd_types.h"
+#include <atomic>
+#include <mutex>
 
 namespace dd
 {
@@ -60,7 +62,9 @@ namespace dd
     JDoc dd_forbidden_403() const;
     JDoc dd_not_found_404() const;
     JDoc dd_conflict_409() const;
+    JDoc dd_payload_too_large_413() const;
     JDoc dd_internal_error_500() const;
+    JDoc dd_service_unavailable_503() const;
 
     // specific errors
     JDoc dd_unknown_library_1000() const;
@@ -78,6 +82,24 @@ namespace dd
     std::string jrender(const JDoc &jst) const;
     std::string jrender(const JVal &jval) const;
 
+    /**
+     * \brief renders with a bounded number of significant digits for floating point values
+     * @param jst JSON document
+     * @param float_precision number of significant digits
+     */
+    std::string jrender(const JDoc &jst, const int &float_precision) const;
+
+    /**
+     * \brief renders in binary: "DDB1" magic, little-endian uint32 size of the JSON header,
+     *        the JSON header, padding to 4 bytes, then little-endian float32 values.
+     *        In the header, every array of numbers is replaced by {"offset":o,"length":n},
+     *        o and n being in number of float32 values, and classes with a probability
+     *        and a category are replaced by such a "probs" buffer and a "cats" list, their
+     *        other members, e.g. bbox, remaining in "classes".
+     * @param jst JSON document
+     */
+    std::string jrender_binary(const JDoc &jst) const;
+
     // resources
     // return a JSON document for every API call
     JDoc info() const;
@@ -92,10 +114,28 @@ namespace dd
     JDoc service_train_status(const std::string &jstr);
     JDoc service_train_delete(const std::string &jstr);
 
+    /**
+     * \brief health call, ready once the services from the manifest are restored
+     */
+    JDoc health() const;
+
     static int store_json_blob(const std::string &model_repo,
 			       const std::string &jstr);
 
+    /**
+     * \brief re-creates the services from the manifest
+     * @param concurrency number of services created in parallel
+     * @param warmup whether to load and run the nets of the restored services once
+     */
+    void restore_services(const int &concurrency, const bool &warmup);
+
     static std::string _json_blob_fname;
+
+    std::atomic<bool> _restoring = {false}; /**< whether services are being restored. */
+    std::atomic<int> _restore_total = {0}; /**< number of services to restore. */
+    std::atomic<int> _restored = {0}; /**< number of services restore was attempted for. */
+    std::vector<std::string> _restore_failed; /**< services that could not be restored. */
+    mutable std::mutex _restore_mtx; /**< mutex around failed restores. */
   };
 
   /**
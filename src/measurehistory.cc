@@ -0,0 +1,115 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "measurehistory.h"
+#include <gflags/gflags.h>
+#include <algorithm>
+
+DEFINE_int32(measure_hist_recent,500,"number of most recent values of every training measure kept at full resolution");
+DEFINE_int32(measure_hist_archive,500,"number of downsampled older values of every training measure");
+
+namespace dd
+{
+  MeasureHistory::MeasureHistory(const int &recent,
+				 const int &archive)
+    :_recent_cap(std::max(1,recent)),_archive_cap(std::max(2,archive))
+  {
+    _recent.resize(_recent_cap);
+  }
+
+  MeasureHistory::MeasureHistory()
+    :MeasureHistory(FLAGS_measure_hist_recent,FLAGS_measure_hist_archive)
+  {
+  }
+
+  void MeasureHistory::add(const double &v)
+  {
+    long int seq = _count++;
+    if (_recent_size < _recent_cap)
+      {
+	_recent[(_recent_start+_recent_size)%_recent_cap] = v;
+	++_recent_size;
+	return;
+      }
+    // evicts the oldest value, whose sequence number is the oldest in the ring
+    archive(_recent[_recent_start],seq-_recent_cap);
+    _recent[_recent_start] = v;
+    _recent_start = (_recent_start+1)%_recent_cap;
+  }
+
+  void MeasureHistory::archive(const double &v, const long int &seq)
+  {
+    _pending_sum += v;
+    if (++_pending_count < _stride)
+      return;
+    _archive_vals.push_back(_pending_sum / _pending_count);
+    _archive_seqs.push_back(seq);
+    _pending_sum = 0.0;
+    _pending_count = 0;
+    if (_archive_vals.size() < _archive_cap)
+      return;
+
+    // archive is full, halves its resolution by averaging pairs
+    size_t n = _archive_vals.size() / 2;
+    for (size_t i=0;i<n;i++)
+      {
+	_archive_vals[i] = 0.5 * (_archive_vals[2*i] + _archive_vals[2*i+1]);
+	_archive_seqs[i] = _archive_seqs[2*i+1];
+      }
+    if (_archive_vals.size() % 2)
+      {
+	_archive_vals[n] = _archive_vals.back();
+	_archive_seqs[n] = _archive_seqs.back();
+	++n;
+      }
+    _archive_vals.resize(n);
+    _archive_seqs.resize(n);
+    _stride *= 2;
+  }
+
+  void MeasureHistory::get(const long int &since,
+			   std::vector<double> &vals,
+			   std::vector<long int> &seqs) const
+  {
+    vals.clear();
+    seqs.clear();
+    auto ait = std::upper_bound(_archive_seqs.begin(),_archive_seqs.end(),since);
+    for (size_t i=std::distance(_archive_seqs.begin(),ait);i<_archive_vals.size();i++)
+      {
+	vals.push_back(_archive_vals[i]);
+	seqs.push_back(_archive_seqs[i]);
+      }
+    long int first_recent = _count - _recent_size;
+    if (_pending_count > 0 && first_recent - 1 > since) // partial stride, not archived yet
+      {
+	vals.push_back(_pending_sum / _pending_count);
+	seqs.push_back(first_recent - 1);
+      }
+    for (size_t i=0;i<_recent_size;i++)
+      {
+	long int seq = first_recent + static_cast<long int>(i);
+	if (seq <= since)
+	  continue;
+	vals.push_back(_recent[(_recent_start+i)%_recent_cap]);
+	seqs.push_back(seq);
+      }
+  }
+}
@@ -0,0 +1,105 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEASUREHISTORY_H
+#define MEASUREHISTORY_H
+
+#include <cstddef>
+#include <vector>
+
+namespace dd
+{
+  /**
+   * \brief bounded history of a measure: the most recent values are kept as is in a
+   *        ring buffer, older values are averaged into an archive whose resolution
+   *        halves every time it fills up, so that memory stays constant while the
+   *        whole training curve remains available.
+   *        Every value gets a sequence number, that clients use as a cursor in order
+   *        to only fetch the values they have not seen yet.
+   */
+  class MeasureHistory
+  {
+  public:
+    /**
+     * \brief constructor
+     * @param recent number of most recent values kept at full resolution
+     * @param archive number of downsampled older values
+     */
+    MeasureHistory(const int &recent,
+		   const int &archive);
+
+    /**
+     * \brief constructor, with sizes from the command line
+     */
+    MeasureHistory();
+
+    ~MeasureHistory() {}
+
+    /**
+     * \brief adds a value
+     */
+    void add(const double &v);
+
+    /**
+     * \brief values, oldest first, each with the sequence number of the last value it
+     *        covers: downsampled values cover several consecutive values, so the first
+     *        one returned may also cover values up to since
+     * @param since sequence number of the last value already seen, -1 for all values
+     * @param vals values that cover values newer than since
+     * @param seqs sequence numbers of vals
+     */
+    void get(const long int &since,
+	     std::vector<double> &vals,
+	     std::vector<long int> &seqs) const;
+
+    /**
+     * \brief sequence number of the last added value, -1 if none
+     */
+    long int last() const { return _count - 1; }
+
+    /**
+     * \brief number of values currently held
+     */
+    size_t size() const { return _archive_vals.size() + _recent_size; }
+
+  private:
+    /**
+     * \brief pushes a value evicted from the ring buffer into the archive
+     */
+    void archive(const double &v, const long int &seq);
+
+    size_t _recent_cap = 0; /**< ring buffer capacity. */
+    std::vector<double> _recent; /**< ring buffer of the most recent values. */
+    size_t _recent_start = 0; /**< index of the oldest value in the ring buffer. */
+    size_t _recent_size = 0; /**< number of values in the ring buffer. */
+
+    size_t _archive_cap = 0; /**< archive capacity. */
+    std::vector<double> _archive_vals; /**< downsampled values. */
+    std::vector<long int> _archive_seqs; /**< sequence number of the last value of each downsampled value. */
+    long int _stride = 1; /**< number of original values per archived value. */
+    double _pending_sum = 0.0; /**< values waiting for a full stride before being archived. */
+    long int _pending_count = 0;
+
+    long int _count = 0; /**< number of values ever added. */
+  };
+}
+
+#endif
@@ -23,7 +23,9 @@
 #define MLLIBSTRATEGY_H
 
 #include "apidata.h"
+#include "measurehistory.h"
 #include "utils/fileops.hpp"
+#include <algorithm>
 #include <atomic>
 #include <exception>
 #include <mutex>
@@ -75,7 +77,7 @@ namespace dd
      * \brief copy-constructor
      */
     MLLib(MLLib &&mll) noexcept
-      :_inputc(mll._inputc),_outputc(mll._outputc),_mlmodel(mll._mlmodel),_meas(mll._meas),_tjob_running(mll._tjob_running.load())
+      :_inputc(mll._inputc),_outputc(mll._outputc),_mlmodel(mll._mlmodel),_meas(mll._meas),_tjob_running(mll._tjob_running.load()),_nthreads(mll._nthreads)
       {}
     
     /**
@@ -145,31 +147,37 @@ namespace dd
     void add_meas_per_iter(const std::string &meas, const double &l)
     {
       std::lock_guard<std::mutex> lock(_meas_per_iter_mutex);
-      auto hit = _meas_per_iter.find(meas);
-      if (hit!=_meas_per_iter.end())
-	(*hit).second.push_back(l);
-      else
-	{
-	  std::vector<double> vmeas = {l};
-	  _meas_per_iter.insert(std::pair<std::string,std::vector<double>>(meas,vmeas));
-	}
+      _meas_per_iter[meas].add(l);
     }
 
     /**
-     * \brief collect current measures history into a data object
-     * 
+     * \brief collect current measures history into a data object, along with
+     *        a cursor to pass back in order to only get the newer values.
+     *        Every <measure>_hist array comes with a <measure>_hist_seq array that
+     *        holds the sequence number of the last value each point covers, since
+     *        older points are averages over several values
+     * @param ad data object to hold the measures history
+     * @param since cursor from a previous call, -1 for the full history
      */
-    void collect_measures_history(APIData &ad)
+    void collect_measures_history(APIData &ad,
+				  const long int &since=-1)
     {
       APIData meas_hist;
+      long int cursor = -1;
       std::lock_guard<std::mutex> lock(_meas_per_iter_mutex);
       auto hit = _meas_per_iter.begin();
       while(hit!=_meas_per_iter.end())
 	{
-	  meas_hist.add((*hit).first+"_hist",(*hit).second);
+	  std::vector<double> vals;
+	  std::vector<long int> seqs;
+	  (*hit).second.get(since,vals,seqs);
+	  meas_hist.add((*hit).first+"_hist",vals);
+	  meas_hist.add((*hit).first+"_hist_seq",std::vector<int>(seqs.begin(),seqs.end()));
+	  cursor = std::max(cursor,(*hit).second.last());
 	  ++hit;
 	}
       ad.add("measure_hist",meas_hist);
+      ad.add("measure_hist_cursor",static_cast<int>(cursor));
     }
 
     /**
@@ -227,13 +235,15 @@ namespace dd
     std::string _libname; /**< ml lib name. */
     
     std::unordered_map<std::string,double> _meas; /**< model measures, used as a per service value. */
-    std::unordered_map<std::string,std::vector<double>> _meas_per_iter; /**< model measures per iteration. */
+    std::unordered_map<std::string,MeasureHistory> _meas_per_iter; /**< model measures per iteration, bounded. */
 
     std::atomic<bool> _tjob_running = {false}; /**< whether a training job is running with this lib instance. */
 
     bool _online = false; /**< whether the algorithm is online, i.e. it interleaves training and prediction calls.
 			     When not, prediction calls are rejected while training is running. */
 
+    int _nthreads = 0; /**< number of threads per call for this service, 0 for the global budget. */
+
   protected:
     std::mutex _meas_per_iter_mutex; /**< mutex over measures history. */
     std::mutex _meas_mutex; /** mutex around current measures. */
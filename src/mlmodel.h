@@ -64,7 +64,10 @@ namespace dd
       {
 	if (_hcorresp.empty())
 	  return std::to_string(i);
-	else return _hcorresp[i];
+	auto hit = _hcorresp.find(i); // no insertion, called concurrently by prediction workers
+	if (hit == _hcorresp.end())
+	  return std::string();
+	return (*hit).second;
       }
     
     std::string _repo; /**< model repository. */
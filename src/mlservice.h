@@ -24,6 +24,8 @@
 
 #include "mllibstrategy.h"
 #include "mlmodel.h"
+#include "jobscheduler.h"
+#include "threadbudget.h"
 #include <string>
 #include <future>
 #include <mutex>
@@ -56,15 +58,25 @@ namespace dd
   {
   public:
     tjob(std::future<int> &&ft,
-	 const std::chrono::time_point<std::chrono::system_clock> &tstart)
-      :_ft(std::move(ft)),_tstart(tstart),_status(1) {}
+	 const std::chrono::time_point<std::chrono::system_clock> &tstart,
+	 const std::shared_ptr<JobTicket> &ticket)
+      :_ft(std::move(ft)),_tstart(tstart),_ticket(ticket) {}
     tjob(tjob &&tj)
-      :_ft(std::move(tj._ft)),_tstart(std::move(tj._tstart)),_status(std::move(tj._status)) {}
+      :_ft(std::move(tj._ft)),_tstart(std::move(tj._tstart)),_ticket(std::move(tj._ticket)) {}
     ~tjob() {}
 
+    /**
+     * \brief job status
+     * @return 0: queued, 1: running, 2: finished or terminated
+     */
+    int status() const
+    {
+      return _ticket->_state.load();
+    }
+
     std::future<int> _ft; /**< training job output status upon termination. */
-    std::chrono::time_point<std::chrono::system_clock> _tstart; /**< date at which the training job has started*/
-    int _status = 0; /**< 0: not started, 1: running, 2: finished or terminated */
+    std::chrono::time_point<std::chrono::system_clock> _tstart; /**< date at which the training job was submitted. */
+    std::shared_ptr<JobTicket> _ticket; /**< job scheduling state. */
   };
 
   /**
@@ -91,8 +103,10 @@ namespace dd
      * @param mls ML service
      */
     MLService(MLService &&mls) noexcept
-      :TMLLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>(std::move(mls)),_sname(std::move(mls._sname)),_description(std::move(mls._description)),_tjobs_counter(mls._tjobs_counter.load()),_training_jobs(std::move(mls._training_jobs))
-      {}
+      :TMLLib<TInputConnectorStrategy,TOutputConnectorStrategy,TMLModel>(std::move(mls)),_sname(std::move(mls._sname)),_description(std::move(mls._description)),_tjobs_counter(mls._tjobs_counter.load()),_training_jobs(std::move(mls._training_jobs)),_placement(std::move(mls._placement))
+      {
+	mls._placement = ServicePlacement();
+      }
     
     /**
      * \brief destructor
@@ -100,6 +114,7 @@ namespace dd
     ~MLService() 
       {
 	kill_jobs();
+	ThreadBudget::get().unplace(_placement);
       }
 
     /**
@@ -116,7 +131,12 @@ namespace dd
 	throw MLLibBadParamException("empty repository");
       this->_inputc.init(ad.getobj("parameters").getobj("input"));
       this->_outputc.init(ad.getobj("parameters").getobj("output"));
-      this->init_mllib(ad.getobj("parameters").getobj("mllib"));
+      APIData ad_mllib = ad.getobj("parameters").getobj("mllib");
+      if (ad_mllib.has("nthreads"))
+	this->_nthreads = ad_mllib.get("nthreads").get<int>();
+      ThreadBudget::get().place(ad_mllib,_placement);
+      ThreadScope tscope(0,_placement); // model weights are first touched on the service's node
+      this->init_mllib(ad_mllib);
     }
 
     /**
@@ -128,12 +148,16 @@ namespace dd
       auto hit = _training_jobs.begin();
       while(hit!=_training_jobs.end())
 	{
+	  if ((*hit).second.status() == 0 // queued, not started
+	      && JobScheduler::get().cancel((*hit).second._ticket))
+	    {
+	      (*hit).second._ft.wait();
+	    }
 	  std::future_status status = (*hit).second._ft.wait_for(std::chrono::seconds(0));
 	  if (status == std::future_status::timeout
-	      && (*hit).second._status == 1) // process is running, terminate it
+	      && (*hit).second.status() >= 1) // process is running, terminate it
 	    {
-	      this->_tjob_running.store(false);
-	      (*hit).second._ft.wait();
+	      stop_job((*hit).second);
 	      auto ohit = _training_out.find((*hit).first);
 	      if (ohit!=_training_out.end())
 		_training_out.erase(ohit);
@@ -141,7 +165,19 @@ namespace dd
 	  ++hit;
 	}
     }
-    
+
+    /**
+     * \brief signals a running job to terminate and waits for it
+     * @param tj training job
+     */
+    void stop_job(tjob &tj)
+    {
+      // the flag is raised by train() when it starts, so signal again until the job returns
+      do
+	this->_tjob_running.store(false);
+      while (tj._ft.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout);
+    }
+
     /**
      * \brief get info about the service
      * @return info data object
@@ -167,6 +203,11 @@ namespace dd
       ad.add("name",_sname);
       ad.add("description",_description);
       ad.add("mllib",this->_libname);
+      if (!_placement.empty())
+	{
+	  ad.add("numa_node",_placement._node);
+	  ad.add("cpuset",_placement._cpus);
+	}
       std::vector<APIData> vad;
       std::lock_guard<std::mutex> lock(_tjobs_mutex);
       auto hit = _training_jobs.begin();
@@ -174,9 +215,12 @@ namespace dd
 	{
 	  APIData jad;
 	  jad.add("job",(*hit).first);
-	  int jstatus = (*hit).second._status;
+	  int jstatus = (*hit).second.status();
 	  if (jstatus == 0)
-	    jad.add("status","not started");
+	    {
+	      jad.add("status","queued");
+	      jad.add("queue_position",JobScheduler::get().queue_position((*hit).second._ticket));
+	    }
 	  else if (jstatus == 1)
 	    jad.add("status","running");
 	  else if (jstatus == 2)
@@ -199,6 +243,7 @@ namespace dd
       APIData jmrepo;
       jmrepo.add("repository",this->_mlmodel._repo);
       out.add("model",jmrepo);
+      std::shared_ptr<JobTicket> ticket = submit_job(ad);
       if (!ad.has("async") || (ad.has("async") && ad.get("async").get<bool>()))
 	{
 	  std::lock_guard<std::mutex> lock(_tjobs_mutex);
@@ -207,31 +252,66 @@ namespace dd
 	  int local_tcounter = _tjobs_counter;
 	  _training_jobs.emplace(local_tcounter,
 				 std::move(tjob(std::async(std::launch::async,
-							   [this,ad,local_tcounter]
+							   [this,ad,local_tcounter,ticket]() -> int
 							   {
-							     // XXX: due to lock below, queued jobs may not start in requested order
-							     boost::unique_lock< boost::shared_mutex > lock(_train_mutex);
-							     APIData out;
-							     int run_code = this->train(ad,out);
-							     std::pair<int,APIData> p(local_tcounter,std::move(out));
-							     _training_out.insert(std::move(p));
+							     if (!JobScheduler::get().acquire(ticket))
+							       return 1; // cancelled while queued
+							     int run_code = 1;
+							     try
+							       {
+								 ThreadScope tscope(ticket->_cores,_placement);
+								 boost::unique_lock< boost::shared_mutex > lock(_train_mutex);
+								 APIData out;
+								 run_code = this->train(ad,out);
+								 std::pair<int,APIData> p(local_tcounter,std::move(out));
+								 _training_out.insert(std::move(p));
+							       }
+							     catch (...)
+							       {
+								 JobScheduler::get().release(ticket);
+								 throw;
+							       }
+							     JobScheduler::get().release(ticket);
 							     return run_code;
 							   }),
-						tstart)));
+						tstart,ticket)));
 	  return _tjobs_counter;
 	}
 	else 
 	  {
-	    boost::unique_lock< boost::shared_mutex > lock(_train_mutex);
-	    int status = this->train(ad,out);
+	    JobScheduler::get().acquire(ticket);
+	    int status = 1;
+	    try
+	      {
+		ThreadScope tscope(ticket->_cores,_placement);
+		boost::unique_lock< boost::shared_mutex > lock(_train_mutex);
+		status = this->train(ad,out);
+	      }
+	    catch (...)
+	      {
+		JobScheduler::get().release(ticket);
+		throw;
+	      }
+	    JobScheduler::get().release(ticket);
 	    //this->collect_measures(out);
 	    APIData ad_params_out = ad.getobj("parameters").getobj("output");
 	    if (ad_params_out.has("measure_hist") && ad_params_out.get("measure_hist").get<bool>())
-	      this->collect_measures_history(out);
+	      this->collect_measures_history(out,measure_hist_since(ad_params_out));
 	    return status;
 	  }
     }
 
+    /**
+     * \brief cursor into the measures history from the output parameters, -1 for the full history
+     * @param ad_params_out output parameters
+     */
+    long int measure_hist_since(const APIData &ad_params_out) const
+    {
+      if (ad_params_out.has("measure_hist_since"))
+	return ad_params_out.get("measure_hist_since").get<int>();
+      return -1;
+    }
+
     /**
      * \brief get status of an asynchronous training job
      * @param ad root data object
@@ -250,14 +330,23 @@ namespace dd
       if ((hit=_training_jobs.find(j))!=_training_jobs.end())
 	{
 	  std::future_status status = (*hit).second._ft.wait_for(std::chrono::seconds(secs));
-	  if (status == std::future_status::timeout)
+	  if (status == std::future_status::timeout && (*hit).second.status() == 0)
+	    {
+	      out.add("status","queued");
+	      out.add("queue_position",JobScheduler::get().queue_position((*hit).second._ticket));
+	      out.add("wait_time",JobScheduler::get().wait_time((*hit).second._ticket));
+	      std::chrono::time_point<std::chrono::system_clock> trun = std::chrono::system_clock::now();
+	      out.add("time",std::chrono::duration_cast<std::chrono::seconds>(trun-(*hit).second._tstart).count());
+	    }
+	  else if (status == std::future_status::timeout)
 	    {
 	      out.add("status","running");
 	      this->collect_measures(out);
+	      out.add("wait_time",JobScheduler::get().wait_time((*hit).second._ticket));
 	      std::chrono::time_point<std::chrono::system_clock> trun = std::chrono::system_clock::now();
 	      out.add("time",std::chrono::duration_cast<std::chrono::seconds>(trun-(*hit).second._tstart).count());
 	      if (ad_params_out.has("measure_hist") && ad_params_out.get("measure_hist").get<bool>())
-		this->collect_measures_history(out);
+		this->collect_measures_history(out,measure_hist_since(ad_params_out));
 	    }
 	  else if (status == std::future_status::ready)
 	    {
@@ -287,10 +376,11 @@ namespace dd
 	      APIData jmrepo;
 	      jmrepo.add("repository",this->_mlmodel._repo);
 	      out.add("model",jmrepo);
+	      out.add("wait_time",JobScheduler::get().wait_time((*hit).second._ticket));
 	      std::chrono::time_point<std::chrono::system_clock> trun = std::chrono::system_clock::now();
 	      out.add("time",std::chrono::duration_cast<std::chrono::seconds>(trun-(*hit).second._tstart).count());
 	      if (ad_params_out.has("measure_hist") && ad_params_out.get("measure_hist").get<bool>())
-		this->collect_measures_history(out);
+		this->collect_measures_history(out,measure_hist_since(ad_params_out));
 	      _training_jobs.erase(hit);
 	    }
 	  return 0;
@@ -314,29 +404,61 @@ namespace dd
       std::unordered_map<int,tjob>::iterator hit;
       if ((hit=_training_jobs.find(j))!=_training_jobs.end())
 	{
+	  if ((*hit).second.status() == 0 // queued, removed from the queue
+	      && JobScheduler::get().cancel((*hit).second._ticket))
+	    {
+	      (*hit).second._ft.wait();
+	      out.add("status","terminated");
+	      out.add("wait_time",JobScheduler::get().wait_time((*hit).second._ticket));
+	      _training_jobs.erase(hit);
+	      return 0;
+	    }
+	  // admitted, possibly in between the status check and the cancellation above
 	  std::future_status status = (*hit).second._ft.wait_for(std::chrono::seconds(0));
 	  if (status == std::future_status::timeout
-	      && (*hit).second._status == 1) // process is running, terminate it
+	      && (*hit).second.status() >= 1) // process is running, terminate it
 	    {
-	      this->_tjob_running.store(false); // signals the process
-	      (*hit).second._ft.wait(); // XXX: default timeout in case the process does not return ?
+	      stop_job((*hit).second); // XXX: default timeout in case the process does not return ?
 	      out.add("status","terminated");
 	      std::chrono::time_point<std::chrono::system_clock> trun = std::chrono::system_clock::now();
 	      out.add("time",std::chrono::duration_cast<std::chrono::seconds>(trun-(*hit).second._tstart).count());
-	      _training_jobs.erase(hit);
 	      auto ohit = _training_out.find((*hit).first);
 	      if (ohit!=_training_out.end())
 		_training_out.erase(ohit);
-	    }
-	  else if ((*hit).second._status == 0)
-	    {
-	      out.add("status","not started");
+	      _training_jobs.erase(hit);
 	    }
 	  return 0;
 	}
       else return 1; // job not found
     }
 
+    /**
+     * \brief queues a training job with the process-wide scheduler, with resources
+     *        from the mllib parameters "job_cores", "job_memory" (MB) and "job_priority".
+     *        Jobs default to the service's threads if any, then GPU jobs to a single core,
+     *        and CPU jobs to the whole budget.
+     * @param ad root data object
+     * @return job ticket
+     */
+    std::shared_ptr<JobTicket> submit_job(const APIData &ad)
+    {
+      APIData ad_mllib = ad.getobj("parameters").getobj("mllib");
+      int cores = 0;
+      long int memory = 0;
+      int priority = 0;
+      if (ad_mllib.has("job_cores"))
+	cores = ad_mllib.get("job_cores").get<int>();
+      else if (this->_nthreads > 0)
+	cores = this->_nthreads;
+      else if (ad_mllib.has("gpu") && ad_mllib.get("gpu").get<bool>())
+	cores = 1;
+      if (ad_mllib.has("job_memory"))
+	memory = ad_mllib.get("job_memory").get<int>();
+      if (ad_mllib.has("job_priority"))
+	priority = ad_mllib.get("job_priority").get<int>();
+      return JobScheduler::get().submit(_sname,priority,cores,memory);
+    }
+
     /**
      * \brief starts a predict job, makes sure no training call is running.
      * @param ad root data object
@@ -344,6 +466,19 @@ namespace dd
      * @return predict job status
      */
     int predict_job(const APIData &ad, APIData &out)
+    {
+      int nthreads = ThreadBudget::get().call_threads(ad.getobj("parameters").getobj("mllib"),this->_nthreads);
+      return ThreadBudget::get().run([this,&ad,&out,nthreads]
+				     {
+				       ThreadScope tscope(nthreads,_placement);
+				       return predict_job_locked(ad,out);
+				     });
+    }
+
+    /**
+     * \brief runs a predict call, makes sure no training call is running.
+     */
+    int predict_job_locked(const APIData &ad, APIData &out)
     {
       if (!this->_online)
 	{
@@ -376,6 +511,7 @@ namespace dd
     std::mutex _tjobs_mutex; /**< mutex around training jobs. */
     std::atomic<int> _tjobs_counter = {0}; /**< training jobs counter. */
     std::unordered_map<int,tjob> _training_jobs; // XXX: the futures' dtor blocks if the object is being terminated
+    ServicePlacement _placement; /**< NUMA node and cores the service runs on, if any. */
     std::unordered_map<int,APIData> _training_out;
 
     boost::shared_mutex _train_mutex;
@@ -23,9 +23,14 @@
 #define OUTPUTCONNECTORSTRATEGY_H
 
 #include <map>
+#include <array>
 #include <algorithm>
 #include <iostream>
 #include <numeric>
+#include <exception>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <Eigen/Dense>
 #include "utils/utils.hpp"
 
@@ -43,6 +43,13 @@
 #include <vector>
 #include <mutex>
 #include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <thread>
+#include <fstream>
+#include <map>
+#include <cstdio>
 #include <iostream>
 
 namespace dd
@@ -470,6 +477,10 @@ namespace dd
      */
     int predict(const APIData &ad, const std::string &sname, APIData &out)
     {
+      if (ad.has("fanout"))
+	return predict_fanout(ad,sname,out);
+      if (ad.has("chain"))
+	return predict_chain(ad,sname,out);
       std::chrono::time_point<std::chrono::system_clock> tstart = std::chrono::system_clock::now();
       visitor_predict vp;
       vp._ad = ad;
@@ -516,10 +527,485 @@ namespace dd
       return pout._status;
     }
 
+    /**
+     * \brief decodes images at full size, for services to share them
+     * @param uris image URIs or contents
+     * @return decoded images, in order
+     */
+    std::vector<cv::Mat> decode_images(const std::vector<std::string> &uris)
+    {
+      std::vector<cv::Mat> imgs(uris.size());
+      int catch_read = 0;
+      std::string catch_msg;
+#pragma omp parallel for
+      for (size_t i=0;i<uris.size();i++)
+	{
+	  DataEl<DDImg> dimg;
+	  dimg._ctype._resize = false;
+	  try
+	    {
+	      if (dimg.read_element(uris.at(i)) || dimg._ctype._imgs.size() != 1)
+		throw InputConnectorBadParamException("no image data for " + uris.at(i));
+	      imgs.at(i) = dimg._ctype._imgs.at(0);
+	    }
+	  catch (std::exception &e)
+	    {
+#pragma omp critical
+	      {
+		++catch_read;
+		catch_msg = e.what();
+	      }
+	    }
+	}
+      if (catch_read)
+	throw InputConnectorBadParamException(catch_msg);
+      return imgs;
+    }
+
+    /**
+     * \brief prediction of the same images by several image services: images
+     *        are decoded once and shared, each service resizes them to its own
+     *        input size, services predict concurrently and the results of the
+     *        other services are merged per URI under "services". Failures of the
+     *        other services are reported there instead of failing the call
+     * @param ad root data object, with the other services in "fanout"
+     * @param sname first service name
+     * @param out output data object
+     */
+    int predict_fanout(const APIData &ad, const std::string &sname, APIData &out)
+    {
+      std::chrono::time_point<std::chrono::system_clock> tstart = std::chrono::system_clock::now();
+      std::vector<std::string> uris = ad.get("data").get<std::vector<std::string>>();
+      std::vector<APIData> fanout = ad.getv("fanout");
+      std::vector<std::string> snames = { sname };
+      for (const APIData &f: fanout)
+	{
+	  if (!f.has("service"))
+	    throw InputConnectorBadParamException("missing service in prediction fanout");
+	  std::string fsname = f.get("service").get<std::string>();
+	  std::transform(fsname.begin(),fsname.end(),fsname.begin(),::tolower);
+	  if (!service_exists(fsname))
+	    throw InputConnectorBadParamException("unknown service " + fsname + " in prediction fanout");
+	  snames.push_back(fsname);
+	}
+
+      MemImages mimgs(decode_images(uris));
+      std::vector<std::string> muris;
+      for (size_t i=0;i<uris.size();i++)
+	muris.push_back(mimgs.uri(i));
+      std::vector<APIData> ads(snames.size());
+      ads.at(0) = ad;
+      ads.at(0).erase("fanout");
+      for (size_t f=0;f<fanout.size();f++)
+	{
+	  ads.at(f+1) = fanout.at(f);
+	  ads.at(f+1).add("service",snames.at(f+1));
+	}
+      for (APIData &fad: ads)
+	{
+	  fad.add("data",muris);
+	  fad.add("mem_uris",true);
+	}
+
+      // services predict concurrently, the first one on the calling thread
+      std::vector<APIData> outs(snames.size());
+      std::vector<int> status(snames.size(),0);
+      std::vector<std::string> ferrors(snames.size()); // failures of the other services
+      std::exception_ptr error;
+      std::vector<std::thread> threads;
+      for (size_t f=1;f<snames.size();f++)
+	threads.push_back(std::thread([&,f]()
+				      {
+					try
+					  {
+					    status.at(f) = predict(ads.at(f),snames.at(f),outs.at(f));
+					    if (status.at(f) != 0)
+					      ferrors.at(f) = "prediction failed with status " + std::to_string(status.at(f));
+					  }
+					catch (std::exception &e)
+					  {
+					    status.at(f) = -1;
+					    ferrors.at(f) = e.what();
+					  }
+					catch (...)
+					  {
+					    status.at(f) = -1;
+					    ferrors.at(f) = "prediction failed";
+					  }
+				      }));
+      try
+	{
+	  status.at(0) = predict(ads.at(0),sname,outs.at(0));
+	}
+      catch (...)
+	{
+	  error = std::current_exception();
+	}
+      for (std::thread &t: threads)
+	t.join();
+      if (error)
+	std::rethrow_exception(error);
+      for (size_t f=1;f<snames.size();f++)
+	if (!ferrors.at(f).empty())
+	  LOG(ERROR) << "service " << snames.at(f) << " failed in prediction fanout: " << ferrors.at(f) << std::endl;
+
+      out = outs.at(0);
+      out.add("predictions",merge_fanout(uris,mimgs,snames,outs,ferrors));
+      std::chrono::time_point<std::chrono::system_clock> tstop = std::chrono::system_clock::now();
+      double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(tstop-tstart).count();
+      out.add("time",elapsed);
+      for (int st: status)
+	if (st != 0)
+	  return st;
+      return 0;
+    }
+
+    /**
+     * \brief merges the predictions of fanout services per URI, under "services" in
+     *        the predictions of the first service. A service that failed is reported
+     *        for every URI with its error message, under "services"
+     * @param uris original URIs, in order
+     * @param mimgs decoded images the services predicted from
+     * @param snames service names, first service first
+     * @param outs services output, in the order of snames
+     * @param ferrors error message of every service, empty if it succeeded
+     * @return predictions of the first service, with original URIs
+     */
+    static std::vector<APIData> merge_fanout(const std::vector<std::string> &uris,
+					     const MemImages &mimgs,
+					     const std::vector<std::string> &snames,
+					     const std::vector<APIData> &outs,
+					     const std::vector<std::string> &ferrors)
+    {
+      std::vector<APIData> vpred = outs.at(0).getv("predictions");
+      std::vector<APIData> vservices(uris.size());
+      for (size_t f=1;f<snames.size();f++)
+	{
+	  if (!ferrors.at(f).empty())
+	    {
+	      APIData ferr;
+	      ferr.add("error",ferrors.at(f));
+	      for (APIData &vs: vservices)
+		vs.add(snames.at(f),ferr);
+	      continue;
+	    }
+	  for (APIData &p: outs.at(f).getv("predictions"))
+	    {
+	      long int i = mimgs.index(p.get("uri").get<std::string>());
+	      if (i < 0)
+		continue;
+	      p.erase("uri");
+	      vservices.at(i).add(snames.at(f),p);
+	    }
+	}
+      for (APIData &p: vpred)
+	{
+	  long int i = mimgs.index(p.get("uri").get<std::string>());
+	  if (i < 0)
+	    continue;
+	  p.add("uri",uris.at(i));
+	  p.add("services",vservices.at(i));
+	}
+      return vpred;
+    }
+
+    /**
+     * \brief prediction through a chain of image services, e.g. detection then
+     *        classification: images are decoded once, the objects detected by a
+     *        service are cropped from the decoded images in memory and handed over
+     *        in a single batch to the next service, whose results are nested
+     *        under each object
+     * @param ad root data object, with the chain of next services
+     * @param sname first service name
+     * @param out output data object
+     */
+    int predict_chain(const APIData &ad, const std::string &sname, APIData &out)
+    {
+      std::chrono::time_point<std::chrono::system_clock> tstart = std::chrono::system_clock::now();
+      std::vector<APIData> chain = ad.getv("chain");
+      for (size_t s=0;s<chain.size();s++)
+	{
+	  if (!chain.at(s).has("service"))
+	    throw InputConnectorBadParamException("missing service in prediction chain");
+	  std::string ssname = chain.at(s).get("service").get<std::string>();
+	  std::transform(ssname.begin(),ssname.end(),ssname.begin(),::tolower);
+	  if (!service_exists(ssname))
+	    throw InputConnectorBadParamException("unknown service " + ssname + " in prediction chain");
+	  chain.at(s).add("service",ssname);
+	}
+      APIData ad_output = ad.getobj("parameters").getobj("output");
+      if (!chain.empty() && !(ad_output.has("bbox") && ad_output.get("bbox").get<bool>()))
+	throw InputConnectorBadParamException("prediction chain requires bbox output from service " + sname);
+
+      // decode images once, at full size
+      std::vector<std::string> uris = ad.get("data").get<std::vector<std::string>>();
+      MemImages mimgs(decode_images(uris));
+
+      APIData ad_first = ad;
+      ad_first.erase("chain");
+      std::vector<std::string> muris;
+      for (size_t i=0;i<uris.size();i++)
+	muris.push_back(mimgs.uri(i));
+      ad_first.add("data",muris);
+      ad_first.add("mem_uris",true);
+      int status = predict(ad_first,sname,out);
+      std::vector<APIData> vpred = out.getv("predictions");
+      int cstatus = predict_chain_stage(vpred,mimgs,chain,0);
+      if (status == 0)
+	status = cstatus;
+      for (APIData &p: vpred)
+	{
+	  long int i = mimgs.index(p.get("uri").get<std::string>());
+	  if (i >= 0)
+	    p.add("uri",uris.at(i));
+	}
+      out.add("predictions",vpred);
+      std::chrono::time_point<std::chrono::system_clock> tstop = std::chrono::system_clock::now();
+      double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(tstop-tstart).count();
+      out.add("time",elapsed);
+      return status;
+    }
+
+    /**
+     * \brief runs a stage of a prediction chain on the objects detected by the previous stage.
+     *        A stage that fails is reported with its error message under "chain" for
+     *        every object it was given
+     * @param vpred predictions of the previous stage, results are nested in place
+     * @param imgs images the previous stage predicted from
+     * @param chain chain of services
+     * @param s stage index in the chain
+     * @return 0 if OK, status of the first stage that failed otherwise
+     */
+    int predict_chain_stage(std::vector<APIData> &vpred, const MemImages &imgs,
+			    const std::vector<APIData> &chain, const size_t &s)
+    {
+      if (s >= chain.size())
+	return 0;
+
+      // crop detected objects, crops share the decoded images
+      std::vector<cv::Mat> crops;
+      std::vector<std::pair<size_t,size_t>> owners; // prediction and object of each crop
+      for (size_t p=0;p<vpred.size();p++)
+	{
+	  long int i = imgs.index(vpred.at(p).get("uri").get<std::string>());
+	  if (i < 0 || !vpred.at(p).has("classes"))
+	    continue;
+	  cv::Mat img = imgs.at(i);
+	  std::vector<APIData> vcls = vpred.at(p).getv("classes");
+	  for (size_t c=0;c<vcls.size();c++)
+	    {
+	      if (!vcls.at(c).has("bbox"))
+		continue;
+	      APIData bbox = vcls.at(c).getobj("bbox");
+	      double xmin = bbox.get("xmin").get<double>();
+	      double xmax = bbox.get("xmax").get<double>();
+	      double ymin = bbox.get("ymin").get<double>();
+	      double ymax = bbox.get("ymax").get<double>();
+	      int x0 = std::max(0,static_cast<int>(std::floor(std::min(xmin,xmax))));
+	      int y0 = std::max(0,static_cast<int>(std::floor(std::min(ymin,ymax))));
+	      int x1 = std::min(img.cols,static_cast<int>(std::ceil(std::max(xmin,xmax))));
+	      int y1 = std::min(img.rows,static_cast<int>(std::ceil(std::max(ymin,ymax))));
+	      if (x1 - x0 < 1 || y1 - y0 < 1)
+		continue;
+	      crops.push_back(img(cv::Rect(x0,y0,x1-x0,y1-y0)));
+	      owners.push_back(std::pair<size_t,size_t>(p,c));
+	    }
+	}
+      if (crops.empty())
+	return 0;
+      MemImages mcrops(std::move(crops));
+
+      // all crops in a single call to the next service
+      const APIData &stage = chain.at(s);
+      std::string ssname = stage.get("service").get<std::string>();
+      if (s+1 < chain.size())
+	{
+	  APIData ad_output = stage.getobj("parameters").getobj("output");
+	  if (!(ad_output.has("bbox") && ad_output.get("bbox").get<bool>()))
+	    throw InputConnectorBadParamException("prediction chain requires bbox output from service " + ssname);
+	}
+      APIData ad_stage;
+      ad_stage.add("service",ssname);
+      if (stage.has("parameters"))
+	ad_stage.add("parameters",stage.getobj("parameters"));
+      std::vector<std::string> curis;
+      for (size_t k=0;k<owners.size();k++)
+	curis.push_back(mcrops.uri(k));
+      ad_stage.add("data",curis);
+      ad_stage.add("mem_uris",true);
+      APIData stage_out;
+      int status = 0;
+      std::string serror;
+      try
+	{
+	  status = predict(ad_stage,ssname,stage_out);
+	  if (status != 0)
+	    serror = "prediction failed with status " + std::to_string(status);
+	}
+      catch (std::exception &e)
+	{
+	  status = -1;
+	  serror = e.what();
+	}
+      catch (...)
+	{
+	  status = -1;
+	  serror = "prediction failed";
+	}
+      std::vector<std::vector<APIData>> vvcls(vpred.size());
+      if (!serror.empty())
+	{
+	  LOG(ERROR) << "service " << ssname << " failed in prediction chain: " << serror << std::endl;
+	  APIData cerr;
+	  cerr.add("service",ssname);
+	  cerr.add("error",serror);
+	  for (const std::pair<size_t,size_t> &o: owners)
+	    {
+	      if (vvcls.at(o.first).empty())
+		vvcls.at(o.first) = vpred.at(o.first).getv("classes");
+	      vvcls.at(o.first).at(o.second).add("chain",cerr);
+	    }
+	  for (size_t p=0;p<vpred.size();p++)
+	    if (!vvcls.at(p).empty())
+	      vpred.at(p).add("classes",vvcls.at(p));
+	  return status;
+	}
+      std::vector<APIData> spred = stage_out.getv("predictions");
+      status = predict_chain_stage(spred,mcrops,chain,s+1);
+
+      // nest results under each object
+      for (APIData &sp: spred)
+	{
+	  long int k = mcrops.index(sp.get("uri").get<std::string>());
+	  if (k < 0)
+	    continue;
+	  const std::pair<size_t,size_t> &o = owners.at(k);
+	  if (vvcls.at(o.first).empty())
+	    vvcls.at(o.first) = vpred.at(o.first).getv("classes");
+	  sp.erase("uri");
+	  sp.add("service",ssname);
+	  vvcls.at(o.first).at(o.second).add("chain",sp);
+	}
+      for (size_t p=0;p<vpred.size();p++)
+	if (!vvcls.at(p).empty())
+	  vpred.at(p).add("classes",vvcls.at(p));
+      return status;
+    }
+
     std::unordered_map<std::string,mls_variant_type> _mlservices; /**< container of instanciated services. */
+
+    /**
+     * \brief sets the file created services are persisted to, and restored from
+     * @param fname manifest file name, empty for none
+     */
+    void set_manifest(const std::string &fname)
+    {
+      std::lock_guard<std::mutex> lock(_manifest_mtx);
+      _manifest_fname = fname;
+    }
     
   protected:
     std::mutex _mlservices_mtx; /**< mutex around adding/removing services. */
+
+    /**
+     * \brief records a created service and its creation call into the manifest, if any
+     * @param sname service name
+     * @param jstr JSON creation call
+     */
+    void record_service(const std::string &sname, const std::string &jstr)
+    {
+      if (_manifest_fname.empty())
+	return;
+      std::lock_guard<std::mutex> lock(_manifest_mtx);
+      _manifest[sname] = jstr;
+      if (write_manifest())
+	LOG(ERROR) << "failed writing service manifest " << _manifest_fname << std::endl;
+    }
+
+    /**
+     * \brief removes a service from the manifest, if any
+     * @param sname service name
+     */
+    void forget_service(const std::string &sname)
+    {
+      if (_manifest_fname.empty())
+	return;
+      std::lock_guard<std::mutex> lock(_manifest_mtx);
+      if (_manifest.erase(sname) && write_manifest())
+	LOG(ERROR) << "failed writing service manifest " << _manifest_fname << std::endl;
+    }
+
+    /**
+     * \brief reads the manifest of services to restore, one JSON object per line,
+     *        with the service name and its creation call
+     * @param entries services names and creation calls, in manifest order
+     * @return 0 if OK, 1 if the manifest could not be read
+     */
+    int read_manifest(std::vector<std::pair<std::string,std::string>> &entries)
+    {
+      std::lock_guard<std::mutex> lock(_manifest_mtx);
+      std::ifstream inf(_manifest_fname);
+      if (!inf.is_open())
+	return 1;
+      std::string line;
+      while(std::getline(inf,line))
+	{
+	  if (line.empty())
+	    continue;
+	  rapidjson::Document d;
+	  d.Parse(line.c_str());
+	  if (d.HasParseError() || !d.IsObject() || !d.HasMember("name") || !d["name"].IsString()
+	      || !d.HasMember("call") || !d["call"].IsObject())
+	    {
+	      LOG(ERROR) << "skipping bad service manifest entry: " << line << std::endl;
+	      continue;
+	    }
+	  rapidjson::StringBuffer buffer;
+	  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	  d["call"].Accept(writer);
+	  std::string sname = d["name"].GetString();
+	  _manifest[sname] = buffer.GetString();
+	  entries.push_back(std::pair<std::string,std::string>(sname,buffer.GetString()));
+	}
+      return 0;
+    }
+
+    std::string _manifest_fname; /**< file created services are persisted to, empty for none. */
+
+  private:
+    /**
+     * \brief rewrites the manifest, atomically, must be called under the manifest lock
+     */
+    int write_manifest()
+    {
+      std::string tmp_fname = _manifest_fname + ".tmp";
+      std::ofstream outf(tmp_fname,std::ofstream::out|std::ofstream::trunc);
+      if (!outf.is_open())
+	return 1;
+      for (auto &e: _manifest)
+	{
+	  rapidjson::Document d;
+	  d.Parse(e.second.c_str());
+	  if (d.HasParseError())
+	    continue;
+	  rapidjson::StringBuffer buffer;
+	  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	  writer.StartObject();
+	  writer.Key("name");
+	  writer.String(e.first.c_str());
+	  writer.Key("call");
+	  d.Accept(writer);
+	  writer.EndObject();
+	  outf << buffer.GetString() << std::endl;
+	}
+      outf.close();
+      if (outf.fail())
+	return 1;
+      return std::rename(tmp_fname.c_str(),_manifest_fname.c_str()) == 0 ? 0 : 1;
+    }
+
+    std::map<std::string,std::string> _manifest; /**< created services and their creation calls. */
+    std::mutex _manifest_mtx; /**< mutex around the manifest. */
   };
   
 }
@@ -71,6 +71,273 @@ namespace dd
       std::multimap<double,APIData,std::greater<double>> _extra; /**< extra data or information added to output, e.g. bboxes. */
     };
 
+    /**
+     * \brief streaming accumulator of supervised measures: predictions are fed batch
+     *        by batch, e.g. directly from the output blob, and only the state each
+     *        measure requires is kept (counts, confusion matrix, sums, or compact
+     *        (prediction,target) pairs for auc and gini). Accumulators can be filled
+     *        up concurrently and merged.
+     */
+    class measure_accumulator
+    {
+    public:
+      /**
+       * \brief constructor
+       * @param measures requested measures, as from the output "measure" parameter
+       * @param nclasses number of classes
+       * @param regression whether the model is a regressor
+       */
+      measure_accumulator(const std::vector<std::string> &measures,
+			  const int &nclasses,
+			  const bool &regression)
+	:_nclasses(nclasses),_regression(regression),_measures(measures)
+      {
+	for (auto s: measures)
+	  if (s.find("acc")!=std::string::npos)
+	    {
+	      std::vector<std::string> sv = dd_utils::split(s,'-');
+	      if (sv.size() == 2)
+		_vacck.push_back(std::atoi(sv.at(1).c_str()));
+	      else _vacck.push_back(1);
+	    }
+	_acc_hits = std::vector<double>(_vacck.size(),0.0);
+	_bauc = has_measure("auc");
+	_bf1 = has_measure("f1");
+	_bmcll = has_measure("mcll");
+	_bgini = has_measure("gini");
+	_beucll = has_measure("eucll");
+	_bmcc = has_measure("mcc");
+	if (_bf1 || _bmcc)
+	  _conf_matrix = dMat::Zero(nclasses,nclasses);
+      }
+
+      ~measure_accumulator() {}
+
+      /**
+       * \brief returns an empty accumulator for the same measures
+       */
+      measure_accumulator empty() const
+      {
+	return measure_accumulator(_measures,_nclasses,_regression);
+      }
+
+      /**
+       * \brief adds a single sample with a scalar target
+       * @param pred predictions, nout values
+       * @param nout number of predicted values
+       * @param target target value, class id or regression target
+       */
+      void add(const float *pred,
+	       const int &nout,
+	       const double &target)
+      {
+	if (_conf_matrix.size())
+	  {
+	    if (target < 0)
+	      throw OutputConnectorBadParamException("negative supervised discrete target (e.g. wrong use of label_offset ?");
+	    else if (target >= _nclasses)
+	      throw OutputConnectorBadParamException("target class has id " + std::to_string(target) + " is higher than the number of classes " + std::to_string(_nclasses) + " (e.g. wrong number of classes specified with nclasses");
+	  }
+	int t = static_cast<int>(target);
+	for (size_t a=0;a<_vacck.size();a++)
+	  {
+	    int k = _vacck.at(a);
+	    if (k-1 >= nout || t < 0 || t >= nout)
+	      continue; // ignore instead of error
+	    int rank = 0;
+	    for (int c=0;c<nout;c++)
+	      if (pred[c] > pred[t])
+		++rank;
+	    if (rank < k)
+	      _acc_hits.at(a) += 1.0;
+	  }
+	if (_conf_matrix.size())
+	  _conf_matrix(std::distance(pred,std::max_element(pred,pred+nout)),t) += 1.0;
+	if (_bauc)
+	  {
+	    _auc_pred.push_back(pred[1]);
+	    _auc_targets.push_back(target);
+	  }
+	if (_bmcll)
+	  {
+	    if (t < 0 || t >= nout)
+	      throw OutputConnectorBadParamException("target class has id " + std::to_string(target) + " out of the range of predictions");
+	    _ll -= std::log(pred[t]);
+	  }
+	if (_bgini)
+	  {
+	    if (_regression)
+	      {
+		_gini_a.push_back(target);
+		_gini_p.push_back(pred[0]);
+	      }
+	    else
+	      {
+		_gini_a.push_back(std::distance(pred,std::max_element(pred,pred+nout)));
+		_gini_p.push_back(0.0);
+	      }
+	  }
+	if (_beucll)
+	  _eucl += (pred[0]-target)*(pred[0]-target);
+	++_count;
+      }
+
+      /**
+       * \brief adds a single sample with a vector target, e.g. multi-target regression
+       *        or autoencoder
+       * @param pred predictions, nout values
+       * @param nout number of predicted values
+       * @param target target values
+       */
+      void add(const float *pred,
+	       const int &nout,
+	       const std::vector<double> &target)
+      {
+	if (_beucll)
+	  for (size_t i=0;i<target.size()&&static_cast<int>(i)<nout;i++)
+	    _eucl += (pred[i]-target.at(i))*(pred[i]-target.at(i));
+	++_count;
+      }
+
+      /**
+       * \brief adds a batch of samples with scalar targets, splitting the work
+       *        across threads for large batches
+       * @param preds predictions, one row of stride values per sample
+       * @param stride distance between two consecutive samples in preds
+       * @param nout number of predicted values per sample
+       * @param targets targets, one per sample
+       */
+      void add_batch(const float *preds,
+		     const int &stride,
+		     const int &nout,
+		     const std::vector<float> &targets)
+      {
+	int n = targets.size();
+	if (n < 4096)
+	  {
+	    for (int j=0;j<n;j++)
+	      add(preds+j*stride,nout,targets[j]);
+	    return;
+	  }
+	// contiguous chunks merged in thread order, so that results do not depend on scheduling
+	std::vector<measure_accumulator> maccs;
+	int nthreads = 1;
+#pragma omp parallel
+	{
+#pragma omp single
+	  {
+#ifdef _OPENMP
+	    nthreads = omp_get_num_threads();
+#endif
+	    for (int t=0;t<nthreads;t++)
+	      maccs.push_back(empty());
+	  }
+	  int tid = 0;
+#ifdef _OPENMP
+	  tid = omp_get_thread_num();
+#endif
+	  int chunk = (n + nthreads - 1) / nthreads;
+	  int start = std::min(n,tid*chunk);
+	  int stop = std::min(n,start+chunk);
+	  try
+	    {
+	      for (int j=start;j<stop;j++)
+		maccs.at(tid).add(preds+j*stride,nout,targets[j]);
+	    }
+	  catch (...)
+	    {
+	      maccs.at(tid)._error = std::current_exception();
+	    }
+	}
+	for (measure_accumulator &m: maccs)
+	  {
+	    if (m._error)
+	      std::rethrow_exception(m._error);
+	    merge(m);
+	  }
+      }
+
+      /**
+       * \brief merges another accumulator for the same measures into this one
+       */
+      void merge(const measure_accumulator &macc)
+      {
+	for (size_t a=0;a<_acc_hits.size();a++)
+	  _acc_hits.at(a) += macc._acc_hits.at(a);
+	if (_conf_matrix.size())
+	  _conf_matrix += macc._conf_matrix;
+	_auc_pred.insert(_auc_pred.end(),macc._auc_pred.begin(),macc._auc_pred.end());
+	_auc_targets.insert(_auc_targets.end(),macc._auc_targets.begin(),macc._auc_targets.end());
+	_gini_a.insert(_gini_a.end(),macc._gini_a.begin(),macc._gini_a.end());
+	_gini_p.insert(_gini_p.end(),macc._gini_p.begin(),macc._gini_p.end());
+	_ll += macc._ll;
+	_eucl += macc._eucl;
+	_count += macc._count;
+      }
+
+      /**
+       * \brief computes the measures into a data object
+       * @param clnames class names, used by confusion matrix outputs
+       * @param meas_out measures output data object
+       */
+      void to_ad(const std::vector<std::string> &clnames,
+		 APIData &meas_out) const
+      {
+	double count = static_cast<double>(_count);
+	if (_bauc)
+	  meas_out.add("auc",SupervisedOutput::auc(_auc_pred,_auc_targets));
+	for (size_t a=0;a<_vacck.size();a++)
+	  {
+	    std::string key = "acc";
+	    if (_vacck.at(a) > 1)
+	      key += "-" + std::to_string(_vacck.at(a));
+	    meas_out.add(key,_acc_hits.at(a) / count);
+	  }
+	if (_bf1)
+	  {
+	    double precision,recall,acc;
+	    dMat conf_diag;
+	    dMat conf_matrix = _conf_matrix;
+	    double f1 = SupervisedOutput::mf1_cm(conf_matrix,precision,recall,acc,conf_diag);
+	    SupervisedOutput::f1_to_ad(f1,precision,recall,acc,conf_diag,conf_matrix,clnames,_measures,meas_out);
+	  }
+	if (_bmcll)
+	  meas_out.add("mcll",_ll / count);
+	if (_bgini)
+	  meas_out.add("gini",SupervisedOutput::comp_gini_normalized(_gini_a,_gini_p));
+	if (_beucll)
+	  meas_out.add("eucll",_eucl / count);
+	if (_bmcc)
+	  meas_out.add("mcc",SupervisedOutput::mcc_cm(_conf_matrix));
+      }
+
+      bool has_measure(const std::string &m) const
+      {
+	return std::find(_measures.begin(),_measures.end(),m)!=_measures.end();
+      }
+
+      int _nclasses = 0;
+      bool _regression = false;
+      std::vector<std::string> _measures; /**< requested measures. */
+      std::vector<int> _vacck; /**< k values of requested acc@k measures. */
+      std::vector<double> _acc_hits; /**< top-k hits, per acc@k measure. */
+      bool _bauc = false;
+      bool _bf1 = false;
+      bool _bmcll = false;
+      bool _bgini = false;
+      bool _beucll = false;
+      bool _bmcc = false;
+      dMat _conf_matrix; /**< confusion matrix counts, predicted class x target class. */
+      std::vector<double> _auc_pred; /**< positive class predictions, for auc. */
+      std::vector<double> _auc_targets; /**< binary targets, for auc. */
+      std::vector<double> _gini_a; /**< actual values, for gini. */
+      std::vector<double> _gini_p; /**< predicted values, for gini. */
+      double _ll = 0.0; /**< accumulated log loss. */
+      double _eucl = 0.0; /**< accumulated squared error. */
+      long int _count = 0; /**< number of samples. */
+      std::exception_ptr _error; /**< error raised while filling up the accumulator from a thread. */
+    };
+
   public:
     /**
      * \brief supervised output connector constructor
@@ -180,17 +447,17 @@ namespace dd
 		}
 	      else
 		{
-		  std::unordered_map<std::string,int> lboxes;
+		  std::map<std::array<double,4>,int> lboxes; // number of categories per box
 		  auto bbit = lboxes.begin();
 		  auto mit = sresult._cats.begin();
 		  auto mitx = sresult._extra.begin();
 		  while(mitx!=sresult._extra.end())
 		    {
-		      APIData bbad = (*mitx).second;
-		      std::string bbkey = std::to_string(bbad.get("xmin").get<double>())
-			+ "-" + std::to_string(bbad.get("ymin").get<double>())
-			+ "-" + std::to_string(bbad.get("xmax").get<double>())
-			+ "-" + std::to_string(bbad.get("ymax").get<double>());
+		      const APIData &bbad = (*mitx).second;
+		      std::array<double,4> bbkey = {{ bbad.get("xmin").get<double>(),
+						      bbad.get("ymin").get<double>(),
+						      bbad.get("xmax").get<double>(),
+						      bbad.get("ymax").get<double>() }};
 		      if ((bbit=lboxes.find(bbkey))!=lboxes.end())
 			{
 			  (*bbit).second += 1;
@@ -202,7 +469,7 @@ namespace dd
 			}
 		      else
 			{
-			  lboxes.insert(std::pair<std::string,int>(bbkey,1));
+			  lboxes.insert(std::pair<std::array<double,4>,int>(bbkey,1));
 			  bsresult._cats.insert(std::pair<double,std::string>((*mit).first,(*mit).second));
 			  bsresult._extra.insert(std::pair<double,APIData>((*mitx).first,bbad));
 			}
@@ -267,9 +534,6 @@ namespace dd
     static void measure(const APIData &ad_res, const APIData &ad_out, APIData &out)
     {
       APIData meas_out;
-      bool tloss = ad_res.has("train_loss");
-      bool loss = ad_res.has("loss");
-      bool iter = ad_res.has("iteration");
       bool regression = ad_res.has("regression");
       if (ad_out.has("measure"))
 	{
@@ -307,33 +571,10 @@ namespace dd
 	      double f1,precision,recall,acc;
 	      dMat conf_diag,conf_matrix;
 	      f1 = mf1(ad_res,precision,recall,acc,conf_diag,conf_matrix);
-	      meas_out.add("f1",f1);
-	      meas_out.add("precision",precision);
-	      meas_out.add("recall",recall);
-	      meas_out.add("accp",acc);
-	      if (std::find(measures.begin(),measures.end(),"cmdiag")!=measures.end())
-		{
-		  std::vector<double> cmdiagv;
-		  for (int i=0;i<conf_diag.rows();i++)
-		    cmdiagv.push_back(conf_diag(i,0));
-		  meas_out.add("cmdiag",cmdiagv);
-		  meas_out.add("labels",ad_res.get("clnames").get<std::vector<std::string>>());
-		}
-	      if (std::find(measures.begin(),measures.end(),"cmfull")!=measures.end())
-		{
-		  std::vector<std::string> clnames = ad_res.get("clnames").get<std::vector<std::string>>();
-		  std::vector<APIData> cmdata;
-		  for (int i=0;i<conf_matrix.cols();i++)
-		    {
-		      std::vector<double> cmrow;
-		      for (int j=0;j<conf_matrix.rows();j++)
-			cmrow.push_back(conf_matrix(j,i));
-		      APIData adrow;
-		      adrow.add(clnames.at(i),cmrow);
-		      cmdata.push_back(adrow);
-		    }
-		  meas_out.add("cmfull",cmdata);
-		}
+	      std::vector<std::string> clnames;
+	      if (ad_res.has("clnames"))
+		clnames = ad_res.get("clnames").get<std::vector<std::string>>();
+	      f1_to_ad(f1,precision,recall,acc,conf_diag,conf_matrix,clnames,measures,meas_out);
 	    }
 	  if (bmcll)
 	    {
@@ -357,26 +598,46 @@ namespace dd
 	      
 	    }
 	}
-	if (loss)
-	  meas_out.add("loss",ad_res.get("loss").get<double>()); // 'universal', comes from algorithm
-	if (tloss)
-	  meas_out.add("train_loss",ad_res.get("train_loss").get<double>());
-	if (iter)
-	  meas_out.add("iteration",ad_res.get("iteration").get<double>());
+	measure_common(ad_res,meas_out);
 	out.add("measure",meas_out);
     }
 
+    /**
+     * \brief measures from a streaming accumulator, as filled up at test time
+     * @param macc measure accumulator
+     * @param ad_res test results, e.g. iteration, train_loss, clnames
+     * @param ad_out output parameters
+     * @param out output data object
+     */
+    static void measure(const measure_accumulator &macc,
+			const APIData &ad_res, const APIData &ad_out, APIData &out)
+    {
+      APIData meas_out;
+      if (ad_out.has("measure"))
+	{
+	  std::vector<std::string> clnames;
+	  if (ad_res.has("clnames"))
+	    clnames = ad_res.get("clnames").get<std::vector<std::string>>();
+	  macc.to_ad(clnames,meas_out);
+	}
+      measure_common(ad_res,meas_out);
+      out.add("measure",meas_out);
+    }
+
+    static void measure_common(const APIData &ad_res, APIData &meas_out)
+    {
+      if (ad_res.has("loss"))
+	meas_out.add("loss",ad_res.get("loss").get<double>()); // 'universal', comes from algorithm
+      if (ad_res.has("train_loss"))
+	meas_out.add("train_loss",ad_res.get("train_loss").get<double>());
+      if (ad_res.has("iteration"))
+	meas_out.add("iteration",ad_res.get("iteration").get<double>());
+    }
+
     // measure: ACC
     static std::map<std::string,double> acc(const APIData &ad,
 					    const std::vector<std::string> &measures)
     {
-      struct acc_comp
-      {
-        acc_comp(const std::vector<double> &v)
-	:_v(v) {}
-	bool operator()(double a, double b) { return _v[a] > _v[b]; }
-	const std::vector<double> _v;
-      };
       std::map<std::string,double> accs;
       std::vector<int> vacck;
       for(auto s: measures)
@@ -398,18 +659,15 @@ namespace dd
 	    {
 	      APIData bad = ad.getobj(std::to_string(i));
 	      std::vector<double> predictions = bad.get("pred").get<std::vector<double>>();
-	      if (k-1 >= static_cast<int>(predictions.size()))
+	      int target = static_cast<int>(bad.get("target").get<double>());
+	      if (k-1 >= static_cast<int>(predictions.size()) || target < 0 || target >= static_cast<int>(predictions.size()))
 		continue; // ignore instead of error
-	      std::vector<int> predk(predictions.size());
+	      int rank = 0;
 	      for (size_t j=0;j<predictions.size();j++)
-		predk[j] = j;
-	      std::partial_sort(predk.begin(),predk.begin()+k-1,predk.end(),acc_comp(predictions));
-	      for (int l=0;l<k;l++)
-		if (predk.at(l) == bad.get("target").get<double>())
-		  {
-		    acc++;
-		    break;
-		  }
+		if (predictions[j] > predictions[target])
+		  ++rank;
+	      if (rank < k)
+		acc++;
 	    }
 	  std::string key = "acc";
 	  if (k>1)
@@ -423,7 +681,6 @@ namespace dd
     static double mf1(const APIData &ad, double &precision, double &recall, double &acc, dMat &conf_diag, dMat &conf_matrix)
     {
       int nclasses = ad.get("nclasses").get<int>();
-      double f1=0.0;
       conf_matrix = dMat::Zero(nclasses,nclasses);
       int batch_size = ad.get("batch_size").get<int>();
       for (int i=0;i<batch_size;i++)
@@ -438,6 +695,16 @@ namespace dd
 	    throw OutputConnectorBadParamException("target class has id " + std::to_string(target) + " is higher than the number of classes " + std::to_string(nclasses) + " (e.g. wrong number of classes specified with nclasses");
 	  conf_matrix(maxpr,target) += 1.0;
 	}
+      return mf1_cm(conf_matrix,precision,recall,acc,conf_diag);
+    }
+
+    /**
+     * \brief F1 from a confusion matrix of counts, normalized in place
+     */
+    static double mf1_cm(dMat &conf_matrix, double &precision, double &recall, double &acc, dMat &conf_diag)
+    {
+      int nclasses = conf_matrix.rows();
+      double f1=0.0;
       conf_diag = conf_matrix.diagonal();
       dMat conf_csum = conf_matrix.colwise().sum();
       dMat conf_rsum = conf_matrix.rowwise().sum();
@@ -451,6 +718,40 @@ namespace dd
 	conf_matrix.col(i) /= conf_csum(i);
       return f1;
     }
+
+    static void f1_to_ad(const double &f1, const double &precision, const double &recall, const double &acc,
+			 const dMat &conf_diag, const dMat &conf_matrix,
+			 const std::vector<std::string> &clnames,
+			 const std::vector<std::string> &measures,
+			 APIData &meas_out)
+    {
+      meas_out.add("f1",f1);
+      meas_out.add("precision",precision);
+      meas_out.add("recall",recall);
+      meas_out.add("accp",acc);
+      if (std::find(measures.begin(),measures.end(),"cmdiag")!=measures.end())
+	{
+	  std::vector<double> cmdiagv;
+	  for (int i=0;i<conf_diag.rows();i++)
+	    cmdiagv.push_back(conf_diag(i,0));
+	  meas_out.add("cmdiag",cmdiagv);
+	  meas_out.add("labels",clnames);
+	}
+      if (std::find(measures.begin(),measures.end(),"cmfull")!=measures.end())
+	{
+	  std::vector<APIData> cmdata;
+	  for (int i=0;i<conf_matrix.cols();i++)
+	    {
+	      std::vector<double> cmrow;
+	      for (int j=0;j<conf_matrix.rows();j++)
+		cmrow.push_back(conf_matrix(j,i));
+	      APIData adrow;
+	      adrow.add(clnames.at(i),cmrow);
+	      cmdata.push_back(adrow);
+	    }
+	  meas_out.add("cmfull",cmdata);
+	}
+    }
     
     // measure: AUC
     static double auc(const APIData &ad)
@@ -538,6 +839,11 @@ namespace dd
 	    throw OutputConnectorBadParamException("target class has id " + std::to_string(target) + " is higher than the number of classes " + std::to_string(nclasses) + " (e.g. wrong number of classes specified with nclasses");
 	  conf_matrix(maxpr,target) += 1.0;
 	}
+      return mcc_cm(conf_matrix);
+    }
+
+    static double mcc_cm(const dMat &conf_matrix)
+    {
       double tp = conf_matrix(0,0);
       double tn = conf_matrix(1,1);
       double fn = conf_matrix(0,1);
@@ -21,7 +21,9 @@
 
 #include "svminputfileconn.h"
 #include "utils/utils.hpp"
+#include "utils/datacache.hpp"
 #include <glog/logging.h>
+#include <memory>
 
 namespace dd
 {
@@ -108,6 +110,97 @@ namespace dd
       }
   }
   
+  /*- parsed dataset cache -*/
+  static const char svm_cache_magic[8] = {'D','D','S','V','M','C','0','1'};
+  enum svm_cache_tag { SVM_CACHE_TRAIN = 0, SVM_CACHE_TEST = 1, SVM_CACHE_END = 2 };
+
+  static void svm_cache_write_line(DataCacheWriter &out, const char &tag,
+				   const int &label, const std::unordered_map<int,double> &vals)
+  {
+    std::vector<int32_t> ids;
+    std::vector<double> dvals;
+    ids.reserve(vals.size());
+    dvals.reserve(vals.size());
+    for (auto &v: vals)
+      {
+	ids.push_back(v.first);
+	dvals.push_back(v.second);
+      }
+    out.write_tag(tag);
+    out.write_int(label);
+    out.write_vals(ids);
+    out.write_vals(dvals);
+  }
+
+  std::string SVMInputFileConn::svm_cache_key(const std::string &fname) const
+  {
+    std::stringstream sk;
+    sk << fname << ":" << fileops::file_last_modif(fname) << ":" << fileops::file_size(fname) << ";";
+    if (!_svm_test_fname.empty())
+      sk << _svm_test_fname << ":" << fileops::file_last_modif(_svm_test_fname) << ":" << fileops::file_size(_svm_test_fname) << ";";
+    return sk.str();
+  }
+
+  bool SVMInputFileConn::read_svm_cache(const std::string &key)
+  {
+    std::string cache_fname = _model_repo + "/" + _cache_fname;
+    DataCacheReader cr(cache_fname,svm_cache_magic);
+    if (!cr.is_open())
+      return false;
+
+    // header: key, feature ids
+    std::string ckey;
+    std::vector<int32_t> fids;
+    int max_id = -1;
+    bool ok = cr.read_str(ckey) && ckey == key && cr.read_vals(fids) && cr.read_int(max_id);
+
+    // check that data lines are complete before replaying any of them
+    size_t data_pos = cr._pos;
+    char tag = SVM_CACHE_END;
+    int label = -1;
+    std::vector<int32_t> ids;
+    std::vector<double> dvals;
+    while (ok && (ok = cr.read_tag(tag)) && tag != SVM_CACHE_END)
+      ok = (tag == SVM_CACHE_TRAIN || tag == SVM_CACHE_TEST) && cr.read_int(label)
+	&& cr.read_vals(ids,true) && cr.read_vals(dvals,true);
+    if (!ok)
+      {
+	LOG(INFO) << "parsed dataset cache " << cache_fname << " is outdated or incomplete, parsing data again" << std::endl;
+	return false;
+      }
+
+    _fids.insert(fids.begin(),fids.end());
+    _max_id = std::max(_max_id,max_id);
+    cr._pos = data_pos;
+    int nlines = 0, ntlines = 0;
+    while (cr.read_tag(tag) && tag != SVM_CACHE_END)
+      {
+	cr.read_int(label);
+	cr.read_vals(ids);
+	cr.read_vals(dvals);
+	std::unordered_map<int,double> vals;
+	for (size_t i=0;i<ids.size()&&i<dvals.size();i++)
+	  vals.insert(std::pair<int,double>(ids.at(i),dvals.at(i)));
+	if (tag == SVM_CACHE_TRAIN)
+	  add_train_svmline(label,vals,nlines++);
+	else add_test_svmline(label,vals,ntlines++);
+      }
+    LOG(INFO) << "read " << nlines << " training and " << ntlines << " test lines from parsed dataset cache " << cache_fname << std::endl;
+    return true;
+  }
+
+  void SVMInputFileConn::finalize_svm(const APIData &ad)
+  {
+    // shuffle before test selection, if any
+    shuffle_data(ad);
+
+    if (_svm_test_fname.empty() && _test_split > 0)
+      {
+	split_data();
+	LOG(INFO) << "data split test size=" << _svmdata_test.size() << " / remaining data size=" << _svmdata.size() << std::endl;
+      }
+  }
+
   void SVMInputFileConn::read_svm(const APIData &ad,
 				  const std::string &fname)
   {
@@ -117,6 +210,21 @@ namespace dd
       throw InputConnectorBadParamException("cannot open file " + fname);
     std::string hline;
 
+    // parsed dataset cache, if any
+    bool cache = _train && ad.has("cache") && ad.get("cache").get<bool>() && !_model_repo.empty();
+    std::string cache_key;
+    std::string cache_fname = _model_repo + "/" + _cache_fname;
+    if (cache)
+      {
+	cache_key = svm_cache_key(fname);
+	if (read_svm_cache(cache_key))
+	  {
+	    svm_file.close();
+	    finalize_svm(ad);
+	    return;
+	  }
+      }
+
     // first pass to get max index
     std::string col;
     while(std::getline(svm_file,hline))
@@ -145,6 +253,24 @@ namespace dd
 
     LOG(INFO) << "total number of dimensions=" << _fids.size() << std::endl;
 
+    // cache header, data lines are appended as they are read
+    std::unique_ptr<DataCacheWriter> cache_out;
+    if (cache)
+      {
+	cache_out.reset(new DataCacheWriter(cache_fname,svm_cache_magic));
+	if (cache_out->is_open())
+	  {
+	    cache_out->write_str(cache_key);
+	    cache_out->write_vals(std::vector<int32_t>(_fids.begin(),_fids.end()));
+	    cache_out->write_int(_max_id);
+	  }
+	else
+	  {
+	    LOG(WARNING) << "cannot write parsed dataset cache " << cache_fname << std::endl;
+	    cache_out.reset();
+	  }
+      }
+
     // read data
     int nlines = 0;
     while(std::getline(svm_file,hline))
@@ -152,6 +278,8 @@ namespace dd
 	std::unordered_map<int,double> vals;
 	int label;
 	read_svm_line(hline,vals,label);
+	if (cache_out)
+	  svm_cache_write_line(*cache_out,SVM_CACHE_TRAIN,label,vals);
 	add_train_svmline(label,vals,nlines);
 	++nlines;
       }
@@ -170,20 +298,24 @@ namespace dd
 	      std::unordered_map<int,double> vals;
 	      int label;
 	      read_svm_line(hline,vals,label);
+	      if (cache_out)
+		svm_cache_write_line(*cache_out,SVM_CACHE_TEST,label,vals);
 	      add_test_svmline(label,vals,tnlines);
 	      ++tnlines;
 	    }
 	  svm_test_file.close();
 	}
-      
-      // shuffle before test selection, if any
-      shuffle_data(ad);
-      
-      if (_svm_test_fname.empty() && _test_split > 0)
+
+      // complete the cache, made visible only once fully written
+      if (cache_out)
 	{
-	  split_data();
-	  LOG(INFO) << "data split test size=" << _svmdata_test.size() << " / remaining data size=" << _svmdata.size() << std::endl;
+	  cache_out->write_tag(SVM_CACHE_END);
+	  if (!cache_out->commit())
+	    LOG(WARNING) << "failed writing parsed dataset cache " << cache_fname << std::endl;
+	  else LOG(INFO) << "wrote parsed dataset cache " << cache_fname << std::endl;
 	}
+
+      finalize_svm(ad);
   }
 
   void SVMInputFileConn::serialize_vocab()
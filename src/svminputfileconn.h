@@ -206,6 +206,28 @@ namespace dd
 		       std::unordered_map<int,double> &vals,
 		       int &label);
 
+    /**
+     * \brief key of the parsed dataset cache, from data files path, modification time
+     *        and size
+     * @param fname training data file name
+     * @return cache key
+     */
+    std::string svm_cache_key(const std::string &fname) const;
+
+    /**
+     * \brief restores feature ids and data lines from the parsed dataset cache
+     *        in the model repository, if its key matches
+     * @param key expected cache key
+     * @return true if the cache was used, false otherwise
+     */
+    bool read_svm_cache(const std::string &key);
+
+    /**
+     * \brief shuffles and splits once data has been read
+     * @param ad input data object
+     */
+    void finalize_svm(const APIData &ad);
+
     int batch_size() const
     {
       return _svmdata.size();
@@ -237,6 +259,7 @@ namespace dd
     std::unordered_set<int> _fids; /**< feature ids. */
     int _max_id = -1;
     std::string _vocabfname = "vocab.dat";
+    std::string _cache_fname = "svm_cache.dat"; /**< parsed dataset cache, in model repository */
     std::string _db_fname;
   };
 
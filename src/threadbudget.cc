@@ -0,0 +1,384 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threadbudget.h"
+#include "mllibstrategy.h"
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <sstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// resolved at link time, if the BLAS library provides them
+extern "C" void openblas_set_num_threads(int) __attribute__((weak));
+extern "C" void goto_set_num_threads(int) __attribute__((weak));
+
+DEFINE_int32(call_threads,0,"number of OpenMP threads per predict call (0: library defaults)");
+DEFINE_int32(blas_threads,0,"number of BLAS threads, process-wide (0: library defaults)");
+DEFINE_int32(pinned_workers,0,"number of pinned workers that run predict calls, each on its own share of the cores (0: calls run in the server threads)");
+DEFINE_bool(numa_auto,false,"whether to spread services across NUMA nodes, binding their memory and threads to a node");
+
+namespace dd
+{
+  static thread_local int current_threads = 0;
+
+#ifdef __linux__
+  static void cpus_to_set(const std::vector<int> &cpus, cpu_set_t &cpuset)
+  {
+    CPU_ZERO(&cpuset);
+    for (int c: cpus)
+      CPU_SET(c,&cpuset);
+  }
+
+  static std::vector<int> thread_cpus()
+  {
+    std::vector<int> cpus;
+    cpu_set_t cpuset;
+    if (pthread_getaffinity_np(pthread_self(),sizeof(cpu_set_t),&cpuset) == 0)
+      for (int c=0;c<CPU_SETSIZE;c++)
+	if (CPU_ISSET(c,&cpuset))
+	  cpus.push_back(c);
+    return cpus;
+  }
+
+  /**
+   * \brief binds the calling thread memory allocations to a node, or back to default if node < 0
+   */
+  static void set_thread_mempolicy(const int &node)
+  {
+#ifdef SYS_set_mempolicy
+    static const int mpol_default = 0;
+    static const int mpol_preferred = 1;
+    if (node < 0)
+      syscall(SYS_set_mempolicy,mpol_default,nullptr,0);
+    else
+      {
+	unsigned long nodemask[16] = {0};
+	nodemask[node/(8*sizeof(unsigned long))] |= 1ul << (node%(8*sizeof(unsigned long)));
+	syscall(SYS_set_mempolicy,mpol_preferred,nodemask,sizeof(nodemask)*8);
+      }
+#else
+    (void)node;
+#endif
+  }
+
+  /**
+   * \brief binds the calling thread, and the OpenMP threads it spawns, to a set of cores
+   */
+  static void bind_threads(const std::vector<int> &cpus,
+			   const int &node,
+			   const int &nthreads)
+  {
+    cpu_set_t cpuset;
+    cpus_to_set(cpus,cpuset);
+    int err = pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&cpuset);
+    if (err != 0)
+      LOG(WARNING) << "failed binding thread to " << cpus.size() << " cores: " << strerror(err) << std::endl;
+    set_thread_mempolicy(node);
+#ifdef _OPENMP
+    // OpenMP threads are kept across parallel regions, and do not follow the calling thread
+    int failed = 0;
+#pragma omp parallel num_threads(std::max(1,nthreads)) reduction(+:failed)
+    {
+      if (pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&cpuset) != 0)
+	++failed;
+      set_thread_mempolicy(node);
+    }
+    if (failed > 0)
+      LOG(WARNING) << "failed binding " << failed << " OpenMP threads to " << cpus.size() << " cores" << std::endl;
+#else
+    (void)nthreads;
+#endif
+  }
+#endif
+
+  static std::vector<int> parse_cpulist(const std::string &cpulist)
+  {
+    std::vector<int> cpus;
+    std::stringstream ss(cpulist);
+    std::string range;
+    while(std::getline(ss,range,','))
+      {
+	size_t dash = range.find('-');
+	try
+	  {
+	    if (dash == std::string::npos)
+	      cpus.push_back(std::stoi(range));
+	    else
+	      for (int c=std::stoi(range.substr(0,dash));c<=std::stoi(range.substr(dash+1));c++)
+		cpus.push_back(c);
+	  }
+	catch (std::exception &e)
+	  {
+	    continue;
+	  }
+      }
+    return cpus;
+  }
+
+  /*- PinnedWorkerPool -*/
+  PinnedWorkerPool::PinnedWorkerPool(const int &nworkers)
+  {
+    // online cores the process may run on, e.g. within a container cpuset
+    _cpus = ThreadBudget::online_cpus();
+#ifdef __linux__
+    std::vector<int> allowed = thread_cpus();
+    std::vector<int> cpus;
+    for (int c: _cpus)
+      if (std::find(allowed.begin(),allowed.end(),c) != allowed.end())
+	cpus.push_back(c);
+    if (!cpus.empty())
+      _cpus = cpus;
+#endif
+    if (_cpus.empty())
+      for (int c=0;c<static_cast<int>(std::max(1u,std::thread::hardware_concurrency()));c++)
+	_cpus.push_back(c);
+    _cores_per_worker = std::max(1,static_cast<int>(_cpus.size()) / nworkers);
+    _pool = std::unique_ptr<WorkerPool>(new WorkerPool(nworkers,0,[this](const int &w){ pin(w); }));
+    LOG(INFO) << "started " << nworkers << " pinned workers with " << _cores_per_worker << " cores each" << std::endl;
+  }
+
+  PinnedWorkerPool::~PinnedWorkerPool()
+  {
+  }
+
+  int PinnedWorkerPool::run(const std::function<int()> &f)
+  {
+    std::shared_ptr<std::packaged_task<int()>> task(new std::packaged_task<int()>(f));
+    std::future<int> ft = task->get_future();
+    if (!_pool->try_submit([task]{ (*task)(); }))
+      (*task)(); // pool stopping, runs in the calling thread
+    return ft.get();
+  }
+
+  void PinnedWorkerPool::pin(const int &w)
+  {
+#ifdef __linux__
+    // threads spawned by the worker, e.g. OpenMP, inherit the affinity
+    std::vector<int> wcpus;
+    for (int c=0;c<_cores_per_worker;c++)
+      wcpus.push_back(_cpus.at((w*_cores_per_worker+c)%_cpus.size()));
+    cpu_set_t cpuset;
+    cpus_to_set(wcpus,cpuset);
+    if (pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&cpuset) != 0)
+      LOG(WARNING) << "failed pinning worker " << w << std::endl;
+#else
+    (void)w;
+#endif
+  }
+
+  /*- ThreadBudget -*/
+  ThreadBudget::ThreadBudget(const int &call_threads,
+			     const int &blas_threads,
+			     const int &pinned_workers)
+    :_call_threads(call_threads),_numa_auto(FLAGS_numa_auto)
+  {
+    _nodes = numa_nodes();
+    _node_services = std::vector<int>(_nodes.size(),0);
+    if (blas_threads > 0)
+      set_blas_threads(blas_threads);
+    if (pinned_workers > 0)
+      _pool = std::unique_ptr<PinnedWorkerPool>(new PinnedWorkerPool(pinned_workers));
+  }
+
+  ThreadBudget& ThreadBudget::get()
+  {
+    static ThreadBudget tb(FLAGS_call_threads,FLAGS_blas_threads,FLAGS_pinned_workers);
+    return tb;
+  }
+
+  int ThreadBudget::call_threads(const APIData &ad_mllib,
+				 const int &service_threads) const
+  {
+    if (ad_mllib.has("nthreads"))
+      return ad_mllib.get("nthreads").get<int>();
+    if (service_threads > 0)
+      return service_threads;
+    if (_call_threads > 0)
+      return _call_threads;
+    if (_pool)
+      return _pool->cores_per_worker();
+    return 0;
+  }
+
+  int ThreadBudget::run(const std::function<int()> &f)
+  {
+    if (_pool)
+      return _pool->run(f);
+    return f();
+  }
+
+  int ThreadBudget::current()
+  {
+    return current_threads;
+  }
+
+  void ThreadBudget::set_blas_threads(const int &nthreads)
+  {
+    if (openblas_set_num_threads)
+      openblas_set_num_threads(nthreads);
+    else if (goto_set_num_threads)
+      goto_set_num_threads(nthreads);
+    else LOG(WARNING) << "BLAS library does not support setting the number of threads" << std::endl;
+  }
+
+  std::vector<std::vector<int>> ThreadBudget::numa_nodes()
+  {
+    std::vector<std::vector<int>> nodes;
+    for (int n=0;;n++)
+      {
+	std::ifstream in("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+	if (!in.is_open())
+	  break;
+	std::string cpulist;
+	std::getline(in,cpulist);
+	nodes.push_back(parse_cpulist(cpulist));
+      }
+    if (nodes.empty())
+      {
+	std::vector<int> cpus;
+	for (unsigned int c=0;c<std::max(1u,std::thread::hardware_concurrency());c++)
+	  cpus.push_back(c);
+	nodes.push_back(cpus);
+      }
+    return nodes;
+  }
+
+  std::vector<int> ThreadBudget::online_cpus()
+  {
+    std::vector<int> cpus;
+    std::ifstream in("/sys/devices/system/cpu/online");
+    if (in.is_open())
+      {
+	std::string cpulist;
+	std::getline(in,cpulist);
+	cpus = parse_cpulist(cpulist);
+      }
+    if (cpus.empty())
+      for (const std::vector<int> &node: numa_nodes())
+	cpus.insert(cpus.end(),node.begin(),node.end());
+    return cpus;
+  }
+
+  void ThreadBudget::place(const APIData &ad_mllib,
+			   ServicePlacement &placement)
+  {
+    std::lock_guard<std::mutex> lock(_place_mutex);
+    if (ad_mllib.has("cpuset"))
+      {
+	std::vector<int> cpus = ad_mllib.get("cpuset").get<std::vector<int>>();
+	if (cpus.empty())
+	  throw MLLibBadParamException("empty cpuset");
+	std::vector<int> online = online_cpus();
+	for (int c: cpus)
+	  {
+#ifdef __linux__
+	    if (c >= CPU_SETSIZE)
+	      throw MLLibBadParamException("cpuset core " + std::to_string(c) + " is beyond the supported " + std::to_string(CPU_SETSIZE) + " cores");
+#endif
+	    if (std::find(online.begin(),online.end(),c) == online.end())
+	      throw MLLibBadParamException("cpuset core " + std::to_string(c) + " is not an online core, host has " + std::to_string(online.size()) + " online cores");
+	  }
+	placement._cpus = cpus;
+	return;
+      }
+    int node = -1;
+    if (ad_mllib.has("numa_node"))
+      {
+	node = ad_mllib.get("numa_node").get<int>();
+	if (node < 0 || node >= static_cast<int>(_nodes.size()))
+	  throw MLLibBadParamException("unknown NUMA node " + std::to_string(node) + ", host has " + std::to_string(_nodes.size()) + " nodes");
+      }
+    else if ((ad_mllib.has("numa_auto") && ad_mllib.get("numa_auto").get<bool>())
+	     || _numa_auto)
+      {
+	if (_nodes.size() < 2)
+	  return; // nothing to spread
+	node = std::distance(_node_services.begin(),std::min_element(_node_services.begin(),_node_services.end()));
+	placement._auto = true;
+      }
+    if (node < 0)
+      return;
+    placement._node = node;
+    placement._cpus = _nodes.at(node);
+    ++_node_services.at(node);
+    LOG(INFO) << "service placed on NUMA node " << node << " with " << placement._cpus.size() << " cores" << std::endl;
+  }
+
+  void ThreadBudget::unplace(const ServicePlacement &placement)
+  {
+    std::lock_guard<std::mutex> lock(_place_mutex);
+    if (placement._node >= 0 && placement._node < static_cast<int>(_node_services.size()))
+      --_node_services.at(placement._node);
+  }
+
+  /*- ThreadScope -*/
+  ThreadScope::ThreadScope(const int &nthreads,
+			   const ServicePlacement &placement)
+  {
+    _nthreads = nthreads;
+    if (_nthreads <= 0 && !placement.empty())
+      _nthreads = placement._cpus.size();
+    if (_nthreads > 0)
+      {
+#ifdef _OPENMP
+	_prev_omp = omp_get_max_threads();
+	omp_set_num_threads(_nthreads);
+#endif
+	_prev_current = current_threads;
+	current_threads = _nthreads;
+	_set = true;
+      }
+#ifdef __linux__
+    if (!placement.empty())
+      {
+	_prev_cpus = thread_cpus();
+	bind_threads(placement._cpus,placement._node,_nthreads);
+	_bound = true;
+      }
+#endif
+  }
+
+  ThreadScope::~ThreadScope()
+  {
+#ifdef __linux__
+    if (_bound && !_prev_cpus.empty())
+      bind_threads(_prev_cpus,-1,_nthreads);
+#endif
+    if (!_set)
+      return;
+#ifdef _OPENMP
+    omp_set_num_threads(_prev_omp);
+#endif
+    current_threads = _prev_current;
+  }
+}
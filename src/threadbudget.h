@@ -0,0 +1,186 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADBUDGET_H
+#define THREADBUDGET_H
+
+#include "apidata.h"
+#include "workerpool.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dd
+{
+  /**
+   * \brief fixed pool of workers, each pinned to its own share of the online cores,
+   *        that runs calls on behalf of the server threads
+   */
+  class PinnedWorkerPool
+  {
+  public:
+    /**
+     * \brief constructor
+     * @param nworkers number of workers
+     */
+    PinnedWorkerPool(const int &nworkers);
+    ~PinnedWorkerPool();
+
+    /**
+     * \brief runs a call on a worker, blocks until completion, exceptions are passed on
+     * @param f call
+     * @return call status
+     */
+    int run(const std::function<int()> &f);
+
+    /**
+     * \brief number of cores each worker is pinned to
+     */
+    int cores_per_worker() const { return _cores_per_worker; }
+
+  private:
+    void pin(const int &w);
+
+    std::vector<int> _cpus; /**< cores the workers are spread over. */
+    int _cores_per_worker = 1;
+    std::unique_ptr<WorkerPool> _pool;
+  };
+
+  /**
+   * \brief placement of a service on a NUMA node or a set of cores
+   */
+  class ServicePlacement
+  {
+  public:
+    ServicePlacement() {}
+    ~ServicePlacement() {}
+
+    bool empty() const { return _cpus.empty(); }
+
+    int _node = -1; /**< NUMA node whose memory is preferred, -1 for none. */
+    std::vector<int> _cpus; /**< cores the service's threads run on, empty for any. */
+    bool _auto = false; /**< whether the node was picked automatically. */
+  };
+
+  /**
+   * \brief process-wide thread budget: number of OpenMP, BLAS and library threads
+   *        per call, so that concurrent calls do not oversubscribe the cores, and
+   *        optional pinned worker pool
+   */
+  class ThreadBudget
+  {
+  public:
+    ThreadBudget(const int &call_threads,
+		 const int &blas_threads,
+		 const int &pinned_workers);
+    ~ThreadBudget() {}
+
+    /**
+     * \brief process-wide budget, from the command line
+     */
+    static ThreadBudget& get();
+
+    /**
+     * \brief number of threads for a call, from the call's "nthreads" mllib parameter,
+     *        else the service's budget, else the global budget
+     * @param ad_mllib call mllib parameters
+     * @param service_threads service budget, 0 if none
+     * @return number of threads, 0 for library defaults
+     */
+    int call_threads(const APIData &ad_mllib,
+		     const int &service_threads) const;
+
+    /**
+     * \brief runs a call, on the pinned worker pool if any, in the calling thread otherwise
+     */
+    int run(const std::function<int()> &f);
+
+    /**
+     * \brief number of threads granted to the call running in the calling thread,
+     *        0 if unset, for libraries with their own pools (e.g. XGBoost, t-SNE)
+     */
+    static int current();
+
+    /**
+     * \brief sets the number of BLAS threads, process-wide, when supported by the BLAS library
+     */
+    static void set_blas_threads(const int &nthreads);
+
+    /**
+     * \brief places a service from its mllib parameters: "cpuset" (list of cores),
+     *        "numa_node" (node id), or "numa_auto" (least loaded node)
+     * @param ad_mllib service mllib parameters
+     * @param placement service placement
+     */
+    void place(const APIData &ad_mllib,
+	       ServicePlacement &placement);
+
+    /**
+     * \brief releases a service placement, e.g. upon service deletion
+     */
+    void unplace(const ServicePlacement &placement);
+
+    /**
+     * \brief NUMA nodes and their cores, from sysfs, a single node if unavailable
+     */
+    static std::vector<std::vector<int>> numa_nodes();
+
+    /**
+     * \brief online cores, from sysfs, or the NUMA nodes cores if unavailable
+     */
+    static std::vector<int> online_cpus();
+
+    int _call_threads = 0; /**< global per call threads, 0 for library defaults. */
+    std::unique_ptr<PinnedWorkerPool> _pool; /**< pinned workers, if any. */
+    bool _numa_auto = false; /**< whether to spread all services across nodes. */
+    std::vector<std::vector<int>> _nodes; /**< NUMA nodes cores. */
+    std::vector<int> _node_services; /**< number of services placed on every node. */
+    std::mutex _place_mutex;
+  };
+
+  /**
+   * \brief sets the thread budget of the calling thread for the duration of a call,
+   *        and binds the calling thread and its OpenMP threads to the service's placement
+   */
+  class ThreadScope
+  {
+  public:
+    /**
+     * \brief constructor
+     * @param nthreads number of threads, 0 for unchanged, or placement size if any
+     * @param placement service placement, if any
+     */
+    ThreadScope(const int &nthreads,
+		const ServicePlacement &placement=ServicePlacement());
+    ~ThreadScope();
+
+  private:
+    int _prev_omp = 0;
+    int _prev_current = 0;
+    bool _set = false;
+    bool _bound = false;
+    int _nthreads = 0;
+    std::vector<int> _prev_cpus; /**< affinity of the calling thread before binding. */
+  };
+}
+
+#endif
@@ -22,6 +22,7 @@
 #include "tsnelib.h"
 #include "csvinputfileconn.h"
 #include "outputconnectorstrategy.h"
+#include "threadbudget.h"
 #include <thread>
 #include <glog/logging.h>
 
@@ -111,7 +112,7 @@ namespace dd
 	N = inputc._N;
 	D = inputc._D;
 	std::cerr << "N=" << N << " / D=" << D << std::endl;
-	int num_threads = hardware_concurrency();
+	int num_threads = ThreadBudget::current() > 0 ? ThreadBudget::current() : hardware_concurrency();
 	Y = new double[N*_no_dims]; // results
 	for (int i=0;i<N*_no_dims;i++)
 	  Y[i] = 0.0;
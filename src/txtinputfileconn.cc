@@ -22,6 +22,7 @@
 #include "txtinputfileconn.h"
 #include "utils/fileops.hpp"
 #include "utils/utils.hpp"
+#include "utils/datacache.hpp"
 #include <boost/tokenizer.hpp>
 #include <glog/logging.h>
 #include <iostream>
@@ -109,6 +110,21 @@ namespace dd
 	  }
       }
     
+    // parsed dataset cache, if any, for a first training directory only
+    bool cache = _ctfc->_train && _ctfc->_cache && !_ctfc->_model_repo.empty()
+      && _ctfc->_txt.empty() && _ctfc->_vocab.empty();
+    std::string cache_key;
+    if (cache)
+      {
+	cache_key = _ctfc->txt_cache_key(lfiles);
+	if (_ctfc->read_txt_cache(cache_key))
+	  {
+	    write_corresp(hcorresp);
+	    LOG(INFO) << "vocabulary size=" << _ctfc->_vocab.size() << std::endl;
+	    return 0;
+	  }
+      }
+
     // parse content
     // XXX: parallelize with openmp -> requires thread safe parse_content
     for (std::pair<std::string,int> &p: lfiles)
@@ -176,7 +192,18 @@ namespace dd
 	  }
       }
 
-    // write corresp file
+    if (cache)
+      _ctfc->write_txt_cache(cache_key);
+
+    write_corresp(hcorresp);
+
+    LOG(INFO) << "vocabulary size=" << _ctfc->_vocab.size() << std::endl;
+        
+    return 0;
+  }
+
+  void DDTxt::write_corresp(const std::unordered_map<int,std::string> &hcorresp)
+  {
     if (_ctfc->_train)
       {
 	std::ofstream correspf(_ctfc->_model_repo + "/" + _ctfc->_correspname,std::ios::binary);
@@ -187,11 +214,7 @@ namespace dd
 	    ++hit;
 	  }
 	correspf.close();
-      }    
-
-    LOG(INFO) << "vocabulary size=" << _ctfc->_vocab.size() << std::endl;
-        
-    return 0;
+      }
   }
   
   /*- TxtInputFileConn -*/
@@ -343,6 +366,150 @@ namespace dd
     std::cerr << "loaded vocabulary of size=" << _vocab.size() << std::endl;
   }
 
+  /*- parsed dataset cache -*/
+  static const char txt_cache_magic[8] = {'D','D','T','X','T','C','0','1'};
+  enum txt_cache_tag { TXT_CACHE_BOW = 0, TXT_CACHE_CHAR = 1, TXT_CACHE_END = 2 };
+
+  std::string TxtInputFileConn::txt_cache_key(const std::vector<std::pair<std::string,int>> &lfiles) const
+  {
+    std::vector<std::pair<std::string,int>> sfiles = lfiles;
+    std::sort(sfiles.begin(),sfiles.end());
+    std::stringstream sk;
+    for (const std::pair<std::string,int> &f: sfiles)
+      sk << f.first << ":" << f.second << ":" << fileops::file_last_modif(f.first) << ":" << fileops::file_size(f.first) << ";";
+    sk << "count=" << _count << ";tfidf=" << _tfidf << ";min_count=" << _min_count
+       << ";min_word_length=" << _min_word_length << ";sentences=" << _sentences
+       << ";characters=" << _characters;
+    if (_characters)
+      sk << ";alphabet=" << _alphabet_str << ";sequence=" << _sequence << ";read_forward=" << _seq_forward;
+    return sk.str();
+  }
+
+  bool TxtInputFileConn::read_txt_cache(const std::string &key)
+  {
+    std::string cache_fname = _model_repo + "/" + _cache_fname;
+    DataCacheReader cr(cache_fname,txt_cache_magic);
+    if (!cr.is_open())
+      return false;
+
+    // header: key, vocabulary
+    std::string ckey;
+    bool ok = cr.read_str(ckey) && ckey == key;
+    uint64_t nwords = 0;
+    ok = ok && cr.read_size(nwords);
+    std::unordered_map<std::string,Word> vocab;
+    for (uint64_t w=0;ok&&w<nwords;w++)
+      {
+	std::string word;
+	int pos = -1, tcount = 0, tdocs = 0;
+	ok = cr.read_str(word) && cr.read_int(pos) && cr.read_int(tcount) && cr.read_int(tdocs);
+	vocab.emplace(std::make_pair(word,Word(pos,tcount,tdocs)));
+      }
+
+    // check that entries are complete before replaying any of them
+    size_t data_pos = cr._pos;
+    char tag = TXT_CACHE_END;
+    int target = -1;
+    std::string word;
+    std::vector<double> vals;
+    std::vector<uint32_t> chars;
+    while (ok && (ok = cr.read_tag(tag)) && tag != TXT_CACHE_END)
+      {
+	ok = cr.read_int(target);
+	if (ok && tag == TXT_CACHE_BOW)
+	  {
+	    uint64_t n = 0;
+	    ok = cr.read_size(n);
+	    for (uint64_t i=0;ok&&i<n;i++)
+	      ok = cr.read_str(word);
+	    ok = ok && cr.read_vals(vals,true);
+	  }
+	else ok = ok && tag == TXT_CACHE_CHAR && cr.read_vals(chars,true);
+      }
+    if (!ok)
+      {
+	LOG(INFO) << "parsed dataset cache " << cache_fname << " is outdated or incomplete, parsing data again" << std::endl;
+	return false;
+      }
+
+    _vocab = vocab;
+    cr._pos = data_pos;
+    while (cr.read_tag(tag) && tag != TXT_CACHE_END)
+      {
+	cr.read_int(target);
+	if (tag == TXT_CACHE_BOW)
+	  {
+	    uint64_t n = 0;
+	    cr.read_size(n);
+	    std::vector<std::string> words(n);
+	    for (uint64_t i=0;i<n;i++)
+	      cr.read_str(words.at(i));
+	    cr.read_vals(vals);
+	    TxtBowEntry *tbe = new TxtBowEntry(target);
+	    for (size_t i=0;i<words.size()&&i<vals.size();i++)
+	      tbe->_v.insert(std::pair<std::string,double>(words.at(i),vals.at(i)));
+	    _txt.push_back(tbe);
+	  }
+	else
+	  {
+	    TxtCharEntry *tce = new TxtCharEntry(target);
+	    cr.read_vals(tce->_v);
+	    _txt.push_back(tce);
+	  }
+      }
+    LOG(INFO) << "read " << _txt.size() << " text samples from parsed dataset cache " << cache_fname << std::endl;
+    return true;
+  }
+
+  void TxtInputFileConn::write_txt_cache(const std::string &key)
+  {
+    std::string cache_fname = _model_repo + "/" + _cache_fname;
+    DataCacheWriter cache_out(cache_fname,txt_cache_magic);
+    if (!cache_out.is_open())
+      {
+	LOG(WARNING) << "cannot write parsed dataset cache " << cache_fname << std::endl;
+	return;
+      }
+    cache_out.write_str(key);
+    cache_out.write_size(_vocab.size());
+    for (auto const &p: _vocab)
+      {
+	cache_out.write_str(p.first);
+	cache_out.write_int(p.second._pos);
+	cache_out.write_int(p.second._total_count);
+	cache_out.write_int(p.second._total_docs);
+      }
+    for (TxtEntry<double> *te: _txt)
+      {
+	if (!_characters)
+	  {
+	    TxtBowEntry *tbe = static_cast<TxtBowEntry*>(te);
+	    cache_out.write_tag(TXT_CACHE_BOW);
+	    cache_out.write_int(static_cast<int>(tbe->_target));
+	    cache_out.write_size(tbe->_v.size());
+	    std::vector<double> vals;
+	    vals.reserve(tbe->_v.size());
+	    for (auto const &w: tbe->_v)
+	      {
+		cache_out.write_str(w.first);
+		vals.push_back(w.second);
+	      }
+	    cache_out.write_vals(vals);
+	  }
+	else
+	  {
+	    TxtCharEntry *tce = static_cast<TxtCharEntry*>(te);
+	    cache_out.write_tag(TXT_CACHE_CHAR);
+	    cache_out.write_int(static_cast<int>(tce->_target));
+	    cache_out.write_vals(tce->_v);
+	  }
+      }
+    cache_out.write_tag(TXT_CACHE_END);
+    if (!cache_out.commit())
+      LOG(WARNING) << "failed writing parsed dataset cache " << cache_fname << std::endl;
+    else LOG(INFO) << "wrote parsed dataset cache " << cache_fname << std::endl;
+  }
+
   void TxtInputFileConn::build_alphabet()
   {
     _alphabet.clear();
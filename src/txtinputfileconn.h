@@ -43,6 +43,12 @@ namespace dd
     int read_mem(const std::string &content);
     int read_dir(const std::string &dir);
 
+    /**
+     * \brief writes the class correspondence file, in training mode
+     * @param hcorresp class number to class name
+     */
+    void write_corresp(const std::unordered_map<int,std::string> &hcorresp);
+
     TxtInputFileConn *_ctfc = nullptr;
   };
 
@@ -180,7 +186,7 @@ namespace dd
     TxtInputFileConn()
       :InputConnectorStrategy() {}
     TxtInputFileConn(const TxtInputFileConn &i)
-      :InputConnectorStrategy(i),_iterator(i._iterator),_tokenizer(i._tokenizer),_count(i._count),_tfidf(i._tfidf),_min_count(i._min_count),_min_word_length(i._min_word_length),_sentences(i._sentences),_characters(i._characters),_alphabet_str(i._alphabet_str),_alphabet(i._alphabet),_sequence(i._sequence),_seq_forward(i._seq_forward),_vocab(i._vocab) {}
+      :InputConnectorStrategy(i),_iterator(i._iterator),_tokenizer(i._tokenizer),_count(i._count),_tfidf(i._tfidf),_min_count(i._min_count),_min_word_length(i._min_word_length),_sentences(i._sentences),_characters(i._characters),_alphabet_str(i._alphabet_str),_alphabet(i._alphabet),_sequence(i._sequence),_seq_forward(i._seq_forward),_cache(i._cache),_vocab(i._vocab) {}
     ~TxtInputFileConn()
       {
 	destroy_txt_entries(_txt);
@@ -222,6 +228,8 @@ namespace dd
 	_sequence = ad_input.get("sequence").get<int>();
       if (ad_input.has("read_forward"))
 	_seq_forward = ad_input.get("read_forward").get<bool>();
+      if (ad_input.has("cache"))
+	_cache = ad_input.get("cache").get<bool>();
     }
 
     int feature_size() const
@@ -326,6 +334,29 @@ namespace dd
     // alphabet for character-level features
     void build_alphabet();
 
+    /**
+     * \brief key of the parsed dataset cache, from data files path, class, modification
+     *        time and size, and connector parameters that affect parsing
+     * @param lfiles labeled data files
+     * @return cache key
+     */
+    std::string txt_cache_key(const std::vector<std::pair<std::string,int>> &lfiles) const;
+
+    /**
+     * \brief restores vocabulary and text entries from the parsed dataset cache
+     *        in the model repository, if its key matches
+     * @param key expected cache key
+     * @return true if the cache was used, false otherwise
+     */
+    bool read_txt_cache(const std::string &key);
+
+    /**
+     * \brief writes vocabulary and text entries, once post-processed, to the parsed
+     *        dataset cache in the model repository
+     * @param key cache key
+     */
+    void write_txt_cache(const std::string &key);
+
     // clearing up memory
     void destroy_txt_entries(std::vector<TxtEntry<double>*> &v);
     
@@ -345,11 +376,13 @@ namespace dd
     std::unordered_map<uint32_t,int> _alphabet; /**< character-level alphabet. */
     int _sequence = 60; /**< sequence size when using character-level features. */
     bool _seq_forward = false; /**< whether to read character-based sequences forward. */
+    bool _cache = false; /**< whether to cache the parsed training directory in the model repository. */
     
     // internals
     std::unordered_map<std::string,Word> _vocab; /**< string to word stats, including word */
     std::string _vocabfname = "vocab.dat";
     std::string _correspname = "corresp.txt";
+    std::string _cache_fname = "txt_cache.dat"; /**< parsed dataset cache, in model repository */
     
     // data
     std::vector<TxtEntry<double>*> _txt;
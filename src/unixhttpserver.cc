@@ -0,0 +1,415 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unixhttpserver.h"
+#include <glog/logging.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include "utils/utils.hpp"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace dd
+{
+  static const size_t max_header_size = 64 * 1024;
+
+  static std::string reason_phrase(const int &status)
+  {
+    switch(status)
+      {
+      case 200: return "OK";
+      case 201: return "Created";
+      case 400: return "Bad Request";
+      case 403: return "Forbidden";
+      case 404: return "Not Found";
+      case 409: return "Conflict";
+      case 411: return "Length Required";
+      case 413: return "Payload Too Large";
+      case 503: return "Service Unavailable";
+      default: return status < 500 ? "Error" : "Internal Server Error";
+      }
+  }
+
+  UnixHttpServer::UnixHttpServer(const std::string &path,
+				 const handler &h,
+				 const int &max_connections,
+				 const size_t &max_body_size)
+    :_path(path),_handler(h),_max_connections(std::max(1,max_connections)),
+     _max_body_size(max_body_size)
+  {
+  }
+
+  UnixHttpServer::~UnixHttpServer()
+  {
+    stop();
+  }
+
+  int UnixHttpServer::start()
+  {
+    _lfd = listen_socket();
+    if (_lfd < 0)
+      return 1;
+    _accept_thread = std::thread(&UnixHttpServer::accept_loop,this);
+    return 0;
+  }
+
+  int UnixHttpServer::listen_socket()
+  {
+    struct sockaddr_un addr;
+    if (_path.size() >= sizeof(addr.sun_path))
+      {
+	LOG(ERROR) << "unix socket path too long: " << _path << std::endl;
+	return -1;
+      }
+    int lfd = socket(AF_UNIX,SOCK_STREAM,0);
+    if (lfd < 0)
+      {
+	LOG(ERROR) << "failed creating unix socket: " << strerror(errno) << std::endl;
+	return -1;
+      }
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path,_path.c_str(),sizeof(addr.sun_path)-1);
+    unlink(_path.c_str()); // stale socket from a previous run
+    if (bind(lfd,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr)) != 0
+	|| listen(lfd,SOMAXCONN) != 0)
+      {
+	LOG(ERROR) << "failed listening on unix socket " << _path << ": " << strerror(errno) << std::endl;
+	close(lfd);
+	return -1;
+      }
+    LOG(INFO) << "Running DeepDetect HTTP server on unix socket " << _path << std::endl;
+    return lfd;
+  }
+
+  std::string UnixHttpServer::source(const int &fd)
+  {
+    (void)fd;
+    return "unix";
+  }
+
+  void UnixHttpServer::stop()
+  {
+    if (_stop.exchange(true))
+      return;
+    if (_lfd >= 0)
+      shutdown(_lfd,SHUT_RDWR);
+    {
+      // the accept loop may be waiting for a connection slot
+      std::lock_guard<std::mutex> lock(_conns_mutex);
+      _conns_cv.notify_all();
+    }
+    if (_accept_thread.joinable())
+      _accept_thread.join();
+    if (_lfd >= 0)
+      {
+	close(_lfd);
+	if (!_path.empty())
+	  unlink(_path.c_str());
+	_lfd = -1;
+      }
+    std::unique_lock<std::mutex> lock(_conns_mutex);
+    for (int fd: _conns)
+      shutdown(fd,SHUT_RDWR);
+    _conns_cv.wait(lock,[this]{ return _conns.empty(); });
+    _stopped = true;
+    _conns_cv.notify_all();
+  }
+
+  void UnixHttpServer::wait()
+  {
+    std::unique_lock<std::mutex> lock(_conns_mutex);
+    _conns_cv.wait(lock,[this]{ return _stopped; });
+  }
+
+  void UnixHttpServer::accept_loop()
+  {
+    while(!_stop.load())
+      {
+	int fd = accept(_lfd,nullptr,nullptr);
+	if (fd < 0)
+	  {
+	    if (errno == EINTR)
+	      continue;
+	    if (!_stop.load())
+	      LOG(ERROR) << "HTTP server accept failed: " << strerror(errno) << std::endl;
+	    return;
+	  }
+	std::unique_lock<std::mutex> lock(_conns_mutex);
+	_conns_cv.wait(lock,[this]{ return _stop.load() || static_cast<int>(_conns.size()) < _max_connections; });
+	if (_stop.load())
+	  {
+	    close(fd);
+	    return;
+	  }
+	_conns.insert(fd);
+	std::thread(&UnixHttpServer::serve,this,fd).detach();
+      }
+  }
+
+  bool UnixHttpServer::send_all(const int &fd, const std::string &data)
+  {
+    size_t sent = 0;
+    while(sent < data.size())
+      {
+	ssize_t n = send(fd,data.data()+sent,data.size()-sent,MSG_NOSIGNAL);
+	if (n < 0 && errno == EINTR)
+	  continue;
+	if (n <= 0)
+	  return false;
+	sent += n;
+      }
+    return true;
+  }
+
+  void UnixHttpServer::serve(const int &fd)
+  {
+    std::string src = source(fd);
+    std::string buf; // bytes read and not consumed yet, may hold pipelined requests
+    char chunk[65536];
+    bool keep_alive = true;
+    bool unread_body = false;
+    while(keep_alive && !_stop.load())
+      {
+	// request line and headers
+	size_t hend;
+	while((hend = buf.find("\r\n\r\n")) == std::string::npos)
+	  {
+	    if (buf.size() > max_header_size)
+	      {
+		keep_alive = false;
+		break;
+	      }
+	    ssize_t n = recv(fd,chunk,sizeof(chunk),0);
+	    if (n < 0 && errno == EINTR)
+	      continue;
+	    if (n <= 0)
+	      {
+		keep_alive = false;
+		break;
+	      }
+	    buf.append(chunk,n);
+	  }
+	if (!keep_alive)
+	  break;
+
+	std::string method, destination, version;
+	http_headers headers;
+	bool conn_close = false, conn_keep_alive = false;
+	size_t content_length = 0;
+	bool bad_length = false;
+	bool chunked = false;
+	size_t lstart = 0;
+	while(lstart < hend)
+	  {
+	    size_t lend = buf.find("\r\n",lstart);
+	    std::string line = buf.substr(lstart,lend-lstart);
+	    if (lstart == 0)
+	      {
+		size_t s1 = line.find(' ');
+		size_t s2 = line.rfind(' ');
+		method = line.substr(0,s1);
+		if (s1 != std::string::npos && s2 > s1)
+		  {
+		    destination = line.substr(s1+1,s2-s1-1);
+		    version = line.substr(s2+1);
+		  }
+	      }
+	    else
+	      {
+		size_t colon = line.find(':');
+		if (colon != std::string::npos)
+		  {
+		    std::string name = line.substr(0,colon);
+		    size_t vstart = line.find_first_not_of(' ',colon+1);
+		    std::string value = vstart == std::string::npos ? "" : line.substr(vstart);
+		    if (dd_utils::iequals(name,"Content-Length"))
+		      {
+			char *end = nullptr;
+			errno = 0;
+			unsigned long long cl = strtoull(value.c_str(),&end,10);
+			if (value.empty() || *end != '\0' || value[0] == '-' || errno == ERANGE
+			    || cl > std::numeric_limits<size_t>::max())
+			  bad_length = true;
+			else content_length = static_cast<size_t>(cl);
+		      }
+		    else if (dd_utils::iequals(name,"Transfer-Encoding") && value != "identity")
+		      chunked = true;
+		    else if (dd_utils::iequals(name,"Connection"))
+		      {
+			conn_close = dd_utils::iequals(value,"close");
+			conn_keep_alive = dd_utils::iequals(value,"keep-alive");
+		      }
+		    headers.push_back(std::pair<std::string,std::string>(name,value));
+		  }
+	      }
+	    lstart = lend + 2;
+	  }
+	buf.erase(0,hend+4);
+	keep_alive = !conn_close && (version == "HTTP/1.1" || conn_keep_alive);
+
+	int status = 200;
+	std::string reply_body;
+	http_headers reply_headers;
+	if (method.empty() || destination.empty() || chunked || bad_length)
+	  {
+	    status = chunked ? 411 : 400;
+	    keep_alive = false;
+	  }
+	else if (_max_body_size > 0 && content_length > _max_body_size)
+	  {
+	    // rejected before reading, the unread body makes the connection unusable
+	    status = 413;
+	    keep_alive = false;
+	    unread_body = true;
+	  }
+	else
+	  {
+	    // body
+	    while(buf.size() < content_length)
+	      {
+		ssize_t n = recv(fd,chunk,sizeof(chunk),0);
+		if (n < 0 && errno == EINTR)
+		  continue;
+		if (n <= 0)
+		  break;
+		buf.append(chunk,n);
+	      }
+	    if (buf.size() < content_length)
+	      break;
+	    std::string body = buf.substr(0,content_length);
+	    buf.erase(0,content_length);
+	    try
+	      {
+		_handler(src,method,destination,headers,body,status,reply_body,reply_headers);
+	      }
+	    catch (std::exception &e)
+	      {
+		LOG(ERROR) << "HTTP request from " << src << " failed: " << e.what() << std::endl;
+		status = 500;
+		reply_body.clear();
+		reply_headers.clear();
+	      }
+	  }
+
+	std::string out = "HTTP/1.1 " + std::to_string(status) + " " + reason_phrase(status) + "\r\n";
+	for (const auto &h: reply_headers)
+	  out += h.first + ": " + h.second + "\r\n";
+	out += "Content-Length: " + std::to_string(reply_body.size()) + "\r\n";
+	if (!keep_alive)
+	  out += "Connection: close\r\n";
+	out += "\r\n";
+	out += reply_body;
+	if (!send_all(fd,out))
+	  {
+	    unread_body = false;
+	    break;
+	  }
+      }
+    if (unread_body)
+      {
+	// closing with unread data resets the connection, and the client may lose the reply
+	shutdown(fd,SHUT_WR);
+	struct timeval tv = {1,0};
+	setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+	size_t drained = 0;
+	ssize_t n;
+	while(drained < 16 * max_header_size && !_stop.load() && (n = recv(fd,chunk,sizeof(chunk),0)) > 0)
+	  drained += n;
+      }
+    std::lock_guard<std::mutex> lock(_conns_mutex);
+    _conns.erase(fd);
+    close(fd); // under lock, so that stop() never shuts down a reused descriptor
+    _conns_cv.notify_all();
+  }
+
+  /*- TcpHttpServer -*/
+  TcpHttpServer::TcpHttpServer(const std::string &host,
+			       const std::string &port,
+			       const handler &h,
+			       const int &max_connections,
+			       const size_t &max_body_size)
+    :UnixHttpServer("",h,max_connections,max_body_size),_host(host),_port(port)
+  {
+  }
+
+  TcpHttpServer::~TcpHttpServer()
+  {
+    stop(); // before the members the connections use go away
+  }
+
+  int TcpHttpServer::listen_socket()
+  {
+    struct addrinfo hints, *res = nullptr;
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(_host.empty() ? nullptr : _host.c_str(),_port.c_str(),&hints,&res);
+    if (err != 0)
+      {
+	LOG(ERROR) << "failed resolving " << _host << ":" << _port << ": " << gai_strerror(err) << std::endl;
+	return -1;
+      }
+    int lfd = -1;
+    for (struct addrinfo *ai=res;ai!=nullptr;ai=ai->ai_next)
+      {
+	lfd = socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol);
+	if (lfd < 0)
+	  continue;
+	int one = 1;
+	setsockopt(lfd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+	setsockopt(lfd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one)); // inherited by accepted connections
+	if (bind(lfd,ai->ai_addr,ai->ai_addrlen) == 0 && listen(lfd,SOMAXCONN) == 0)
+	  break;
+	close(lfd);
+	lfd = -1;
+      }
+    freeaddrinfo(res);
+    if (lfd < 0)
+      {
+	LOG(ERROR) << "failed listening on " << _host << ":" << _port << ": " << strerror(errno) << std::endl;
+	return -1;
+      }
+    LOG(INFO) << "Running DeepDetect HTTP server on " << _host << ":" << _port << std::endl;
+    return lfd;
+  }
+
+  std::string TcpHttpServer::source(const int &fd)
+  {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char host[NI_MAXHOST];
+    if (getpeername(fd,reinterpret_cast<struct sockaddr*>(&addr),&len) != 0
+	|| getnameinfo(reinterpret_cast<struct sockaddr*>(&addr),len,host,sizeof(host),nullptr,0,NI_NUMERICHOST) != 0)
+      return "";
+    return host;
+  }
+}
@@ -0,0 +1,158 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNIXHTTPSERVER_H
+#define UNIXHTTPSERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace dd
+{
+  typedef std::vector<std::pair<std::string,std::string>> http_headers;
+
+  /**
+   * \brief minimal HTTP/1.1 server on a Unix domain socket, for co-located clients.
+   *        Connections are kept alive and pipelined requests are served in order,
+   *        each connection is served by its own thread.
+   */
+  class UnixHttpServer
+  {
+  public:
+    /**
+     * \brief request handler
+     * @param source client address
+     * @param method HTTP method
+     * @param destination request URI
+     * @param headers request headers
+     * @param body request body
+     * @param status reply status
+     * @param reply_body reply body
+     * @param reply_headers reply headers, besides Content-Length
+     */
+    typedef std::function<void(const std::string &source,
+			       const std::string &method,
+			       const std::string &destination,
+			       const http_headers &headers,
+			       std::string &body,
+			       int &status,
+			       std::string &reply_body,
+			       http_headers &reply_headers)> handler;
+
+    /**
+     * \brief constructor
+     * @param path socket path
+     * @param h request handler
+     * @param max_connections maximum number of simultaneous connections
+     * @param max_body_size maximum request body size in bytes, larger bodies are rejected with 413 (0: unlimited)
+     */
+    UnixHttpServer(const std::string &path,
+		   const handler &h,
+		   const int &max_connections,
+		   const size_t &max_body_size=0);
+    virtual ~UnixHttpServer();
+
+    /**
+     * \brief binds the socket and starts accepting connections in the background
+     * @return 0 if OK, 1 otherwise
+     */
+    int start();
+
+    /**
+     * \brief closes the socket and all connections
+     */
+    void stop();
+
+    /**
+     * \brief blocks until the server is stopped and all connections are closed
+     */
+    void wait();
+
+  protected:
+    /**
+     * \brief creates the listening socket
+     * @return socket, -1 on failure
+     */
+    virtual int listen_socket();
+
+    /**
+     * \brief name of a client, for logging
+     */
+    virtual std::string source(const int &fd);
+
+    std::string _path; /**< socket path. */
+
+  private:
+    void accept_loop();
+    void serve(const int &fd);
+    bool send_all(const int &fd, const std::string &data);
+
+    handler _handler;
+    int _max_connections = 64;
+    size_t _max_body_size = 0; /**< maximum request body size in bytes, 0 for unlimited. */
+    int _lfd = -1; /**< listening socket. */
+    std::atomic<bool> _stop = {false};
+    bool _stopped = false; /**< whether stop() has completed, under the connections lock. */
+    std::thread _accept_thread;
+    std::unordered_set<int> _conns; /**< open connections. */
+    std::mutex _conns_mutex;
+    std::condition_variable _conns_cv;
+  };
+
+  /**
+   * \brief same keep-alive and pipelining HTTP/1.1 server, on a TCP address
+   */
+  class TcpHttpServer : public UnixHttpServer
+  {
+  public:
+    /**
+     * \brief constructor
+     * @param host address to listen on
+     * @param port port to listen on
+     * @param h request handler
+     * @param max_connections maximum number of simultaneous connections
+     * @param max_body_size maximum request body size in bytes, larger bodies are rejected with 413 (0: unlimited)
+     */
+    TcpHttpServer(const std::string &host,
+		  const std::string &port,
+		  const handler &h,
+		  const int &max_connections,
+		  const size_t &max_body_size=0);
+    ~TcpHttpServer();
+
+  protected:
+    virtual int listen_socket();
+    virtual std::string source(const int &fd);
+
+  private:
+    std::string _host;
+    std::string _port;
+  };
+}
+
+#endif
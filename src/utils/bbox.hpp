@@ -0,0 +1,140 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DD_BBOX_H
+#define DD_BBOX_H
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace dd
+{
+  /**
+   * \brief detected object box, in pixels
+   */
+  class bbox
+  {
+  public:
+    bbox() {}
+    bbox(const double &x1, const double &y1, const double &x2, const double &y2,
+	 const double &prob, const std::string &cat)
+      :_xmin(std::min(x1,x2)),_ymin(std::min(y1,y2)),_xmax(std::max(x1,x2)),_ymax(std::max(y1,y2)),
+      _prob(prob),_cat(cat) {}
+    bbox(const double &x1, const double &y1, const double &x2, const double &y2,
+	 const double &prob, const int &label)
+      :_xmin(std::min(x1,x2)),_ymin(std::min(y1,y2)),_xmax(std::max(x1,x2)),_ymax(std::max(y1,y2)),
+      _prob(prob),_label(label) {}
+    ~bbox() {}
+
+    double area() const
+    {
+      return std::max(0.0,_xmax-_xmin) * std::max(0.0,_ymax-_ymin);
+    }
+
+    /**
+     * \brief intersection over union with another box
+     */
+    double iou(const bbox &b) const
+    {
+      double iw = std::min(_xmax,b._xmax) - std::max(_xmin,b._xmin);
+      double ih = std::min(_ymax,b._ymax) - std::max(_ymin,b._ymin);
+      if (iw <= 0.0 || ih <= 0.0)
+	return 0.0;
+      double inter = iw * ih;
+      return inter / (area() + b.area() - inter);
+    }
+
+    bool same_class(const bbox &b) const
+    {
+      return _label == b._label && _cat == b._cat;
+    }
+
+    /**
+     * \brief indices of the boxes with highest probability
+     * @param boxes boxes to select from
+     * @param top_k number of boxes to select, -1 for all
+     * @return indices of the selected boxes, by decreasing probability
+     */
+    static std::vector<size_t> top(const std::vector<bbox> &boxes,
+				   const int &top_k=-1)
+    {
+      std::vector<size_t> order(boxes.size());
+      std::iota(order.begin(),order.end(),0);
+      auto by_prob = [&boxes](const size_t &a, const size_t &b)
+	{ return boxes[a]._prob > boxes[b]._prob; };
+      if (top_k >= 0 && static_cast<size_t>(top_k) < order.size())
+	{
+	  std::partial_sort(order.begin(),order.begin()+top_k,order.end(),by_prob);
+	  order.resize(top_k);
+	}
+      else std::stable_sort(order.begin(),order.end(),by_prob);
+      return order;
+    }
+
+    /**
+     * \brief greedy non-maximum suppression
+     * @param boxes boxes to filter
+     * @param iou_threshold boxes that overlap a better box beyond this threshold are removed
+     * @param per_class whether only boxes of the same category suppress each other
+     * @param top_k maximum number of kept boxes, -1 for no limit
+     * @return indices of the kept boxes, by decreasing probability
+     */
+    static std::vector<size_t> nms(const std::vector<bbox> &boxes,
+				   const double &iou_threshold,
+				   const bool &per_class=true,
+				   const int &top_k=-1)
+    {
+      std::vector<size_t> order = top(boxes);
+      std::vector<size_t> kept;
+      for (size_t i: order)
+	{
+	  if (top_k >= 0 && kept.size() >= static_cast<size_t>(top_k))
+	    break;
+	  bool suppressed = false;
+	  for (size_t k: kept)
+	    {
+	      if (per_class && !boxes[k].same_class(boxes[i]))
+		continue;
+	      if (boxes[k].iou(boxes[i]) > iou_threshold)
+		{
+		  suppressed = true;
+		  break;
+		}
+	    }
+	  if (!suppressed)
+	    kept.push_back(i);
+	}
+      return kept;
+    }
+
+    double _xmin = 0.0;
+    double _ymin = 0.0;
+    double _xmax = 0.0;
+    double _ymax = 0.0;
+    double _prob = 0.0;
+    int _label = -1; /**< class index, -1 if identified by category name only. */
+    std::string _cat;
+  };
+}
+
+#endif
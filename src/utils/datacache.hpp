@@ -0,0 +1,236 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DD_DATACACHE_H
+#define DD_DATACACHE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace dd
+{
+  /**
+   * \brief writer of a parsed dataset cache file: the file is written under a
+   *        temporary name and only renamed into place by commit(), so that readers
+   *        never see an incomplete cache
+   */
+  class DataCacheWriter
+  {
+  public:
+    /**
+     * \brief constructor
+     * @param fname cache file name
+     * @param magic 8 bytes file signature, one per connector and format version
+     */
+    DataCacheWriter(const std::string &fname,
+		    const char *magic)
+      :_fname(fname)
+      {
+	_out.open(_fname + ".tmp",std::ios::binary|std::ios::trunc);
+	if (_out.is_open())
+	  _out.write(magic,8);
+      }
+
+    ~DataCacheWriter()
+      {
+	if (_out.is_open())
+	  {
+	    _out.close();
+	    std::remove((_fname + ".tmp").c_str());
+	  }
+      }
+
+    bool is_open() const { return _out.is_open(); }
+
+    void write_size(const uint64_t &s)
+    {
+      _out.write(reinterpret_cast<const char*>(&s),sizeof(uint64_t));
+    }
+
+    void write_int(const int &v)
+    {
+      int32_t i = v;
+      _out.write(reinterpret_cast<const char*>(&i),sizeof(int32_t));
+    }
+
+    void write_str(const std::string &str)
+    {
+      write_size(str.size());
+      _out.write(str.data(),str.size());
+    }
+
+    template<typename T>
+      void write_vals(const std::vector<T> &vals)
+      {
+	write_size(vals.size());
+	_out.write(reinterpret_cast<const char*>(vals.data()),vals.size()*sizeof(T));
+      }
+
+    void write_tag(const char &tag)
+    {
+      _out.put(tag);
+    }
+
+    /**
+     * \brief completes the cache and moves it into place
+     * @return true on success, the temporary file is removed otherwise
+     */
+    bool commit()
+    {
+      _out.close();
+      if (_out.fail() || std::rename((_fname + ".tmp").c_str(),_fname.c_str()) != 0)
+	{
+	  std::remove((_fname + ".tmp").c_str());
+	  return false;
+	}
+      return true;
+    }
+
+  private:
+    std::string _fname;
+    std::ofstream _out;
+  };
+
+  /**
+   * \brief bounds-checked reader over a memory-mapped parsed dataset cache file
+   */
+  class DataCacheReader
+  {
+  public:
+    /**
+     * \brief constructor, maps the file and checks its signature
+     * @param fname cache file name
+     * @param magic 8 bytes file signature
+     */
+    DataCacheReader(const std::string &fname,
+		    const char *magic)
+      {
+	int fd = open(fname.c_str(),O_RDONLY);
+	if (fd < 0)
+	  return;
+	struct stat bstat;
+	if (fstat(fd,&bstat) != 0 || bstat.st_size <= 8)
+	  {
+	    close(fd);
+	    return;
+	  }
+	void *addr = mmap(nullptr,bstat.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (addr == MAP_FAILED)
+	  return;
+	_data = static_cast<const char*>(addr);
+	_size = bstat.st_size;
+	if (std::memcmp(_data,magic,8) != 0)
+	  {
+	    unmap();
+	    return;
+	  }
+	_pos = 8;
+      }
+
+    ~DataCacheReader()
+      {
+	unmap();
+      }
+
+    /**
+     * \brief whether the file is mapped and has the expected signature
+     */
+    bool is_open() const { return _data != nullptr; }
+
+    bool read_size(uint64_t &s)
+    {
+      if (_pos + sizeof(uint64_t) > _size)
+	return false;
+      std::memcpy(&s,_data+_pos,sizeof(uint64_t));
+      _pos += sizeof(uint64_t);
+      return true;
+    }
+
+    bool read_int(int &v)
+    {
+      int32_t i = 0;
+      if (_pos + sizeof(int32_t) > _size)
+	return false;
+      std::memcpy(&i,_data+_pos,sizeof(int32_t));
+      _pos += sizeof(int32_t);
+      v = i;
+      return true;
+    }
+
+    bool read_str(std::string &str)
+    {
+      uint64_t s = 0;
+      if (!read_size(s) || s > _size - _pos)
+	return false;
+      str.assign(_data+_pos,s);
+      _pos += s;
+      return true;
+    }
+
+    template<typename T>
+      bool read_vals(std::vector<T> &vals, const bool &skip=false)
+      {
+	uint64_t s = 0;
+	if (!read_size(s) || s > (_size - _pos) / sizeof(T))
+	  return false;
+	if (!skip)
+	  {
+	    vals.resize(s);
+	    std::memcpy(vals.data(),_data+_pos,s*sizeof(T));
+	  }
+	_pos += s * sizeof(T);
+	return true;
+      }
+
+    bool read_tag(char &tag)
+    {
+      if (_pos >= _size)
+	return false;
+      tag = _data[_pos++];
+      return true;
+    }
+
+    size_t _pos = 0; /**< read position, can be rewound to replay data. */
+
+  private:
+    void unmap()
+    {
+      if (_data)
+	munmap(const_cast<char*>(_data),_size);
+      _data = nullptr;
+      _size = 0;
+    }
+
+    const char *_data = nullptr;
+    size_t _size = 0;
+  };
+}
+
+#endif
@@ -74,6 +74,14 @@ namespace dd
       else return -1;
     }
 
+    static long int file_size(const std::string &fname)
+    {
+      struct stat bstat;
+      if (stat(fname.c_str(),&bstat)==0)
+	return bstat.st_size;
+      else return -1;
+    }
+
     static int list_directory(const std::string &repo,
 			      const bool &files,
 			      const bool &dirs,
@@ -0,0 +1,170 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DD_SHMSEG_H
+#define DD_SHMSEG_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dd
+{
+  /**
+   * \brief read-only view of a region of a POSIX shared memory segment, filled up
+   *        by a co-located client, from a URI of the form
+   *        shm://name?offset=0&size=1024[&shape=HxWxC&dtype=uint8|float32]
+   *        Without a shape, the region holds an encoded element (e.g. a JPEG image),
+   *        with a shape it holds a raw tensor.
+   */
+  class ShmSegment
+  {
+  public:
+    ShmSegment(const std::string &uri)
+    {
+      static const std::string scheme = "shm://";
+      if (uri.compare(0,scheme.size(),scheme) != 0)
+	throw std::runtime_error("not a shared memory uri: " + uri);
+      std::string rest = uri.substr(scheme.size());
+      size_t q = rest.find('?');
+      _name = "/" + rest.substr(0,q);
+      long int size = -1;
+      if (q != std::string::npos)
+	{
+	  std::string query = rest.substr(q+1);
+	  size_t start = 0;
+	  while(start < query.size())
+	    {
+	      size_t end = query.find('&',start);
+	      if (end == std::string::npos)
+		end = query.size();
+	      std::string kv = query.substr(start,end-start);
+	      size_t eq = kv.find('=');
+	      std::string key = kv.substr(0,eq);
+	      std::string val = eq == std::string::npos ? "" : kv.substr(eq+1);
+	      try
+		{
+		  if (key == "offset")
+		    _offset = std::stol(val);
+		  else if (key == "size")
+		    size = std::stol(val);
+		  else if (key == "dtype")
+		    _dtype = val;
+		  else if (key == "shape")
+		    {
+		      size_t s = 0;
+		      while(s <= val.size())
+			{
+			  size_t x = val.find('x',s);
+			  if (x == std::string::npos)
+			    x = val.size();
+			  _shape.push_back(std::stoi(val.substr(s,x-s)));
+			  s = x + 1;
+			}
+		    }
+		}
+	      catch (std::exception &e)
+		{
+		  throw std::runtime_error("bad shared memory uri parameter " + kv);
+		}
+	      start = end + 1;
+	    }
+	}
+      if (_dtype != "uint8" && _dtype != "float32")
+	throw std::runtime_error("unsupported shared memory dtype " + _dtype);
+      if (_offset < 0)
+	throw std::runtime_error("negative shared memory offset");
+
+      int fd = shm_open(_name.c_str(),O_RDONLY,0);
+      if (fd < 0)
+	throw std::runtime_error("failed opening shared memory segment " + _name);
+      struct stat st;
+      if (fstat(fd,&st) != 0)
+	{
+	  close(fd);
+	  throw std::runtime_error("failed reading shared memory segment " + _name);
+	}
+      if (size < 0)
+	size = st.st_size - _offset;
+      if (!_shape.empty())
+	{
+	  long int tsize = _dtype == "float32" ? 4 : 1;
+	  for (int d: _shape)
+	    tsize *= d;
+	  if (size < tsize)
+	    size = tsize;
+	}
+      if (size <= 0 || _offset + size > st.st_size)
+	{
+	  close(fd);
+	  throw std::runtime_error("region out of shared memory segment " + _name);
+	}
+      _size = size;
+
+      // mapping starts on a page boundary
+      long int page = sysconf(_SC_PAGESIZE);
+      long int moffset = (_offset / page) * page;
+      _map_size = _size + (_offset - moffset);
+      _map = mmap(nullptr,_map_size,PROT_READ,MAP_SHARED,fd,moffset);
+      close(fd);
+      if (_map == MAP_FAILED)
+	{
+	  _map = nullptr;
+	  throw std::runtime_error("failed mapping shared memory segment " + _name);
+	}
+      _data = static_cast<const char*>(_map) + (_offset - moffset);
+    }
+
+    ~ShmSegment()
+    {
+      if (_map)
+	munmap(_map,_map_size);
+    }
+
+    ShmSegment(const ShmSegment&) = delete;
+    ShmSegment& operator=(const ShmSegment&) = delete;
+
+    static bool is_shm(const std::string &uri)
+    {
+      return uri.compare(0,6,"shm://") == 0;
+    }
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    std::string _name; /**< segment name. */
+    long int _offset = 0; /**< region offset in the segment, in bytes. */
+    std::vector<int> _shape; /**< raw tensor shape, empty for an encoded element. */
+    std::string _dtype = "uint8"; /**< raw tensor type. */
+
+  private:
+    void *_map = nullptr;
+    size_t _map_size = 0;
+    const char *_data = nullptr;
+    size_t _size = 0;
+  };
+}
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "workerpool.h"
+#include <glog/logging.h>
+#include <algorithm>
+
+namespace dd
+{
+  WorkerPool::WorkerPool(const int &nworkers,
+			 const int &max_queued,
+			 const std::function<void(const int&)> &init)
+    :_init(init),_max_queued(std::max(0,max_queued))
+  {
+    for (int w=0;w<std::max(1,nworkers);w++)
+      _workers.push_back(std::thread(&WorkerPool::work,this,w));
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (std::thread &t: _workers)
+      t.join();
+  }
+
+  bool WorkerPool::try_submit(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_stop || (_max_queued > 0 && _tasks.size() >= _max_queued))
+	return false;
+      _tasks.push(std::move(task));
+    }
+    _cv.notify_one();
+    return true;
+  }
+
+  size_t WorkerPool::queued()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _tasks.size();
+  }
+
+  void WorkerPool::work(const int &w)
+  {
+    if (_init)
+      _init(w);
+    while(true)
+      {
+	std::function<void()> task;
+	{
+	  std::unique_lock<std::mutex> lock(_mutex);
+	  _cv.wait(lock,[this]{ return _stop || !_tasks.empty(); });
+	  if (_stop && _tasks.empty())
+	    return;
+	  task = std::move(_tasks.front());
+	  _tasks.pop();
+	}
+	try
+	  {
+	    task();
+	  }
+	catch (std::exception &e)
+	  {
+	    LOG(ERROR) << "worker task failed: " << e.what() << std::endl;
+	  }
+      }
+  }
+}
@@ -0,0 +1,82 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace dd
+{
+  /**
+   * \brief fixed pool of workers with a bounded queue of tasks, tasks are
+   *        fire-and-forget and report their results by themselves
+   */
+  class WorkerPool
+  {
+  public:
+    /**
+     * \brief constructor
+     * @param nworkers number of workers
+     * @param max_queued maximum number of queued tasks, 0 for unbounded
+     * @param init run by every worker with its index before it takes tasks, e.g. for pinning
+     */
+    WorkerPool(const int &nworkers,
+	       const int &max_queued,
+	       const std::function<void(const int&)> &init=nullptr);
+    ~WorkerPool();
+
+    /**
+     * \brief queues a task, without blocking
+     * @param task task to run on a worker
+     * @return false if the queue is full and the task was not queued
+     */
+    bool try_submit(std::function<void()> task);
+
+    /**
+     * \brief number of tasks waiting for a worker
+     */
+    size_t queued();
+
+    /**
+     * \brief number of workers
+     */
+    int size() const { return static_cast<int>(_workers.size()); }
+
+  private:
+    void work(const int &w);
+
+    std::vector<std::thread> _workers;
+    std::function<void(const int&)> _init; /**< worker initialization, if any. */
+    std::queue<std::function<void()>> _tasks;
+    size_t _max_queued = 0; /**< queue bound, 0 for unbounded. */
+    bool _stop = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+  };
+}
+
+#endif
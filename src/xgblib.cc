@@ -22,6 +22,7 @@
 #include "xgblib.h"
 #include "csvinputfileconn.h"
 #include "outputconnectorstrategy.h"
+#include "threadbudget.h"
 #include <iomanip>
 #include <iostream>
 
@@ -148,6 +149,8 @@ namespace dd
       add_cfg_param("base_score",base_score);
       add_cfg_param("eval_metric",eval_metric);
       add_cfg_param("seed",seed);
+      if (ThreadBudget::current() > 0)
+	add_cfg_param("nthread",ThreadBudget::current());
       if (_objective == "multi:softmax")
 	throw MLLibBadParamException("use multi:softprob objective instead of multi:softmax");
       else if (_objective == "reg:linear" || _objective == "reg:logistic")
@@ -509,6 +512,10 @@ namespace dd
     ad_res.add("iteration",this->get_meas("iteration"));
     //ad_res.add("train_loss",this->get_meas("train_loss")); //TODO: can't acquire the loss yet.
     APIData ad_out = ad.getobj("parameters").getobj("output");
+    std::vector<std::string> measures;
+    if (ad_out.has("measure"))
+      measures = ad_out.get("measure").get<std::vector<std::string>>();
+    SupervisedOutput::measure_accumulator macc(measures,_nclasses,_regression);
     if (ad_out.has("measure"))
       {
 	int nout = _nclasses;
@@ -525,29 +532,27 @@ namespace dd
 	  batch_size /= _nclasses;
 	else if (_objective == "binary:logistic")
 	  nclasses--;
-	for (int k=0;k<batch_size;k++)
+	const std::vector<float> &labels = dtest->info().labels;
+	std::vector<float> targets(labels.begin(),labels.begin()+batch_size);
+	if (_objective == "binary:logistic")
 	  {
-	    APIData bad;
-	    std::vector<double> predictions;
-	    for (int c=0;c<nclasses;c++)
+	    // expand to two-class predictions
+	    std::vector<float> preds2(2*batch_size);
+	    for (int k=0;k<batch_size;k++)
 	      {
-		predictions.push_back(out_preds.at(k*nclasses+c));
+		preds2[2*k] = 1.0-out_preds.at(k);
+		preds2[2*k+1] = out_preds.at(k);
 	      }
-	    if (_objective == "binary:logistic")
-	      predictions.insert(predictions.begin(),1.0-predictions.back());
-	    bad.add("target",dtest->info().labels.at(k));
-	    bad.add("pred",predictions);
-	    ad_res.add(std::to_string(k),bad);
+	    macc.add_batch(preds2.data(),2,2,targets);
 	  }
+	else macc.add_batch(out_preds.data(),nclasses,nclasses,targets);
 	std::vector<std::string> clnames;
 	for (int i=0;i<nout;i++)
 	  clnames.push_back(std::to_string(i));
 	ad_res.add("clnames",clnames);
 	ad_res.add("batch_size",batch_size);
-	if (_regression)
-	  ad_res.add("regression",_regression);
       }
-    SupervisedOutput::measure(ad_res,ad_out,out);
+    SupervisedOutput::measure(macc,ad_res,ad_out,out);
   }
   
   template class XGBLib<CSVXGBInputFileConn,SupervisedOutput,XGBModel>;
@@ -0,0 +1,265 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "apidata.h"
+#include "imginputfileconn.h"
+#include "csvinputfileconn.h"
+#include "txtinputfileconn.h"
+#include "outputconnectorstrategy.h"
+#include "jsonapi.h"
+#include <benchmark/benchmark.h>
+#include <random>
+
+using namespace dd;
+
+// synthetic inputs
+
+static std::string synthetic_jpeg(const int &width,
+				  const int &height)
+{
+  cv::Mat img(height,width,CV_8UC3);
+  cv::randu(img,cv::Scalar::all(0),cv::Scalar::all(255));
+  std::vector<unsigned char> buf;
+  cv::imencode(".jpg",img,buf);
+  return std::string(buf.begin(),buf.end());
+}
+
+static std::string synthetic_csv_line(const int &ncols)
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> dis(-1000.0,1000.0);
+  std::string line;
+  for (int c=0;c<ncols;c++)
+    {
+      if (c > 0)
+	line += ",";
+      line += std::to_string(dis(gen));
+    }
+  return line;
+}
+
+static std::string synthetic_text(const int &nwords)
+{
+  static std::vector<std::string> words = {"the","deep","learning","server","predicts","images","text","and","numbers","with","neural","networks","over","an","api"};
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dis(0,words.size()-1);
+  std::string txt;
+  for (int w=0;w<nwords;w++)
+    txt += words.at(dis(gen)) + (w % 12 == 11 ? ". " : " ");
+  return txt;
+}
+
+static std::vector<APIData> synthetic_results(const int &nresults,
+					      const int &nclasses)
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> dis(0.0,1.0);
+  std::vector<std::string> cats;
+  for (int c=0;c<nclasses;c++)
+    cats.push_back("class_" + std::to_string(c));
+  std::vector<APIData> vrad;
+  for (int r=0;r<nresults;r++)
+    {
+      std::vector<double> probs;
+      for (int c=0;c<nclasses;c++)
+	probs.push_back(dis(gen));
+      APIData rad;
+      rad.add("uri",std::to_string(r));
+      rad.add("loss",0.0);
+      rad.add("probs",probs);
+      rad.add("cats",cats);
+      vrad.push_back(rad);
+    }
+  return vrad;
+}
+
+static std::string synthetic_predict_call(const int &ndata)
+{
+  std::string jstr = "{\"service\":\"bench\",\"parameters\":{\"input\":{\"width\":224,\"height\":224},\"output\":{\"best\":5},\"mllib\":{\"gpu\":true}},\"data\":[";
+  for (int d=0;d<ndata;d++)
+    {
+      if (d > 0)
+	jstr += ",";
+      jstr += "\"http://example.com/images/img_" + std::to_string(d) + ".jpg\"";
+    }
+  jstr += "]}";
+  return jstr;
+}
+
+// input connectors
+
+static void BM_DDImg_decode(benchmark::State &state)
+{
+  std::string jpeg = synthetic_jpeg(state.range(0),state.range(0));
+  DDImg dimg;
+  dimg._width = 224;
+  dimg._height = 224;
+  while (state.KeepRunning())
+    {
+      dimg.decode(jpeg);
+      state.PauseTiming();
+      dimg._imgs.clear();
+      dimg._imgs_size.clear();
+      state.ResumeTiming();
+    }
+  state.SetBytesProcessed(state.iterations() * jpeg.size());
+}
+BENCHMARK(BM_DDImg_decode)->Arg(256)->Arg(640)->Arg(1920);
+
+static void BM_CSVInputFileConn_read_csv_line(benchmark::State &state)
+{
+  std::string line = synthetic_csv_line(state.range(0));
+  CSVInputFileConn cifc;
+  std::string column_id;
+  int nlines = 0;
+  while (state.KeepRunning())
+    {
+      std::vector<double> vals;
+      cifc.read_csv_line(line,cifc._delim,vals,column_id,nlines);
+      benchmark::DoNotOptimize(vals.data());
+    }
+  state.SetBytesProcessed(state.iterations() * line.size());
+}
+BENCHMARK(BM_CSVInputFileConn_read_csv_line)->Arg(16)->Arg(64)->Arg(512);
+
+static void BM_TxtInputFileConn_parse_content(benchmark::State &state)
+{
+  std::string txt = synthetic_text(state.range(0));
+  TxtInputFileConn tifc;
+  tifc._train = true;
+  tifc._sentences = state.range(1);
+  while (state.KeepRunning())
+    {
+      tifc.parse_content(txt,1);
+      state.PauseTiming();
+      tifc.destroy_txt_entries(tifc._txt);
+      state.ResumeTiming();
+    }
+  state.SetBytesProcessed(state.iterations() * txt.size());
+}
+BENCHMARK(BM_TxtInputFileConn_parse_content)->Args({100,0})->Args({5000,0})->Args({5000,1});
+
+// data objects
+
+static void BM_APIData_fromJVal(benchmark::State &state)
+{
+  std::string jstr = synthetic_predict_call(state.range(0));
+  JDoc d;
+  d.Parse(jstr.c_str());
+  while (state.KeepRunning())
+    {
+      APIData ad(d);
+      benchmark::DoNotOptimize(ad);
+    }
+}
+BENCHMARK(BM_APIData_fromJVal)->Arg(1)->Arg(64)->Arg(1024);
+
+static void BM_APIData_toJDoc(benchmark::State &state)
+{
+  SupervisedOutput so;
+  so._best = 5;
+  so.add_results(synthetic_results(state.range(0),1000));
+  APIData ad_out;
+  so.to_ad(ad_out,false,false);
+  while (state.KeepRunning())
+    {
+      JDoc jd;
+      jd.SetObject();
+      ad_out.toJDoc(jd);
+      benchmark::DoNotOptimize(jd);
+    }
+}
+BENCHMARK(BM_APIData_toJDoc)->Arg(1)->Arg(64);
+
+// output connector
+
+static void BM_SupervisedOutput_add_results(benchmark::State &state)
+{
+  std::vector<APIData> vrad = synthetic_results(state.range(0),state.range(1));
+  while (state.KeepRunning())
+    {
+      SupervisedOutput so;
+      so.add_results(vrad);
+      benchmark::DoNotOptimize(so._vvcats.data());
+    }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SupervisedOutput_add_results)->Args({1,1000})->Args({64,10})->Args({64,1000});
+
+static void BM_SupervisedOutput_best_cats(benchmark::State &state)
+{
+  SupervisedOutput so;
+  so._best = 5;
+  so.add_results(synthetic_results(state.range(0),state.range(1)));
+  APIData ad_out;
+  while (state.KeepRunning())
+    {
+      SupervisedOutput bcats(so);
+      so.best_cats(ad_out,bcats,state.range(1),false);
+      benchmark::DoNotOptimize(bcats._vvcats.data());
+    }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SupervisedOutput_best_cats)->Args({1,1000})->Args({64,10})->Args({64,1000});
+
+static void BM_SupervisedOutput_to_ad(benchmark::State &state)
+{
+  SupervisedOutput so;
+  so._best = 5;
+  SupervisedOutput bcats(so);
+  so.add_results(synthetic_results(state.range(0),1000));
+  so.best_cats(APIData(),bcats,1000,false);
+  while (state.KeepRunning())
+    {
+      APIData ad_out;
+      bcats.to_ad(ad_out,false,false);
+      benchmark::DoNotOptimize(ad_out);
+    }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SupervisedOutput_to_ad)->Arg(1)->Arg(64);
+
+// rendering
+
+static void BM_JsonAPI_jrender(benchmark::State &state)
+{
+  SupervisedOutput so;
+  so._best = state.range(1);
+  so.add_results(synthetic_results(state.range(0),1000));
+  APIData ad_out;
+  so.finalize(APIData(),ad_out);
+  JsonAPI japi;
+  JDoc jd = japi.dd_ok_200();
+  JVal jout(rapidjson::kObjectType);
+  ad_out.toJVal(jd,jout);
+  jd.AddMember("body",jout,jd.GetAllocator());
+  size_t rendered = 0;
+  while (state.KeepRunning())
+    {
+      std::string jstr = japi.jrender(jd);
+      benchmark::DoNotOptimize(jstr.data());
+      rendered += jstr.size();
+    }
+  state.SetBytesProcessed(rendered);
+}
+BENCHMARK(BM_JsonAPI_jrender)->Args({1,5})->Args({64,5})->Args({64,1000});
+
+BENCHMARK_MAIN();
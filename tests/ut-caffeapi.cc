@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fstream>
 #include <iostream>
 
 using namespace dd;
@@ -339,6 +340,29 @@ TEST(caffeapi,service_predict)
   std::cerr << "uri=" << uri << std::endl;
   ASSERT_EQ("0",uri);
 
+  // predict with per-layer profile
+  jpredictstr = "{\"service\":\""+ sname + "\",\"parameters\":{\"input\":{\"bw\":true,\"width\":28,\"height\":28},\"mllib\":{\"profile\":true,\"profile_iterations\":2}},\"data\":[\"" + mnist_repo + "/sample_digit.png\"]}";
+  joutstr = japi.jrender(japi.service_predict(jpredictstr));
+  std::cout << "joutstr=" << joutstr << std::endl;
+  jd.Parse(joutstr.c_str());
+  ASSERT_TRUE(!jd.HasParseError());
+  ASSERT_EQ(200,jd["status"]["code"]);
+  ASSERT_TRUE(jd["body"]["predictions"].IsArray());
+  ASSERT_TRUE(jd["body"]["profile"]["layers"].IsArray());
+  ASSERT_TRUE(jd["body"]["profile"]["layers"].Size() > 0);
+  ASSERT_TRUE(jd["body"]["profile"]["time"].GetDouble() >= 0.0);
+  ASSERT_TRUE(jd["body"]["profile"]["memory"].GetDouble() > 0.0);
+
+  // benchmark, no data required
+  jpredictstr = "{\"service\":\""+ sname + "\",\"parameters\":{\"mllib\":{\"benchmark\":{\"batch_size\":16,\"iterations\":2}}}}";
+  joutstr = japi.jrender(japi.service_predict(jpredictstr));
+  std::cout << "joutstr=" << joutstr << std::endl;
+  jd.Parse(joutstr.c_str());
+  ASSERT_TRUE(!jd.HasParseError());
+  ASSERT_EQ(200,jd["status"]["code"]);
+  ASSERT_EQ(16,jd["body"]["profile"]["batch_size"].GetInt());
+  ASSERT_TRUE(jd["body"]["profile"]["layers"].Size() > 0);
+
   // predict non existing image
   jpredictstr = "{\"service\":\""+ sname + "\",\"parameters\":{\"input\":{\"bw\":true,\"width\":28,\"height\":28},\"output\":{\"best\":3}},\"data\":[\"http://example.com/my_image.png\"]}";
   joutstr = japi.jrender(japi.service_predict(jpredictstr));
@@ -355,7 +379,55 @@ TEST(caffeapi,service_predict)
   ASSERT_TRUE(!jd.HasParseError());
   ASSERT_EQ(200,jd["status"]["code"]);
   ASSERT_TRUE(jd["body"]["measure"]["f1"].GetDouble() > 0.0);
-  
+
+  // predict from a service with preallocated batch buckets, 2 images padded to 4
+  std::string sname_buckets = "my_service_buckets";
+  jstr = "{\"mllib\":\"caffe\",\"description\":\"my classifier\",\"type\":\"supervised\",\"model\":{\"repository\":\"" +  mnist_repo + "\"},\"parameters\":{\"input\":{\"connector\":\"image\"},\"mllib\":{\"nclasses\":10,\"batch_buckets\":[1,4]}}}";
+  joutstr = japi.jrender(japi.service_create(sname_buckets,jstr));
+  ASSERT_EQ(created_str,joutstr);
+  jpredictstr = "{\"service\":\""+ sname_buckets + "\",\"parameters\":{\"input\":{\"bw\":true,\"width\":28,\"height\":28},\"output\":{\"best\":3}},\"data\":[\"" + mnist_repo + "/sample_digit.png\",\"" + mnist_repo + "/sample_digit2.png\"]}";
+  joutstr = japi.jrender(japi.service_predict(jpredictstr));
+  std::cout << "joutstr=" << joutstr << std::endl;
+  jd.Parse(joutstr.c_str());
+  ASSERT_TRUE(!jd.HasParseError());
+  ASSERT_EQ(200,jd["status"]["code"]);
+  ASSERT_EQ(2,jd["body"]["predictions"].Size());
+  for (rapidjson::SizeType i=0;i<jd["body"]["predictions"].Size();i++)
+    ASSERT_TRUE(jd["body"]["predictions"][i]["classes"][0]["prob"].GetDouble() > 0);
+  joutstr = japi.jrender(japi.service_delete(sname_buckets,""));
+  ASSERT_EQ(ok_str,joutstr);
+
+  // predict one image per batch on two CPU workers, six batches interleave over
+  // the workers and results come back in input order
+  std::vector<std::string> wuris;
+  std::string jwdata;
+  for (int i=0;i<6;i++)
+    {
+      std::string wuri = mnist_repo + "/cpu_workers_digit" + std::to_string(i) + ".png";
+      std::ifstream src(mnist_repo + (i % 2 ? "/sample_digit2.png" : "/sample_digit.png"),std::ios::binary);
+      std::ofstream dst(wuri,std::ios::binary);
+      dst << src.rdbuf();
+      wuris.push_back(wuri);
+      jwdata += (i ? ",\"" : "\"") + wuri + "\"";
+    }
+  jpredictstr = "{\"service\":\""+ sname + "\",\"parameters\":{\"input\":{\"bw\":true,\"width\":28,\"height\":28},\"mllib\":{\"gpu\":false,\"cpu_workers\":2,\"net\":{\"test_batch_size\":1}},\"output\":{\"best\":3}},\"data\":[" + jwdata + "]}";
+  joutstr = japi.jrender(japi.service_predict(jpredictstr));
+  std::cout << "joutstr=" << joutstr << std::endl;
+  for (const std::string &wuri: wuris)
+    remove(wuri.c_str());
+  jd.Parse(joutstr.c_str());
+  ASSERT_TRUE(!jd.HasParseError());
+  ASSERT_EQ(200,jd["status"]["code"]);
+  ASSERT_EQ(6,jd["body"]["predictions"].Size());
+  for (rapidjson::SizeType i=0;i<jd["body"]["predictions"].Size();i++)
+    {
+      ASSERT_EQ(wuris.at(i),std::string(jd["body"]["predictions"][i]["uri"].GetString()));
+      ASSERT_TRUE(jd["body"]["predictions"][i]["classes"][0]["prob"].GetDouble() > 0);
+      if (i >= 2) // same image, same result
+	ASSERT_EQ(std::string(jd["body"]["predictions"][i-2]["classes"][0]["cat"].GetString()),
+		  std::string(jd["body"]["predictions"][i]["classes"][0]["cat"].GetString()));
+    }
+
   // remove service
   jstr = "{\"clear\":\"lib\"}";
   joutstr = japi.jrender(japi.service_delete(sname,jstr));
@@ -453,6 +525,40 @@ TEST(caffeapi,service_train_csv)
   ASSERT_TRUE(!fileops::remove_directory_files(forest_repo,{".prototxt"}));
 }
 
+TEST(caffeapi,service_train_csv_prefetch)
+{
+  // create service
+  JsonAPI japi;
+  std::string sname = "my_service";
+  std::string jstr = "{\"mllib\":\"caffe\",\"description\":\"my classifier\",\"type\":\"supervised\",\"model\":{\"repository\":\"" +  forest_repo + "\",\"templates\":\"" + model_templates_repo  + "\"},\"parameters\":{\"input\":{\"connector\":\"csv\"},\"mllib\":{\"template\":\"mlp\",\"nclasses\":7}}}";
+  std::string joutstr = japi.jrender(japi.service_create(sname,jstr));
+  ASSERT_EQ(created_str,joutstr);
+
+  // train, mini-batches are pulled from the CSV connector
+  std::string jtrainstr = "{\"service\":\"" + sname + "\",\"async\":false,\"parameters\":{\"input\":{\"label\":\"Cover_Type\",\"id\":\"Id\",\"scale\":true,\"test_split\":0.1,\"label_offset\":-1,\"shuffle\":true},\"mllib\":{\"gpu\":false,\"prefetch\":true,\"solver\":{\"iterations\":" + iterations_forest + ",\"base_lr\":0.05},\"net\":{\"batch_size\":512}},\"output\":{\"measure\":[\"acc\",\"mcll\",\"f1\"]}},\"data\":[\"" + forest_repo + "train.csv\"]}";
+  joutstr = japi.jrender(japi.service_train(jtrainstr));
+  std::cout << "joutstr=" << joutstr << std::endl;
+  JDoc jd;
+  jd.Parse(joutstr.c_str());
+  ASSERT_TRUE(!jd.HasParseError());
+  ASSERT_EQ(201,jd["status"]["code"].GetInt());
+  ASSERT_TRUE(fabs(jd["body"]["measure"]["train_loss"].GetDouble()) > 0.0);
+  ASSERT_TRUE(jd["body"]["measure"]["f1"].GetDouble() > 0.5);
+  ASSERT_EQ(504,jd["body"]["parameters"]["mllib"]["batch_size"].GetInt());
+
+  // prefetch does not combine with CPU workers
+  jtrainstr = "{\"service\":\"" + sname + "\",\"async\":false,\"parameters\":{\"input\":{\"label\":\"Cover_Type\",\"id\":\"Id\",\"scale\":true,\"label_offset\":-1},\"mllib\":{\"gpu\":false,\"prefetch\":true,\"cpu_workers\":2,\"solver\":{\"iterations\":10},\"net\":{\"batch_size\":512}}},\"data\":[\"" + forest_repo + "train.csv\"]}";
+  joutstr = japi.jrender(japi.service_train(jtrainstr));
+  jd.Parse(joutstr.c_str());
+  ASSERT_EQ(400,jd["status"]["code"].GetInt());
+
+  // remove service
+  jstr = "{\"clear\":\"lib\"}";
+  joutstr = japi.jrender(japi.service_delete(sname,jstr));
+  ASSERT_EQ(ok_str,joutstr);
+  ASSERT_TRUE(!fileops::remove_directory_files(forest_repo,{".prototxt"}));
+}
+
 TEST(caffeapi,service_train_csv_in_memory)
 {
   // create service
@@ -24,9 +24,14 @@
 #include "csvinputfileconn.h"
 #include "txtinputfileconn.h"
 #include "outputconnectorstrategy.h"
+#include "utils/bbox.hpp"
+#include "utils/fileops.hpp"
 #include "jsonapi.h"
 #include <gtest/gtest.h>
 #include <iostream>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 using namespace dd;
 
@@ -196,6 +201,68 @@ TEST(outputconn,cmfull)
 
 }
 
+TEST(outputconn,measure_accumulator)
+{
+  std::vector<float> targets = {0, 0, 1, 2};
+  std::vector<float> preds = {0.7, 0.1, 0.1, 0.1,
+			      0.3, 0.5, 0.1, 0.1,
+			      0.1, 0.9, 0.0, 0.0,
+			      0.1, 0.7, 0.05, 0.15};
+  std::vector<std::string> measures = {"acc","acc-2","f1","mcll"};
+  APIData res_ad;
+  res_ad.add("nclasses",4);
+  res_ad.add("batch_size",static_cast<int>(targets.size()));
+  for (size_t i=0;i<targets.size();i++)
+    {
+      APIData bad;
+      bad.add("pred",std::vector<double>(preds.begin()+4*i,preds.begin()+4*(i+1)));
+      bad.add("target",static_cast<double>(targets.at(i)));
+      std::vector<APIData> vad = {bad};
+      res_ad.add(std::to_string(i),vad);
+    }
+  APIData ad_out;
+  ad_out.add("measure",measures);
+  APIData out;
+  SupervisedOutput::measure(res_ad,ad_out,out);
+  APIData meas_out = out.getobj("measure");
+
+  // fed in two batches, merged
+  SupervisedOutput::measure_accumulator macc(measures,4,false);
+  SupervisedOutput::measure_accumulator macc2 = macc.empty();
+  macc.add_batch(&preds.front(),4,4,std::vector<float>(targets.begin(),targets.begin()+2));
+  macc2.add_batch(&preds.front()+8,4,4,std::vector<float>(targets.begin()+2,targets.end()));
+  macc.merge(macc2);
+  APIData out_acc;
+  SupervisedOutput::measure(macc,APIData(),ad_out,out_acc);
+  APIData meas_acc = out_acc.getobj("measure");
+  ASSERT_EQ(0.5,meas_acc.get("acc").get<double>());
+  ASSERT_EQ(0.75,meas_acc.get("acc-2").get<double>());
+  for (std::string m: {"acc","acc-2","f1","precision","recall","accp","mcll"})
+    ASSERT_NEAR(meas_out.get(m).get<double>(),meas_acc.get(m).get<double>(),1e-6);
+}
+
+TEST(outputconn,bbox_nms)
+{
+  std::vector<bbox> boxes = { bbox(0,0,10,10,0.9,1),
+			      bbox(1,1,11,11,0.8,1), // overlaps the first box
+			      bbox(1,1,11,11,0.7,2), // overlaps as well, other class
+			      bbox(50,50,60,60,0.95,1) };
+  std::vector<size_t> kept = bbox::nms(boxes,0.5);
+  ASSERT_EQ(3,kept.size());
+  ASSERT_EQ(3,kept.at(0));
+  ASSERT_EQ(0,kept.at(1));
+  ASSERT_EQ(2,kept.at(2));
+  kept = bbox::nms(boxes,0.5,false); // across classes
+  ASSERT_EQ(2,kept.size());
+  kept = bbox::nms(boxes,0.5,true,1);
+  ASSERT_EQ(1,kept.size());
+  ASSERT_EQ(3,kept.at(0));
+  kept = bbox::top(boxes,2);
+  ASSERT_EQ(2,kept.size());
+  ASSERT_EQ(0,kept.at(1));
+  ASSERT_NEAR(81.0/119.0,boxes.at(0).iou(boxes.at(1)),1e-9);
+}
+
 TEST(inputconn,img)
 {
   std::string mnist_repo = "../examples/caffe/mnist/";
@@ -224,6 +291,133 @@ TEST(inputconn,img)
     ASSERT_TRUE(cv::countNonZero(channels.at(i))==0); // the two images must be identical
 }
 
+TEST(inputconn,img_mem)
+{
+  std::string uri;
+  {
+    std::vector<cv::Mat> imgs = { cv::Mat(40,30,CV_8UC3,cv::Scalar(0,0,255)) };
+    MemImages mimgs(std::move(imgs));
+    std::vector<cv::Mat> crops = { mimgs.at(0)(cv::Rect(5,5,10,20)) };
+    MemImages mcrops(std::move(crops));
+    uri = mcrops.uri(0);
+    ASSERT_EQ(0,mcrops.index(uri));
+    ASSERT_EQ(-1,mimgs.index(uri));
+    APIData ad;
+    std::vector<std::string> uris = { mimgs.uri(0), uri };
+    ad.add("data",uris);
+    ImgInputFileConn iifc_ext;
+    ASSERT_THROW(iifc_ext.transform(ad),InputConnectorBadParamException); // internal calls only
+    ad.add("mem_uris",true);
+    ImgInputFileConn iifc;
+    iifc._bw = true;
+    try
+      {
+	iifc.transform(ad);
+      }
+    catch (InputConnectorBadParamException &e)
+      {
+	std::cerr << e.what() << std::endl;
+	ASSERT_FALSE(true); // trigger
+      }
+    ASSERT_EQ(2,iifc._images.size());
+    for (size_t i=0;i<iifc._images.size();i++)
+      {
+	ASSERT_EQ(1,iifc._images.at(i).channels());
+	ASSERT_EQ(227,iifc._images.at(i).rows);
+	if (iifc._uris.at(i) == uri)
+	  {
+	    ASSERT_EQ(20,iifc._images_size.at(i).first);
+	    ASSERT_EQ(10,iifc._images_size.at(i).second);
+	  }
+      }
+  }
+  APIData ad; // images are released with their batch
+  std::vector<std::string> uris = { uri };
+  ad.add("data",uris);
+  ad.add("mem_uris",true);
+  ImgInputFileConn iifc;
+  ASSERT_THROW(iifc.transform(ad),InputConnectorBadParamException);
+}
+
+TEST(inputconn,img_tiles)
+{
+  std::vector<cv::Mat> imgs = { cv::Mat(300,500,CV_8UC3,cv::Scalar(0,0,255)),
+				cv::Mat(100,100,CV_8UC3,cv::Scalar(0,255,0)) };
+  MemImages mimgs(std::move(imgs));
+  APIData ad;
+  std::vector<std::string> uris = { mimgs.uri(0), mimgs.uri(1) };
+  ad.add("data",uris);
+  ad.add("mem_uris",true);
+  APIData ad_param,ad_input;
+  ad_input.add("tile_size",200);
+  ad_input.add("tile_overlap",0.2);
+  ad_input.add("width",200);
+  ad_input.add("height",200);
+  ad_param.add("input",ad_input);
+  ad.add("parameters",ad_param);
+  ImgInputFileConn iifc;
+  iifc.transform(ad);
+  ASSERT_EQ(7,iifc._images.size()); // 3x2 windows, and the small image as is
+  int ntiles = 0;
+  for (size_t i=0;i<iifc._uris.size();i++)
+    {
+      ASSERT_EQ(200,iifc._images.at(i).rows);
+      if (iifc._uris.at(i).find("#tile=") != std::string::npos)
+	{
+	  ++ntiles;
+	  ASSERT_EQ(200,iifc._images_size.at(i).first);
+	  ASSERT_EQ(200,iifc._images_size.at(i).second);
+	}
+      else ASSERT_EQ(mimgs.uri(1),iifc._uris.at(i));
+    }
+  ASSERT_EQ(6,ntiles);
+  ASSERT_TRUE(std::find(iifc._uris.begin(),iifc._uris.end(),mimgs.uri(0) + "#tile=300,100") != iifc._uris.end());
+}
+
+TEST(inputconn,img_video)
+{
+  std::string vfile = "ut_video.avi";
+  {
+    cv::VideoWriter writer(vfile,CV_FOURCC('M','J','P','G'),10,cv::Size(64,48));
+    if (!writer.isOpened())
+      {
+	std::cerr << "no video codec available, skipping" << std::endl;
+	return;
+      }
+    for (int f=0;f<20;f++)
+      writer << cv::Mat(48,64,CV_8UC3,cv::Scalar(f*10,0,0));
+  }
+  APIData ad;
+  std::vector<std::string> uris = { vfile };
+  ad.add("data",uris);
+  APIData ad_param,ad_input;
+  ad_input.add("video_stride",5);
+  ad_param.add("input",ad_input);
+  ad.add("parameters",ad_param);
+  ImgInputFileConn iifc;
+  iifc.transform(ad);
+  ASSERT_EQ(4,iifc._images.size());
+  ASSERT_EQ(4,iifc._uris.size());
+  ASSERT_EQ(48,iifc._images_size.at(0).first);
+  ASSERT_EQ(64,iifc._images_size.at(0).second);
+  for (const std::string &u: iifc._uris)
+    ASSERT_EQ(0,u.find(vfile + "#t="));
+
+  // sampled frames are bounded
+  ad_input.add("video_max_frames",2);
+  ad_param.add("input",ad_input);
+  ad.add("parameters",ad_param);
+  ImgInputFileConn iifc2;
+  iifc2.transform(ad);
+  ASSERT_EQ(2,iifc2._images.size());
+  ad_input.add("video_max_frames",0);
+  ad_param.add("input",ad_input);
+  ad.add("parameters",ad_param);
+  ImgInputFileConn iifc3;
+  ASSERT_THROW(iifc3.transform(ad),InputConnectorBadParamException);
+  remove(vfile.c_str());
+}
+
 //TODO: test csv scale, separator, categorical, ...
 TEST(inputconn,csv_mem1)
 {
@@ -248,6 +442,36 @@ TEST(inputconn,csv_mem1)
   ASSERT_EQ(2590,cifc._csvdata.at(0)._v.at(0));
 }
 
+TEST(inputconn,csv_shm)
+{
+  std::string no_header = "2590,56,2,212,5";
+  int fd = shm_open("/dd_ut_csv_shm",O_CREAT|O_RDWR,0600);
+  ASSERT_TRUE(fd >= 0);
+  ASSERT_EQ(0,ftruncate(fd,4096));
+  char *shm = static_cast<char*>(mmap(nullptr,4096,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0));
+  close(fd);
+  std::copy(no_header.begin(),no_header.end(),shm+100);
+  std::vector<std::string> vdata = { "shm://dd_ut_csv_shm?offset=100&size=" + std::to_string(no_header.size()) };
+  APIData ad;
+  ad.add("data",vdata);
+  CSVInputFileConn cifc;
+  cifc._train = false; // prediction mode
+  try
+    {
+      cifc.transform(ad);
+    }
+  catch (std::exception &e)
+    {
+      std::cerr << "exception=" << e.what() << std::endl;
+      ASSERT_FALSE(true);
+    }
+  munmap(shm,4096);
+  shm_unlink("/dd_ut_csv_shm");
+  ASSERT_EQ(1,cifc._csvdata.size());
+  ASSERT_EQ(5,cifc._csvdata.at(0)._v.size());
+  ASSERT_EQ(2590,cifc._csvdata.at(0)._v.at(0));
+}
+
 TEST(inputconn,csv_mem2)
 {
   std::string header = "id,val1,val2,val3,val4,val5";
@@ -428,6 +652,61 @@ TEST(inputconn,csv_ignore)
   remove("test.csv");
 }
 
+TEST(inputconn,txt_cache)
+{
+  mkdir("txt_cache_data",0755);
+  mkdir("txt_cache_data/pos",0755);
+  mkdir("txt_cache_data/neg",0755);
+  std::ofstream("txt_cache_data/pos/1.txt") << "everything runs fine, right?";
+  std::ofstream("txt_cache_data/neg/1.txt") << "nothing runs fine";
+  APIData ad;
+  ad.add("cache",true);
+  ad.add("min_count",1);
+  ad.add("min_word_length",1);
+  TxtInputFileConn tifc;
+  tifc._train = true;
+  tifc._model_repo = ".";
+  tifc.fillup_parameters(ad);
+  DDTxt ddt;
+  ddt._ctfc = &tifc;
+  ASSERT_EQ(0,ddt.read_dir("txt_cache_data"));
+  ASSERT_TRUE(fileops::file_exists("./txt_cache.dat"));
+
+  // second read comes from the cache
+  TxtInputFileConn tifc2;
+  tifc2._train = true;
+  tifc2._model_repo = ".";
+  tifc2.fillup_parameters(ad);
+  ddt._ctfc = &tifc2;
+  ASSERT_EQ(0,ddt.read_dir("txt_cache_data"));
+  ASSERT_EQ(5,tifc2._vocab.size());
+  ASSERT_EQ(tifc._vocab["fine"]._pos,tifc2._vocab["fine"]._pos);
+  ASSERT_EQ(2,tifc2._vocab["fine"]._total_docs);
+  ASSERT_EQ(tifc._txt.size(),tifc2._txt.size());
+  for (size_t i=0;i<tifc._txt.size();i++)
+    {
+      TxtBowEntry *tbe = static_cast<TxtBowEntry*>(tifc._txt.at(i));
+      TxtBowEntry *tbe2 = static_cast<TxtBowEntry*>(tifc2._txt.at(i));
+      ASSERT_EQ(tbe->_target,tbe2->_target);
+      ASSERT_EQ(tbe->_v,tbe2->_v);
+    }
+
+  // any change to the data invalidates the cache
+  std::ofstream("txt_cache_data/neg/1.txt",std::ios::app) << " today";
+  TxtInputFileConn tifc3;
+  tifc3._train = true;
+  tifc3._model_repo = ".";
+  tifc3.fillup_parameters(ad);
+  ddt._ctfc = &tifc3;
+  ASSERT_EQ(0,ddt.read_dir("txt_cache_data"));
+  ASSERT_EQ(6,tifc3._vocab.size());
+
+  fileops::clear_directory("txt_cache_data");
+  rmdir("txt_cache_data");
+  remove("txt_cache.dat");
+  remove("corresp.txt");
+}
+
 /*TEST(inputconn,txt_parse_content)
 {
   std::string str = "everything runs fine, right?";
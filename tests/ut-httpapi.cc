@@ -21,12 +21,24 @@
 
 #include "deepdetect.h"
 #include "httpjsonapi.h"
+#include "unixhttpserver.h"
 #include "utils/httpclient.hpp"
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <future>
 #include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace dd;
 
+DECLARE_int32(max_inflated_size);
+
 std::string host = "127.0.0.1";
 int port = 8080;
 int nthreads = 10;
@@ -76,10 +88,56 @@ TEST(httpjsonapi,info)
   ASSERT_TRUE(d.HasMember("head"));
   ASSERT_TRUE(d["head"].HasMember("services"));
   ASSERT_EQ(0,d["head"]["services"].Size());
+  ASSERT_TRUE(d["head"].HasMember("train_scheduler"));
+  ASSERT_TRUE(d["head"]["train_scheduler"]["cores"].GetInt() > 0);
+  ASSERT_EQ(0,d["head"]["train_scheduler"]["queued"].GetInt());
   
   hja.stop_server();
 }
 
+static std::string gzip_body(const std::string &body)
+{
+  std::stringstream in(body), out;
+  boost::iostreams::filtering_ostream gzout;
+  gzout.push(boost::iostreams::gzip_compressor());
+  gzout.push(out);
+  boost::iostreams::copy(in,gzout);
+  return out.str();
+}
+
+TEST(httpjsonapi,inflate_too_large)
+{
+  FLAGS_max_inflated_size = 1;
+  HttpJsonAPI hja;
+  hja.start_server_daemon(host,std::to_string(port),nthreads);
+  std::string luri = "http://" + host + ":" + std::to_string(port);
+  sleep(2);
+
+  // small compressed body is decompressed and routed
+  int code = -1;
+  std::string jstr;
+  std::string jpredict = "{\"service\":\"" + serv + "\",\"data\":[\"x\"]}";
+  httpclient::post_call(luri+"/predict",gzip_body(jpredict),"POST",code,jstr,"Content-Encoding: gzip");
+  ASSERT_EQ(400,code);
+  rapidjson::Document d;
+  d.Parse(jstr.c_str());
+  ASSERT_FALSE(d.HasParseError());
+  ASSERT_EQ(1002,d["status"]["dd_code"].GetInt()); // service not found, the body was parsed
+
+  // decompressed body beyond -max_inflated_size is rejected, whatever its compressed size
+  std::string big = "{\"service\":\"" + serv + "\",\"data\":[\"" + std::string(2*1024*1024,'x') + "\"]}";
+  std::string gzbig = gzip_body(big);
+  ASSERT_TRUE(gzbig.size() < 1024*1024);
+  httpclient::post_call(luri+"/predict",gzbig,"POST",code,jstr,"Content-Encoding: gzip");
+  ASSERT_EQ(413,code);
+  d.Parse(jstr.c_str());
+  ASSERT_FALSE(d.HasParseError());
+  ASSERT_EQ(413,d["status"]["code"].GetInt());
+
+  hja.stop_server();
+  FLAGS_max_inflated_size = 512;
+}
+
 TEST(httpjsonapi,services)
 {
   
@@ -499,3 +557,212 @@ TEST(httpjsonapi,predict)
   
   hja.stop_server();
 }
+
+static int unix_connect(const std::string &path)
+{
+  int fd = socket(AF_UNIX,SOCK_STREAM,0);
+  struct sockaddr_un addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path,path.c_str(),sizeof(addr.sun_path)-1);
+  if (connect(fd,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr)) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+  return fd;
+}
+
+static std::string unix_read(const int &fd, const size_t &nreplies)
+{
+  std::string out;
+  char chunk[4096];
+  size_t rstart = 0, hend = 0;
+  for (size_t r=0;r<nreplies;r++)
+    {
+      // headers, then body from Content-Length
+      while((hend = out.find("\r\n\r\n",rstart)) == std::string::npos)
+	{
+	  ssize_t n = recv(fd,chunk,sizeof(chunk),0);
+	  if (n <= 0)
+	    return out;
+	  out.append(chunk,n);
+	}
+      size_t cl = out.rfind("Content-Length: ",hend);
+      size_t bend = hend + 4 + std::stoul(out.substr(cl+16));
+      while(out.size() < bend)
+	{
+	  ssize_t n = recv(fd,chunk,sizeof(chunk),0);
+	  if (n <= 0)
+	    return out;
+	  out.append(chunk,n);
+	}
+      rstart = bend;
+    }
+  return out;
+}
+
+TEST(unixhttpserver,pipelining)
+{
+  std::string path = "ut_unix_pipelining.sock";
+  UnixHttpServer userv(path,[](const std::string &source, const std::string &method, const std::string &destination,
+			       const http_headers &headers, std::string &body,
+			       int &status, std::string &reply_body, http_headers &reply_headers)
+		       {
+			 (void)headers;
+			 (void)reply_headers;
+			 ASSERT_EQ("unix",source);
+			 status = destination == "/missing" ? 404 : 200;
+			 reply_body = method + " " + destination + " " + body;
+		       },2);
+  ASSERT_EQ(0,userv.start());
+  int fd = unix_connect(path);
+  ASSERT_TRUE(fd >= 0);
+
+  // pipelined requests on a kept-alive connection are answered in order
+  std::string reqs = "POST /predict HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody"
+    "GET /missing HTTP/1.1\r\n\r\n"
+    "GET /info HTTP/1.1\r\nConnection: close\r\n\r\n";
+  ASSERT_EQ(static_cast<ssize_t>(reqs.size()),send(fd,reqs.data(),reqs.size(),0));
+  std::string out = unix_read(fd,3);
+  std::cout << out << std::endl;
+  size_t r1 = out.find("HTTP/1.1 200 OK");
+  size_t r2 = out.find("HTTP/1.1 404 Not Found");
+  size_t r3 = out.rfind("HTTP/1.1 200 OK");
+  ASSERT_TRUE(r1 != std::string::npos);
+  ASSERT_TRUE(r2 != std::string::npos);
+  ASSERT_TRUE(r1 < r2 && r2 < r3);
+  ASSERT_TRUE(out.find("POST /predict body") < r2);
+  ASSERT_TRUE(out.find("GET /missing ") > r2);
+  ASSERT_TRUE(out.find("Connection: close") > r3);
+
+  // connection is closed after the last request
+  char c;
+  ASSERT_EQ(0,recv(fd,&c,1,0));
+  close(fd);
+  userv.stop();
+}
+
+TEST(unixhttpserver,stop_at_max_connections)
+{
+  std::string path = "ut_unix_stop.sock";
+  UnixHttpServer userv(path,[](const std::string &source, const std::string &method, const std::string &destination,
+			       const http_headers &headers, std::string &body,
+			       int &status, std::string &reply_body, http_headers &reply_headers)
+		       {
+			 (void)source;
+			 (void)method;
+			 (void)destination;
+			 (void)headers;
+			 (void)body;
+			 (void)reply_headers;
+			 status = 200;
+			 reply_body = "ok";
+		       },1);
+  ASSERT_EQ(0,userv.start());
+
+  // one idle keep-alive client holds the single slot, the next one waits to be accepted
+  int fd1 = unix_connect(path);
+  ASSERT_TRUE(fd1 >= 0);
+  std::string req = "GET /info HTTP/1.1\r\n\r\n";
+  send(fd1,req.data(),req.size(),0);
+  ASSERT_TRUE(unix_read(fd1,1).find("HTTP/1.1 200 OK") != std::string::npos);
+  int fd2 = unix_connect(path);
+  ASSERT_TRUE(fd2 >= 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::future<void> fstop = std::async(std::launch::async,[&userv](){ userv.stop(); });
+  ASSERT_EQ(std::future_status::ready,fstop.wait_for(std::chrono::seconds(10)));
+  close(fd1);
+  close(fd2);
+}
+
+TEST(unixhttpserver,max_body_size)
+{
+  std::string path = "ut_unix_body.sock";
+  int calls = 0;
+  UnixHttpServer userv(path,[&calls](const std::string &source, const std::string &method, const std::string &destination,
+				     const http_headers &headers, std::string &body,
+				     int &status, std::string &reply_body, http_headers &reply_headers)
+		       {
+			 (void)source;
+			 (void)method;
+			 (void)destination;
+			 (void)headers;
+			 (void)reply_headers;
+			 ++calls;
+			 status = 200;
+			 reply_body = body;
+		       },2,8);
+  ASSERT_EQ(0,userv.start());
+
+  // within the limit
+  int fd = unix_connect(path);
+  ASSERT_TRUE(fd >= 0);
+  std::string req = "POST /predict HTTP/1.1\r\nContent-Length: 8\r\n\r\n12345678";
+  send(fd,req.data(),req.size(),0);
+  ASSERT_TRUE(unix_read(fd,1).find("HTTP/1.1 200 OK") != std::string::npos);
+
+  // declared size over the limit is rejected before the body is read, and the connection closed
+  req = "POST /predict HTTP/1.1\r\nContent-Length: 1073741824\r\n\r\n123456789";
+  send(fd,req.data(),req.size(),0);
+  std::string out = unix_read(fd,1);
+  ASSERT_TRUE(out.find("HTTP/1.1 413 Payload Too Large") != std::string::npos);
+  ASSERT_TRUE(out.find("Connection: close") != std::string::npos);
+  char c;
+  ASSERT_EQ(0,recv(fd,&c,1,0));
+  close(fd);
+
+  // unparsable length
+  fd = unix_connect(path);
+  ASSERT_TRUE(fd >= 0);
+  req = "POST /predict HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n";
+  send(fd,req.data(),req.size(),0);
+  ASSERT_TRUE(unix_read(fd,1).find("HTTP/1.1 400 Bad Request") != std::string::npos);
+  close(fd);
+  ASSERT_EQ(1,calls);
+  userv.stop();
+}
+
+TEST(tcphttpserver,keep_alive)
+{
+  TcpHttpServer tserv("127.0.0.1","18089",[](const std::string &source, const std::string &method, const std::string &destination,
+					     const http_headers &headers, std::string &body,
+					     int &status, std::string &reply_body, http_headers &reply_headers)
+		      {
+			(void)method;
+			(void)headers;
+			(void)reply_headers;
+			status = 200;
+			reply_body = source + " " + destination + " " + body;
+		      },2,1024);
+  ASSERT_EQ(0,tserv.start());
+  int fd = socket(AF_INET,SOCK_STREAM,0);
+  struct sockaddr_in addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(18089);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0,connect(fd,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr)));
+
+  // pipelined requests on a single kept-alive connection
+  std::string reqs = "POST /predict HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody"
+    "GET /info HTTP/1.1\r\n\r\n";
+  send(fd,reqs.data(),reqs.size(),0);
+  std::string out = unix_read(fd,2);
+  ASSERT_TRUE(out.find("127.0.0.1 /predict body") != std::string::npos);
+  ASSERT_TRUE(out.find("127.0.0.1 /info ") != std::string::npos);
+  ASSERT_TRUE(out.find("Connection: close") == std::string::npos);
+
+  // body over the limit, the reply reaches the client while it is still sending
+  std::string big(4096,'x');
+  std::string req = "POST /predict HTTP/1.1\r\nContent-Length: " + std::to_string(big.size()) + "\r\n\r\n" + big;
+  send(fd,req.data(),req.size(),0);
+  out = unix_read(fd,1);
+  ASSERT_TRUE(out.find("HTTP/1.1 413 Payload Too Large") != std::string::npos);
+  close(fd);
+
+  std::thread tstop([&tserv](){ tserv.stop(); });
+  tserv.wait();
+  tstop.join();
+}
@@ -24,6 +24,7 @@
 #include <gtest/gtest.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fstream>
 #include <iostream>
 
 using namespace dd;
@@ -161,3 +162,165 @@ TEST(jsonapi,service_status)
   std::string here = "here";
   rmdir(here.c_str());
 }
+
+TEST(jsonapi,service_predict_mem_uris)
+{
+  // create service.
+  JsonAPI japi;
+  std::string sname = "my_service";
+  std::string jstr = "{\"mllib\":\"caffe\",\"description\":\"my classifier\",\"type\":\"supervised\",\"model\":{\"repository\":\"here\"},\"parameters\":{\"input\":{\"connector\":\"image\"},\"mllib\":{\"nclasses\":2}}}";
+  std::string joutstr = japi.jrender(japi.service_create(sname,jstr));
+  ASSERT_EQ(created_str,joutstr);
+
+  // in-memory images of other requests cannot be read by clients
+  for (std::string jpredstr: { "{\"service\":\"" + sname + "\",\"data\":[\"mem://0/0\"]}",
+	"{\"service\":\"" + sname + "\",\"mem_uris\":true,\"data\":[\"img.jpg\"]}" })
+    {
+      JDoc jd;
+      std::string jpredoutstr = japi.jrender(japi.service_predict(jpredstr));
+      jd.Parse(jpredoutstr.c_str());
+      ASSERT_TRUE(!jd.HasParseError());
+      ASSERT_EQ(400,jd["status"]["code"]);
+    }
+
+  std::string here = "here";
+  rmdir(here.c_str());
+}
+
+TEST(jsonapi,predict_fanout_merge)
+{
+  std::vector<cv::Mat> imgs = { cv::Mat(10,10,CV_8UC3), cv::Mat(10,10,CV_8UC3) };
+  MemImages mimgs(std::move(imgs));
+  std::vector<std::string> uris = { "img0.jpg", "img1.jpg" };
+  std::vector<std::string> snames = { "first", "second", "third" };
+  std::vector<APIData> outs(3);
+  std::vector<std::string> ferrors(3);
+  // first and second services, predictions not in input order
+  for (size_t f=0;f<2;f++)
+    {
+      std::vector<APIData> vpred;
+      for (int i: { 1, 0 })
+	{
+	  APIData p;
+	  p.add("uri",mimgs.uri(i));
+	  p.add("cat",snames.at(f) + std::to_string(i));
+	  vpred.push_back(p);
+	}
+      outs.at(f).add("predictions",vpred);
+    }
+  ferrors.at(2) = "third service failed";
+
+  std::vector<APIData> vpred = Services::merge_fanout(uris,mimgs,snames,outs,ferrors);
+  ASSERT_EQ(2,vpred.size());
+  for (APIData &p: vpred)
+    {
+      std::string uri = p.get("uri").get<std::string>();
+      std::string idx = uri == "img0.jpg" ? "0" : "1";
+      ASSERT_EQ("first" + idx,p.get("cat").get<std::string>());
+      APIData pserv = p.getobj("services");
+      ASSERT_EQ("second" + idx,pserv.getobj("second").get("cat").get<std::string>());
+      ASSERT_FALSE(pserv.getobj("second").has("uri"));
+      ASSERT_EQ("third service failed",pserv.getobj("third").get("error").get<std::string>());
+    }
+  ASSERT_EQ("img1.jpg",vpred.at(0).get("uri").get<std::string>());
+}
+
+static std::vector<std::string> manifest_lines(const std::string &fname)
+{
+  std::vector<std::string> lines;
+  std::ifstream inf(fname);
+  std::string line;
+  while(std::getline(inf,line))
+    lines.push_back(line);
+  return lines;
+}
+
+TEST(jsonapi,service_manifest)
+{
+  std::string manifest = "ut_manifest.jsonl";
+  remove(manifest.c_str());
+  std::string jstr = "{\"mllib\":\"caffe\",\"description\":\"my classifier\",\"type\":\"supervised\",\"model\":{\"repository\":\"here\"},\"parameters\":{\"input\":{\"connector\":\"image\"},\"mllib\":{\"nclasses\":2}}}";
+  std::string deljstr = "{\"clear\":\"mem\"}";
+
+  // created services are recorded, deleted ones are forgotten
+  {
+    JsonAPI japi;
+    japi.set_manifest(manifest);
+    ASSERT_EQ(created_str,japi.jrender(japi.service_create("serv1",jstr)));
+    ASSERT_EQ(created_str,japi.jrender(japi.service_create("serv2",jstr)));
+    ASSERT_EQ(2,manifest_lines(manifest).size());
+    ASSERT_EQ(ok_str,japi.jrender(japi.service_delete("serv1",deljstr)));
+    std::vector<std::string> lines = manifest_lines(manifest);
+    ASSERT_EQ(1,lines.size());
+    JDoc jd;
+    jd.Parse(lines.at(0).c_str());
+    ASSERT_TRUE(!jd.HasParseError());
+    ASSERT_EQ("serv2",std::string(jd["name"].GetString()));
+    ASSERT_EQ("my classifier",std::string(jd["call"]["description"].GetString()));
+  }
+
+  // services are restored from the manifest, which is written back unchanged,
+  // and bad entries are skipped
+  std::vector<std::string> lines = manifest_lines(manifest);
+  {
+    std::ofstream outf(manifest,std::ofstream::out|std::ofstream::app);
+    outf << "{\"name\":\"serv3\"}" << std::endl;
+  }
+  JsonAPI japi;
+  japi.set_manifest(manifest);
+  japi._restoring = true;
+  JDoc jh = japi.health();
+  ASSERT_EQ(503,jh["status"]["code"]);
+  ASSERT_FALSE(jh["body"]["ready"].GetBool());
+  japi.restore_services(2,false);
+  jh = japi.health();
+  ASSERT_EQ(200,jh["status"]["code"]);
+  ASSERT_TRUE(jh["body"]["ready"].GetBool());
+  ASSERT_EQ(1,jh["body"]["total"].GetInt());
+  ASSERT_EQ(1,jh["body"]["restored"].GetInt());
+  ASSERT_EQ(0,jh["body"]["failed"].Size());
+  ASSERT_TRUE(japi.service_exists("serv2"));
+  ASSERT_FALSE(japi.service_exists("serv3"));
+  ASSERT_EQ(lines,manifest_lines(manifest));
+
+  ASSERT_EQ(ok_str,japi.jrender(japi.service_delete("serv2",deljstr)));
+  ASSERT_EQ(0,manifest_lines(manifest).size());
+  remove(manifest.c_str());
+  std::string here = "here";
+  rmdir(here.c_str());
+}
+
+TEST(jsonapi,render_formats)
+{
+  JsonAPI japi;
+  JDoc jd;
+  jd.Parse("{\"status\":{\"code\":200},\"body\":{\"predictions\":[{\"uri\":\"a\",\"vals\":[0.123456789,1.5,-2.0]}]},\"format\":\"binary\",\"float_precision\":3}");
+  ASSERT_EQ("{\"status\":{\"code\":200},\"body\":{\"predictions\":[{\"uri\":\"a\",\"vals\":[0.123,1.5,-2]}]}}",japi.jrender(jd,3));
+
+  std::string bin = japi.jrender_binary(jd);
+  ASSERT_EQ("DDB1",bin.substr(0,4));
+  uint32_t hsize = 0;
+  memcpy(&hsize,bin.data()+4,4);
+  ASSERT_EQ("{\"status\":{\"code\":200},\"body\":{\"predictions\":[{\"uri\":\"a\",\"vals\":{\"offset\":0,\"length\":3}}]}}",bin.substr(8,hsize));
+  size_t offset = 8 + hsize;
+  offset += (4 - offset % 4) % 4;
+  ASSERT_EQ(offset+3*sizeof(float),bin.size());
+  float vals[3];
+  memcpy(vals,bin.data()+offset,sizeof(vals));
+  ASSERT_FLOAT_EQ(0.123456789,vals[0]);
+  ASSERT_FLOAT_EQ(1.5,vals[1]);
+  ASSERT_FLOAT_EQ(-2.0,vals[2]);
+
+  // classes are packed as probs and cats, other class members stay in classes
+  jd.Parse("{\"status\":{\"code\":200},\"body\":{\"predictions\":[{\"uri\":\"a\",\"classes\":[{\"prob\":0.75,\"cat\":\"dog\"},{\"prob\":0.25,\"cat\":\"cat\",\"last\":true}]},{\"uri\":\"b\",\"classes\":[{\"prob\":0.5,\"cat\":\"car\",\"bbox\":{\"xmin\":1.0}}]}]}}");
+  bin = japi.jrender_binary(jd);
+  memcpy(&hsize,bin.data()+4,4);
+  ASSERT_EQ("{\"status\":{\"code\":200},\"body\":{\"predictions\":[{\"uri\":\"a\",\"probs\":{\"offset\":0,\"length\":2},\"cats\":[\"dog\",\"cat\"]},{\"uri\":\"b\",\"probs\":{\"offset\":2,\"length\":1},\"cats\":[\"car\"],\"classes\":[{\"bbox\":{\"xmin\":1.0}}]}]}}",bin.substr(8,hsize));
+  offset = 8 + hsize;
+  offset += (4 - offset % 4) % 4;
+  ASSERT_EQ(offset+3*sizeof(float),bin.size());
+  memcpy(vals,bin.data()+offset,sizeof(vals));
+  ASSERT_FLOAT_EQ(0.75,vals[0]);
+  ASSERT_FLOAT_EQ(0.25,vals[1]);
+  ASSERT_FLOAT_EQ(0.5,vals[2]);
+}
@@ -0,0 +1,108 @@
+/**
+ * DeepDetect
+ * Copyright (c) 2017 Emmanuel Benazera
+ * Author: Emmanuel Benazera <beniz@droidnik.fr>
+ *
+ * This file is part of deepdetect.
+ *
+ * deepdetect is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * deepdetect is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with deepdetect.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "measurehistory.h"
+#include <gtest/gtest.h>
+#include <iostream>
+
+using namespace dd;
+
+TEST(measurehistory,recent)
+{
+  MeasureHistory mh(4,4);
+  ASSERT_EQ(-1,mh.last());
+  for (int i=0;i<3;i++)
+    mh.add(i);
+  ASSERT_EQ(2,mh.last());
+  ASSERT_EQ(3,mh.size());
+  std::vector<double> vals;
+  std::vector<long int> seqs;
+  mh.get(-1,vals,seqs);
+  ASSERT_EQ(3,vals.size());
+  ASSERT_EQ(3,seqs.size());
+  for (int i=0;i<3;i++)
+    {
+      ASSERT_EQ(i,vals.at(i));
+      ASSERT_EQ(i,seqs.at(i));
+    }
+  mh.get(1,vals,seqs);
+  ASSERT_EQ(1,vals.size());
+  ASSERT_EQ(2,vals.at(0));
+  ASSERT_EQ(2,seqs.at(0));
+  mh.get(2,vals,seqs);
+  ASSERT_TRUE(vals.empty());
+  ASSERT_TRUE(seqs.empty());
+}
+
+TEST(measurehistory,archive)
+{
+  MeasureHistory mh(4,4);
+  for (int i=0;i<30;i++)
+    mh.add(i);
+  ASSERT_EQ(29,mh.last());
+  std::vector<double> vals;
+  std::vector<long int> seqs;
+  mh.get(-1,vals,seqs);
+  ASSERT_EQ(vals.size(),seqs.size());
+  ASSERT_TRUE(vals.size() <= 9); // bounded: archive, partial stride and recent values
+  ASSERT_EQ(29,seqs.back());
+
+  // every point is the average of the values since the previous point
+  long int prev = -1;
+  for (size_t i=0;i<vals.size();i++)
+    {
+      ASSERT_TRUE(seqs.at(i) > prev);
+      ASSERT_DOUBLE_EQ(0.5*(prev+1+seqs.at(i)),vals.at(i));
+      prev = seqs.at(i);
+    }
+
+  // most recent values are kept as is
+  for (int i=0;i<4;i++)
+    {
+      ASSERT_EQ(26+i,seqs.at(vals.size()-4+i));
+      ASSERT_EQ(26+i,vals.at(vals.size()-4+i));
+    }
+}
+
+TEST(measurehistory,since)
+{
+  MeasureHistory mh(4,4);
+  for (int i=0;i<30;i++)
+    mh.add(i);
+  std::vector<double> avals, vals;
+  std::vector<long int> aseqs, seqs;
+  mh.get(-1,avals,aseqs);
+  mh.get(20,vals,seqs);
+
+  // points covering values after since, with their positions in the full history
+  ASSERT_FALSE(seqs.empty());
+  ASSERT_TRUE(seqs.at(0) > 20);
+  size_t first = avals.size() - vals.size();
+  ASSERT_TRUE(first == 0 || aseqs.at(first-1) <= 20);
+  for (size_t i=0;i<vals.size();i++)
+    {
+      ASSERT_EQ(aseqs.at(first+i),seqs.at(i));
+      ASSERT_EQ(avals.at(first+i),vals.at(i));
+    }
+
+  mh.get(mh.last(),vals,seqs);
+  ASSERT_TRUE(vals.empty());
+}